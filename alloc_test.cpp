@@ -0,0 +1,135 @@
+#include "reg_api.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// Allocation test for the read hot path
+//
+// Replaces the global operator new with a counting one, warms up
+// read_into, value_exists and read_number on a scratch key under HKCU, and
+// then checks that a loop of the same calls allocates nothing, with the
+// value cache disabled and enabled. Exits non-zero on failure.
+//
+//   reg_api_alloc_test
+
+namespace
+{
+    const char* const scratch_root = "Software\\reg_api_alloc_test";
+    const int loop_count = 1000;
+
+    // Counted only while armed, so setup and reporting stay out of it
+    std::atomic<bool> g_counting(false);
+    std::atomic<unsigned long long> g_allocations(0);
+
+    void* counted_alloc(size_t size)
+    {
+        if (g_counting.load(std::memory_order_relaxed))
+        {
+            ++g_allocations;
+        }
+        void* p = std::malloc(size == 0 ? 1 : size);
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    // One pass of the calls expected to be allocation-free; false if a
+    // value did not read back
+    bool read_pass(reg_api& reg, std::string& text, char* buffer, size_t capacity)
+    {
+        size_t length = 0;
+        bool ok = reg.read_into("name", text) && text == "alloc test value";
+        ok = reg.read_into("name", buffer, capacity, &length) && length == text.size() && ok;
+        ok = reg.value_exists("name") && !reg.value_exists("missing") && ok;
+        ok = reg.read_number<int>("count", 0) == 42 && ok;
+        ok = reg.read_number<double>("ratio", 0.0) == 0.5 && ok;
+        ok = reg.read_number<int>("missing", 7) == 7 && ok;
+        return ok;
+    }
+
+    // Warm up, then count the allocations of loop_count passes
+    bool check(reg_api& reg, const char* label)
+    {
+        std::string text;
+        char buffer[64];
+        bool ok = true;
+        for (int i = 0; i < 16; ++i)
+        {
+            ok = read_pass(reg, text, buffer, sizeof(buffer)) && ok;
+        }
+
+        g_allocations = 0;
+        g_counting = true;
+        for (int i = 0; i < loop_count; ++i)
+        {
+            ok = read_pass(reg, text, buffer, sizeof(buffer)) && ok;
+        }
+        g_counting = false;
+
+        unsigned long long allocations = g_allocations;
+        bool passed = ok && allocations == 0;
+        std::printf("%-8s %-5s %llu allocations in %d passes%s\n", label, passed ? "ok" : "FAIL",
+                    allocations, loop_count, ok ? "" : ", wrong values");
+        return passed;
+    }
+}
+
+void* operator new(size_t size)
+{
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size)
+{
+    return counted_alloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+int main()
+{
+    bool passed = true;
+    {
+        reg_api reg(HKEY_CURRENT_USER);
+        if (!reg.chroot(scratch_root))
+        {
+            std::printf("cannot open HKCU\\%s\n", scratch_root);
+            return 1;
+        }
+
+        reg.write_string("name", "alloc test value");
+        reg.write_number("count", 42);
+        reg.write_number("ratio", 0.5);
+
+        passed = check(reg, "uncached") && passed;
+
+        reg.enable_cache(true);
+        passed = check(reg, "cached") && passed;
+    }
+
+    RegDeleteTreeA(HKEY_CURRENT_USER, scratch_root);
+    RegDeleteKeyA(HKEY_CURRENT_USER, scratch_root);
+
+    return passed ? 0 : 1;
+}
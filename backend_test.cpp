@@ -0,0 +1,156 @@
+#include "reg_api.h"
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Test of reg_api over reg_api::memory_backend
+//
+// Drives reg_api and reg_api::shared on a memory_backend, with the value
+// cache off and on, chunked objects, and the chroot() loops that retire
+// shared keys whose handles belong to the backend. Exits non-zero on failure.
+//
+//   reg_api_backend_test
+
+namespace
+{
+    const int loop_count = 200;
+
+    bool report(const char* label, bool passed)
+    {
+        std::printf("%-24s %s\n", label, passed ? "ok" : "FAIL");
+        return passed;
+    }
+
+    // Typed values and the cache of a plain reg_api on the backend
+    bool check_reg_api(reg_api::memory_backend& store)
+    {
+        reg_api reg(store.root());
+        bool ok = reg.chroot("Software\\reg_api_backend_test");
+        ok = reg.write_string("name", "backend value") && ok;
+        ok = reg.write_number("count", 42) && ok;
+        ok = reg.read_string("name") == "backend value" && ok;
+
+        reg.enable_cache(true);
+        for (int i = 0; i < loop_count; ++i)
+        {
+            ok = reg.read_number<int>("count", 0) == 42 && ok;
+        }
+        ok = reg.write_number("count", 43) && reg.read_number<int>("count", 0) == 43 && ok;
+        ok = reg.delete_value("count") && !reg.value_exists("count") && ok;
+        return report("reg_api", ok);
+    }
+
+    struct big_obj
+    {
+        char bytes[4096];
+    };
+
+    // Fails every change below a chunk subkey
+    class failing_chunks : public reg_api::memory_backend
+    {
+        protected:
+            bool record(const change& c) override
+            {
+                return c.key_path.find(".reg_api_chunks") == std::string::npos;
+            }
+    };
+
+    // Writes over a manifest drop its chunks; a failed chunked write is
+    // reported, not stored as one value
+    bool check_chunks(reg_api::memory_backend& store)
+    {
+        reg_api reg(store.root());
+        bool ok = reg.chroot("Software\reg_api_chunk_test");
+        big_obj obj = {};
+        obj.bytes[100] = 'x';
+
+        reg.set_obj_chunking(1024, 512);
+        ok = reg.write_obj("obj", obj) && reg.subkey_names(".reg_api_chunks").size() == 1 && ok;
+        ok = reg.write_string("obj", "text") && reg.subkey_names(".reg_api_chunks").empty() && ok;
+
+        ok = reg.write_obj("obj", obj) && reg.subkey_names(".reg_api_chunks").size() == 1 && ok;
+        reg.set_obj_chunking(0);
+        ok = reg.write_obj("obj", obj) && reg.subkey_names(".reg_api_chunks").empty() && ok;
+        big_obj loaded = {};
+        ok = reg.read_obj("obj", loaded) && loaded.bytes[100] == 'x' && ok;
+
+        failing_chunks failing;
+        reg_api broken(failing.root());
+        ok = broken.chroot("Software\reg_api_chunk_test") && ok;
+        broken.set_obj_chunking(1024, 512);
+        ok = !broken.write_obj("obj", obj) && !broken.value_exists("obj") && ok;
+        return report("chunks", ok);
+    }
+
+    // Switching a shared between keys retires the old ones, which close
+    // their backend handles once no reader holds them
+    bool check_shared_chroot(reg_api::memory_backend& store)
+    {
+        bool ok = true;
+        for (int round = 0; round < 2; ++round)
+        {
+            reg_api::shared reg(store.root());
+            reg.enable_cache(round == 1);
+            for (int i = 0; i < loop_count; ++i)
+            {
+                const char* path = (i % 2 == 0) ? "shared\\a" : "shared\\b";
+                ok = reg.chroot(path) && ok;
+                ok = reg.write_number("index", i) && ok;
+                ok = reg.read_number<int>("index", -1) == i && ok;
+            }
+        }
+        return report("shared chroot", ok);
+    }
+
+    // Readers on several threads while a writer switches keys
+    bool check_shared_threads(reg_api::memory_backend& store)
+    {
+        reg_api::shared reg(store.root());
+        reg.enable_cache(true);
+        bool ok = reg.chroot("shared\\a") && reg.write_string("name", "a");
+        ok = reg.chroot("shared\\b") && reg.write_string("name", "b") && ok;
+
+        std::atomic<bool> stop(false);
+        std::atomic<int> bad(0);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; ++i)
+        {
+            readers.emplace_back([&]()
+            {
+                while (!stop)
+                {
+                    std::string name = reg.read_string("name");
+                    if (name != "a" && name != "b")
+                    {
+                        ++bad;
+                    }
+                }
+            });
+        }
+
+        for (int i = 0; i < loop_count; ++i)
+        {
+            ok = reg.chroot((i % 2 == 0) ? "shared\\a" : "shared\\b") && ok;
+        }
+        stop = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+        return report("shared threads", ok && bad == 0);
+    }
+}
+
+int main()
+{
+    bool passed = true;
+    reg_api::memory_backend store;
+
+    passed = check_reg_api(store) && passed;
+    passed = check_chunks(store) && passed;
+    passed = check_shared_chroot(store) && passed;
+    passed = check_shared_threads(store) && passed;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,429 @@
+#include "reg_api.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// reg_api benchmark harness
+//
+// Every case runs a warm-up sample and then a fixed number of timed
+// samples of ops_per_sample operations each. Per-sample ns/op values give
+// the p50/p99 columns; syscalls/op comes from reg_api::syscall_count().
+// Registry cases run against a scratch key under HKCU that is removed on
+// exit.
+//
+//   reg_api_bench [--samples N] [--json file|-]
+
+namespace
+{
+    const char* const scratch_root = "Software\\reg_api_bench";
+
+    // Keeps the optimizer from dropping the measured work
+    volatile size_t g_sink = 0;
+
+    struct bench_result
+    {
+        std::string name;
+        size_t bytes;               // Payload size, 0 when not applicable
+        size_t ops;                 // Timed operations over all samples
+        double p50;                 // ns/op
+        double p99;                 // ns/op
+        double mean;                // ns/op
+        double syscalls_per_op;
+    };
+
+    struct bench_config
+    {
+        size_t samples = 50;
+        std::string json_path;
+    };
+
+    double percentile(std::vector<double> values, double p)
+    {
+        std::sort(values.begin(), values.end());
+        size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+        return values[std::min(index, values.size() - 1)];
+    }
+
+    // Time fn(i) in samples of ops_per_sample calls; reg may be null for
+    // cases that never reach the registry
+    template<typename Fn>
+    bench_result measure(const bench_config& config, const std::string& name, size_t bytes,
+                         size_t ops_per_sample, reg_api* reg, Fn fn)
+    {
+        std::vector<double> per_op;
+        per_op.reserve(config.samples);
+
+        // Warm-up sample, not recorded
+        for (size_t i = 0; i < ops_per_sample; ++i)
+        {
+            fn(i);
+        }
+
+        unsigned long long syscalls_before = reg ? reg->syscall_count() : 0;
+        double total = 0.0;
+
+        for (size_t s = 0; s < config.samples; ++s)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < ops_per_sample; ++i)
+            {
+                fn(s * ops_per_sample + i);
+            }
+            auto stop = std::chrono::steady_clock::now();
+
+            double ns = std::chrono::duration<double, std::nano>(stop - start).count() / ops_per_sample;
+            per_op.push_back(ns);
+            total += ns;
+        }
+
+        bench_result result;
+        result.name = name;
+        result.bytes = bytes;
+        result.ops = config.samples * ops_per_sample;
+        result.p50 = percentile(per_op, 0.50);
+        result.p99 = percentile(per_op, 0.99);
+        result.mean = total / config.samples;
+        result.syscalls_per_op = reg
+            ? static_cast<double>(reg->syscall_count() - syscalls_before) / result.ops
+            : 0.0;
+        return result;
+    }
+
+    // Former number_to_string, kept here as the baseline
+    template<typename T>
+    std::string legacy_number_to_string(const T& value)
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(5) << value;
+        std::string str = oss.str();
+
+        if (str.find('.') != std::string::npos)
+        {
+            str = str.substr(0, str.find_last_not_of('0') + 1);
+            if (str.back() == '.')
+            {
+                str.pop_back();
+            }
+        }
+
+        return str;
+    }
+
+    // Former string_to_number, kept here as the baseline
+    template<typename T>
+    T legacy_string_to_number(const std::string& str, const T& default_val)
+    {
+        T result = default_val;
+        std::istringstream iss(str);
+
+        iss >> result;
+        if (iss.fail())
+        {
+            return default_val;
+        }
+
+        return result;
+    }
+
+    template<typename T>
+    void bench_number_text(const bench_config& config, std::vector<bench_result>& results,
+                           const char* type_name, const std::vector<T>& values)
+    {
+        const size_t ops = 4000;
+        const size_t n = values.size();
+        const std::string suffix = std::string(".") + type_name;
+
+        std::vector<std::string> texts;
+        for (const T& value : values)
+        {
+            texts.push_back(legacy_number_to_string(value));
+        }
+
+        results.push_back(measure(config, "format.stream" + suffix, 0, ops, nullptr, [&](size_t i)
+        {
+            g_sink += legacy_number_to_string(values[i % n]).size();
+        }));
+
+        results.push_back(measure(config, "format.fixed5" + suffix, 0, ops, nullptr, [&](size_t i)
+        {
+            char buffer[reg_api::number_buffer_size];
+            g_sink += reg_api::format_number(values[i % n], reg_api::float_format::fixed5, buffer, sizeof(buffer));
+        }));
+
+        results.push_back(measure(config, "format.shortest" + suffix, 0, ops, nullptr, [&](size_t i)
+        {
+            char buffer[reg_api::number_buffer_size];
+            g_sink += reg_api::format_number(values[i % n], reg_api::float_format::shortest, buffer, sizeof(buffer));
+        }));
+
+        results.push_back(measure(config, "parse.stream" + suffix, 0, ops, nullptr, [&](size_t i)
+        {
+            g_sink += static_cast<size_t>(legacy_string_to_number<T>(texts[i % n], T()));
+        }));
+
+        results.push_back(measure(config, "parse.charconv" + suffix, 0, ops, nullptr, [&](size_t i)
+        {
+            const std::string& text = texts[i % n];
+            T value = T();
+            reg_api::parse_number(text.data(), text.data() + text.size(), value);
+            g_sink += static_cast<size_t>(value);
+        }));
+    }
+
+    // Fixed-size trivially copyable payload for write_obj/read_obj
+    template<size_t N>
+    struct payload
+    {
+        unsigned char bytes[N];
+    };
+
+    template<size_t N>
+    void bench_obj(const bench_config& config, std::vector<bench_result>& results, reg_api& reg)
+    {
+        const size_t ops = N >= 4096 ? 20 : 200;
+        const std::string suffix = "." + std::to_string(N);
+
+        payload<N> value;
+        for (size_t i = 0; i < N; ++i)
+        {
+            value.bytes[i] = static_cast<unsigned char>(i * 31 + 7);
+        }
+
+        results.push_back(measure(config, "write_obj" + suffix, N, ops, &reg, [&](size_t i)
+        {
+            value.bytes[0] = static_cast<unsigned char>(i);
+            reg.write_obj("obj", value);
+        }));
+
+        results.push_back(measure(config, "read_obj" + suffix, N, ops, &reg, [&](size_t)
+        {
+            payload<N> out = reg.read_obj<payload<N>>("obj");
+            g_sink += out.bytes[N - 1];
+        }));
+    }
+
+    void bench_b64(const bench_config& config, std::vector<bench_result>& results, size_t size)
+    {
+        const size_t ops = size >= 4096 ? 100 : 2000;
+        const std::string suffix = "." + std::to_string(size);
+
+        std::string raw(size, '\0');
+        for (size_t i = 0; i < size; ++i)
+        {
+            raw[i] = static_cast<char>(i * 131 + 17);
+        }
+        std::string encoded = reg_api::b64(raw);
+
+        results.push_back(measure(config, "b64" + suffix, size, ops, nullptr, [&](size_t)
+        {
+            g_sink += reg_api::b64(raw).size();
+        }));
+
+        results.push_back(measure(config, "b64_d" + suffix, size, ops, nullptr, [&](size_t)
+        {
+            g_sink += reg_api::b64_d(encoded).size();
+        }));
+    }
+
+    void bench_registry(const bench_config& config, std::vector<bench_result>& results)
+    {
+        const size_t ops = 500;
+        const std::string key_a = std::string(scratch_root) + "\\a";
+        const std::string key_b = std::string(scratch_root) + "\\b";
+
+        reg_api reg(HKEY_CURRENT_USER);
+        if (!reg.chroot(key_a))
+        {
+            std::cerr << "cannot open scratch key HKCU\\" << key_a << std::endl;
+            return;
+        }
+
+        const std::string text = "The quick brown fox jumps over the lazy dog";
+        reg.write_string("str", text);
+        reg.write_number("int", 123456);
+        reg.write_number("dbl", 3.14159);
+
+        results.push_back(measure(config, "write_string", text.size(), ops, &reg, [&](size_t)
+        {
+            reg.write_string("str", text);
+        }));
+
+        results.push_back(measure(config, "read_string", text.size(), ops, &reg, [&](size_t)
+        {
+            g_sink += reg.read_string("str", "").size();
+        }));
+
+        results.push_back(measure(config, "read_number.int", sizeof(int), ops, &reg, [&](size_t)
+        {
+            g_sink += static_cast<size_t>(reg.read_number<int>("int", 0));
+        }));
+
+        results.push_back(measure(config, "read_number.double", sizeof(double), ops, &reg, [&](size_t)
+        {
+            g_sink += static_cast<size_t>(reg.read_number<double>("dbl", 0.0));
+        }));
+
+        bench_obj<16>(config, results, reg);
+        bench_obj<256>(config, results, reg);
+        bench_obj<4096>(config, results, reg);
+        bench_obj<65536>(config, results, reg);
+
+        results.push_back(measure(config, "chroot", 0, ops, &reg, [&](size_t i)
+        {
+            reg.chroot((i & 1) ? key_a : key_b);
+        }));
+
+        reg.enable_handle_pool(4);
+        results.push_back(measure(config, "chroot.pooled", 0, ops, &reg, [&](size_t i)
+        {
+            reg.chroot((i & 1) ? key_a : key_b);
+        }));
+
+        reg.close();
+        reg.clear_handle_pool();
+
+        RegDeleteTreeA(HKEY_CURRENT_USER, scratch_root);
+        RegDeleteKeyA(HKEY_CURRENT_USER, scratch_root);
+    }
+
+    // The registry cases against reg_api::memory_backend: library overhead
+    // without the registry
+    void bench_memory_backend(const bench_config& config, std::vector<bench_result>& results)
+    {
+        const size_t ops = 500;
+
+        reg_api::memory_backend store;
+        reg_api reg(store.root());
+        reg.chroot("a");
+
+        const std::string text = "The quick brown fox jumps over the lazy dog";
+        reg.write_string("str", text);
+        reg.write_number("int", 123456);
+
+        results.push_back(measure(config, "mem.write_string", text.size(), ops, &reg, [&](size_t)
+        {
+            reg.write_string("str", text);
+        }));
+
+        results.push_back(measure(config, "mem.read_string", text.size(), ops, &reg, [&](size_t)
+        {
+            g_sink += reg.read_string("str", "").size();
+        }));
+
+        results.push_back(measure(config, "mem.read_number.int", sizeof(int), ops, &reg, [&](size_t)
+        {
+            g_sink += static_cast<size_t>(reg.read_number<int>("int", 0));
+        }));
+
+        results.push_back(measure(config, "mem.chroot", 0, ops, &reg, [&](size_t i)
+        {
+            reg.chroot((i & 1) ? "a" : "b");
+        }));
+    }
+
+    void print_table(const std::vector<bench_result>& results)
+    {
+        std::cout << std::left << std::setw(28) << "case" << std::right
+                  << std::setw(10) << "bytes"
+                  << std::setw(12) << "p50 ns"
+                  << std::setw(12) << "p99 ns"
+                  << std::setw(12) << "mean ns"
+                  << std::setw(12) << "sys/op" << std::endl;
+
+        for (const bench_result& r : results)
+        {
+            std::cout << std::left << std::setw(28) << r.name << std::right << std::fixed
+                      << std::setw(10) << r.bytes
+                      << std::setprecision(1)
+                      << std::setw(12) << r.p50
+                      << std::setw(12) << r.p99
+                      << std::setw(12) << r.mean
+                      << std::setprecision(2)
+                      << std::setw(12) << r.syscalls_per_op << std::endl;
+        }
+    }
+
+    void write_json(std::ostream& out, const bench_config& config, const std::vector<bench_result>& results)
+    {
+        out << "{\n  \"samples\": " << config.samples << ",\n  \"results\": [\n";
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const bench_result& r = results[i];
+            char line[256];
+            std::snprintf(line, sizeof(line),
+                "    {\"name\": \"%s\", \"bytes\": %zu, \"ops\": %zu, \"p50_ns\": %.1f, \"p99_ns\": %.1f, "
+                "\"mean_ns\": %.1f, \"syscalls_per_op\": %.3f}%s\n",
+                r.name.c_str(), r.bytes, r.ops, r.p50, r.p99, r.mean, r.syscalls_per_op,
+                i + 1 < results.size() ? "," : "");
+            out << line;
+        }
+
+        out << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bench_config config;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--samples" && i + 1 < argc)
+        {
+            config.samples = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            config.json_path = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--samples N] [--json file|-]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<bench_result> results;
+
+    bench_number_text<int>(config, results, "int", { 0, 7, -42, 123456, 2147483647, -99999 });
+    bench_number_text<long long>(config, results, "int64", { 0LL, 9007199254740993LL, -1234567890123LL, 42LL });
+    bench_number_text<float>(config, results, "float", { 0.0f, 99.99f, -3.5f, 1234.5678f, 1e-3f });
+    bench_number_text<double>(config, results, "double", { 0.0, 3.14159, -2.718281828, 1e10, 1234567.891011 });
+
+    bench_b64(config, results, 16);
+    bench_b64(config, results, 4096);
+    bench_b64(config, results, 65536);
+
+    bench_registry(config, results);
+    bench_memory_backend(config, results);
+
+    if (config.json_path == "-")
+    {
+        write_json(std::cout, config, results);
+        return 0;
+    }
+
+    print_table(results);
+
+    if (!config.json_path.empty())
+    {
+        std::ofstream file(config.json_path);
+        if (!file)
+        {
+            std::cerr << "cannot write " << config.json_path << std::endl;
+            return 1;
+        }
+        write_json(file, config, results);
+    }
+
+    return 0;
+}
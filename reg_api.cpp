@@ -1,221 +1,7509 @@
 #include "reg_api.h"
 
+#ifdef _WIN32
+
+#include <ktmw32.h>
+#include <compressapi.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifndef REG_NOTIFY_THREAD_AGNOSTIC
+#define REG_NOTIFY_THREAD_AGNOSTIC 0x10000000L
+#endif
+
+namespace
+{
+    // UTF-8 <-> UTF-16 for text_encoding::utf8. Registry names and most
+    // string data are ASCII, which is converted 16 characters at a time;
+    // anything else takes the scalar path. Malformed input becomes U+FFFD.
+    static_assert(sizeof(wchar_t) == 2, "the W registry API works in UTF-16");
+
+    const wchar_t replacement_char = 0xFFFD;
+
+    // out must have room for in_size units; returns the units written
+    size_t utf8_to_utf16(const char* in, size_t in_size, wchar_t* out)
+    {
+        const unsigned char* s = reinterpret_cast<const unsigned char*>(in);
+        const unsigned char* end = s + in_size;
+        wchar_t* start = out;
+        
+        while (s < end)
+        {
+#if defined(_M_X64) || defined(__SSE2__)
+            // Zero-extend 16 ASCII bytes at once
+            while (end - s >= 16)
+            {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+                if (_mm_movemask_epi8(bytes) != 0)
+                {
+                    break;
+                }
+                
+                __m128i zero = _mm_setzero_si128();
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(bytes, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(bytes, zero));
+                s += 16;
+                out += 16;
+            }
+            
+            if (s == end)
+            {
+                break;
+            }
+#endif
+            unsigned lead = *s;
+            if (lead < 0x80)
+            {
+                *out++ = static_cast<wchar_t>(lead);
+                ++s;
+                continue;
+            }
+            
+            size_t length;
+            uint32_t code_point;
+            uint32_t smallest;
+            if ((lead & 0xE0) == 0xC0)
+            {
+                length = 2;
+                code_point = lead & 0x1F;
+                smallest = 0x80;
+            }
+            else if ((lead & 0xF0) == 0xE0)
+            {
+                length = 3;
+                code_point = lead & 0x0F;
+                smallest = 0x800;
+            }
+            else if ((lead & 0xF8) == 0xF0)
+            {
+                length = 4;
+                code_point = lead & 0x07;
+                smallest = 0x10000;
+            }
+            else
+            {
+                *out++ = replacement_char;
+                ++s;
+                continue;
+            }
+            
+            size_t i = 1;
+            while (i < length && s + i < end && (s[i] & 0xC0) == 0x80)
+            {
+                code_point = (code_point << 6) | (s[i] & 0x3F);
+                ++i;
+            }
+            
+            // Truncated sequences, overlong forms and surrogates
+            if (i < length || code_point < smallest || code_point > 0x10FFFF ||
+                (code_point >= 0xD800 && code_point <= 0xDFFF))
+            {
+                *out++ = replacement_char;
+                s += i;
+                continue;
+            }
+            
+            s += length;
+            if (code_point >= 0x10000)
+            {
+                code_point -= 0x10000;
+                *out++ = static_cast<wchar_t>(0xD800 + (code_point >> 10));
+                *out++ = static_cast<wchar_t>(0xDC00 + (code_point & 0x3FF));
+            }
+            else
+            {
+                *out++ = static_cast<wchar_t>(code_point);
+            }
+        }
+        
+        return static_cast<size_t>(out - start);
+    }
+
+    // out must have room for 3 * in_size bytes; returns the bytes written
+    size_t utf16_to_utf8(const wchar_t* in, size_t in_size, char* out)
+    {
+        const wchar_t* end = in + in_size;
+        char* start = out;
+        
+        while (in < end)
+        {
+#if defined(_M_X64) || defined(__SSE2__)
+            // Narrow 16 ASCII units at once
+            while (end - in >= 16)
+            {
+                __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+                __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 8));
+                __m128i non_ascii = _mm_and_si128(_mm_or_si128(low, high), _mm_set1_epi16(static_cast<short>(0xFF80)));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(non_ascii, _mm_setzero_si128())) != 0xFFFF)
+                {
+                    break;
+                }
+                
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(low, high));
+                in += 16;
+                out += 16;
+            }
+            
+            if (in == end)
+            {
+                break;
+            }
+#endif
+            uint32_t code_point = static_cast<uint16_t>(*in++);
+            if (code_point < 0x80)
+            {
+                *out++ = static_cast<char>(code_point);
+                continue;
+            }
+            
+            if (code_point >= 0xD800 && code_point <= 0xDFFF)
+            {
+                // Only a high surrogate followed by a low one is valid
+                uint32_t next = (in < end) ? static_cast<uint16_t>(*in) : 0;
+                if (code_point <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF)
+                {
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (next - 0xDC00);
+                    ++in;
+                }
+                else
+                {
+                    code_point = replacement_char;
+                }
+            }
+            
+            if (code_point < 0x800)
+            {
+                *out++ = static_cast<char>(0xC0 | (code_point >> 6));
+            }
+            else if (code_point < 0x10000)
+            {
+                *out++ = static_cast<char>(0xE0 | (code_point >> 12));
+                *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            }
+            else
+            {
+                *out++ = static_cast<char>(0xF0 | (code_point >> 18));
+                *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+                *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            }
+            *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+        
+        return static_cast<size_t>(out - start);
+    }
+
+    // Per-thread conversion buffers, reused by every W call of the thread
+    struct wide_scratch
+    {
+        std::vector<wchar_t> path;   // Key path or subkey name
+        std::vector<wchar_t> name;   // Value name
+        std::vector<wchar_t> data;   // UTF-16 string data
+        std::vector<char> text;      // UTF-8 string data
+    };
+
+    wide_scratch& thread_scratch()
+    {
+        thread_local wide_scratch scratch;
+        return scratch;
+    }
+
+    // Null-terminated UTF-16 copy of text in buffer; null stays null
+    const wchar_t* widen(const char* text, std::vector<wchar_t>& buffer)
+    {
+        if (text == nullptr)
+        {
+            return nullptr;
+        }
+        
+        size_t size = strlen(text);
+        if (buffer.size() < size + 1)
+        {
+            buffer.resize(size + 1);
+        }
+        
+        size_t units = utf8_to_utf16(text, size, buffer.data());
+        buffer[units] = L'\0';
+        return buffer.data();
+    }
+
+    bool is_string_type(DWORD type)
+    {
+        return type == REG_SZ || type == REG_EXPAND_SZ || type == REG_MULTI_SZ;
+    }
+
+    // Turn UTF-16 string data the W API left in data (capacity bytes) into
+    // UTF-8 in place. data_size goes from UTF-16 to UTF-8 bytes; a result
+    // that does not fit gives ERROR_MORE_DATA with the size it needs
+    LONG narrow_data(DWORD type, char* data, DWORD capacity, DWORD* data_size, LONG result)
+    {
+        if (!is_string_type(type) || data_size == nullptr)
+        {
+            return result;
+        }
+        
+        size_t units = *data_size / sizeof(wchar_t);
+        if (result == ERROR_MORE_DATA || data == nullptr)
+        {
+            // Upper bound; the UTF-8 form is at most three bytes per unit
+            *data_size = static_cast<DWORD>(units * 3);
+            return result;
+        }
+        
+        if (result != ERROR_SUCCESS)
+        {
+            return result;
+        }
+        
+        wide_scratch& scratch = thread_scratch();
+        if (scratch.data.size() < units)
+        {
+            scratch.data.resize(units);
+        }
+        memcpy(scratch.data.data(), data, units * sizeof(wchar_t));
+        
+        if (scratch.text.size() < units * 3)
+        {
+            scratch.text.resize(units * 3);
+        }
+        size_t size = utf16_to_utf8(scratch.data.data(), units, scratch.text.data());
+        
+        *data_size = static_cast<DWORD>(size);
+        if (size > capacity)
+        {
+            return ERROR_MORE_DATA;
+        }
+        
+        memcpy(data, scratch.text.data(), size);
+        return ERROR_SUCCESS;
+    }
+
+    // UTF-8 copy of a UTF-16 name into out (capacity bytes, terminator
+    // included); size receives its length
+    LONG narrow_name(const wchar_t* name, DWORD units, char* out, DWORD capacity, DWORD& size)
+    {
+        wide_scratch& scratch = thread_scratch();
+        if (scratch.text.size() < static_cast<size_t>(units) * 3)
+        {
+            scratch.text.resize(static_cast<size_t>(units) * 3);
+        }
+        
+        size = static_cast<DWORD>(utf16_to_utf8(name, units, scratch.text.data()));
+        if (size >= capacity)
+        {
+            return ERROR_MORE_DATA;
+        }
+        
+        memcpy(out, scratch.text.data(), size);
+        out[size] = '\0';
+        return ERROR_SUCCESS;
+    }
+
+    // The open backend key h_key stands for, or nullptr for a Win32 key
+    reg_api::backend::handle* backend_of(HKEY h_key)
+    {
+        return reg_api::backend::find(h_key);
+    }
+    
+    // Registry calls in either encoding; with wide set, names and string
+    // data are UTF-8 on our side and UTF-16 on the registry's. Backend
+    // handles go to their backend, which stores our bytes as they are
+    LONG reg_open(HKEY h_key, const char* key_path, REGSAM sam, HKEY& h_result, bool wide)
+    {
+        if (reg_api::backend::handle* parent = backend_of(h_key))
+        {
+            return reg_api::backend::open(*parent, key_path, false, h_result);
+        }
+        
+        if (wide)
+        {
+            return RegOpenKeyExW(h_key, widen(key_path, thread_scratch().path), 0, sam, &h_result);
+        }
+        return RegOpenKeyExA(h_key, key_path, 0, sam, &h_result);
+    }
+
+    LONG reg_create(HKEY h_key, const char* key_path, DWORD options, REGSAM sam, HKEY& h_result, bool wide)
+    {
+        if (reg_api::backend::handle* parent = backend_of(h_key))
+        {
+            return reg_api::backend::open(*parent, key_path, true, h_result);
+        }
+        
+        if (wide)
+        {
+            return RegCreateKeyExW(h_key, widen(key_path, thread_scratch().path), 0, NULL, options, sam,
+                                   NULL, &h_result, NULL);
+        }
+        return RegCreateKeyExA(h_key, key_path, 0, NULL, options, sam, NULL, &h_result, NULL);
+    }
+
+    LONG reg_query(HKEY h_key, const char* value_name, DWORD* type, char* data, DWORD* data_size, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->query(key->key, value_name, type, data, data_size);
+        }
+        
+        if (!wide)
+        {
+            return RegQueryValueExA(h_key, value_name, NULL, type, reinterpret_cast<BYTE*>(data), data_size);
+        }
+        
+        DWORD value_type = REG_NONE;
+        DWORD capacity = (data_size != nullptr) ? *data_size : 0;
+        LONG result = RegQueryValueExW(h_key, widen(value_name, thread_scratch().name), NULL, &value_type,
+                                       reinterpret_cast<BYTE*>(data), data_size);
+        if (type != nullptr)
+        {
+            *type = value_type;
+        }
+        
+        return narrow_data(value_type, data, capacity, data_size, result);
+    }
+
+    LONG reg_set(HKEY h_key, const char* value_name, DWORD type, const void* data, DWORD data_size, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->set(key->key, value_name, type, data, data_size);
+        }
+        
+        if (!wide)
+        {
+            return RegSetValueExA(h_key, value_name, 0, type, static_cast<const BYTE*>(data), data_size);
+        }
+        
+        wide_scratch& scratch = thread_scratch();
+        const wchar_t* name = widen(value_name, scratch.name);
+        
+        if (is_string_type(type) && data != nullptr)
+        {
+            // The data carries its own terminators
+            if (scratch.data.size() < data_size)
+            {
+                scratch.data.resize(data_size);
+            }
+            size_t units = utf8_to_utf16(static_cast<const char*>(data), data_size, scratch.data.data());
+            return RegSetValueExW(h_key, name, 0, type, reinterpret_cast<const BYTE*>(scratch.data.data()),
+                                  static_cast<DWORD>(units * sizeof(wchar_t)));
+        }
+        
+        return RegSetValueExW(h_key, name, 0, type, static_cast<const BYTE*>(data), data_size);
+    }
+
+    LONG reg_delete(HKEY h_key, const char* value_name, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->remove(key->key, value_name);
+        }
+        
+        if (wide)
+        {
+            return RegDeleteValueW(h_key, widen(value_name, thread_scratch().name));
+        }
+        return RegDeleteValueA(h_key, value_name);
+    }
+
+    LONG reg_delete_tree(HKEY h_key, const char* key_path, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->remove_tree(key->key, key_path);
+        }
+        
+        if (wide)
+        {
+            return RegDeleteTreeW(h_key, widen(key_path, thread_scratch().path));
+        }
+        return RegDeleteTreeA(h_key, key_path);
+    }
+
+    // Value count and the largest name (in bytes of our encoding, without
+    // terminator) and data of a key
+    LONG reg_info(HKEY h_key, DWORD* subkey_count, DWORD* max_subkey_size, DWORD* value_count,
+                  DWORD* max_name_size, DWORD* max_data_size, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->info(key->key, subkey_count, max_subkey_size, value_count, max_name_size, max_data_size);
+        }
+        
+        if (!wide)
+        {
+            return RegQueryInfoKeyA(h_key, NULL, NULL, NULL, subkey_count, max_subkey_size, NULL,
+                                    value_count, max_name_size, max_data_size, NULL, NULL);
+        }
+        
+        LONG result = RegQueryInfoKeyW(h_key, NULL, NULL, NULL, subkey_count, max_subkey_size, NULL,
+                                       value_count, max_name_size, max_data_size, NULL, NULL);
+        
+        // The W sizes count UTF-16 units; UTF-8 needs up to three bytes each
+        if (max_subkey_size != nullptr)
+        {
+            *max_subkey_size *= 3;
+        }
+        if (max_name_size != nullptr)
+        {
+            *max_name_size *= 3;
+        }
+        if (max_data_size != nullptr)
+        {
+            *max_data_size = *max_data_size / 2 * 3;
+        }
+        return result;
+    }
+
+    // RegEnumValue; name_size is the capacity of name on input and its
+    // length on output, like in the A API
+    LONG reg_enum_value(HKEY h_key, DWORD index, char* name, DWORD* name_size, DWORD* type,
+                        char* data, DWORD* data_size, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->enum_value(key->key, index, name, name_size, type, data, data_size);
+        }
+        
+        if (!wide)
+        {
+            return RegEnumValueA(h_key, index, name, name_size, NULL, type, reinterpret_cast<BYTE*>(data), data_size);
+        }
+        
+        // A UTF-8 name of name_size bytes has at most as many UTF-16 units
+        wide_scratch& scratch = thread_scratch();
+        if (scratch.name.size() < *name_size)
+        {
+            scratch.name.resize(*name_size);
+        }
+        
+        DWORD units = static_cast<DWORD>(scratch.name.size());
+        DWORD value_type = REG_NONE;
+        DWORD capacity = (data_size != nullptr) ? *data_size : 0;
+        LONG result = RegEnumValueW(h_key, index, scratch.name.data(), &units, NULL, &value_type,
+                                    reinterpret_cast<BYTE*>(data), data_size);
+        if (type != nullptr)
+        {
+            *type = value_type;
+        }
+        
+        if (result == ERROR_SUCCESS)
+        {
+            result = narrow_name(scratch.name.data(), units, name, *name_size, *name_size);
+        }
+        
+        return narrow_data(value_type, data, capacity, data_size, result);
+    }
+
+    LONG reg_enum_key(HKEY h_key, DWORD index, char* name, DWORD* name_size, bool wide)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            return key->owner->enum_key(key->key, index, name, name_size);
+        }
+        
+        if (!wide)
+        {
+            return RegEnumKeyExA(h_key, index, name, name_size, NULL, NULL, NULL, NULL);
+        }
+        
+        wide_scratch& scratch = thread_scratch();
+        if (scratch.path.size() < *name_size)
+        {
+            scratch.path.resize(*name_size);
+        }
+        
+        DWORD units = static_cast<DWORD>(scratch.path.size());
+        LONG result = RegEnumKeyExW(h_key, index, scratch.path.data(), &units, NULL, NULL, NULL, NULL);
+        if (result != ERROR_SUCCESS)
+        {
+            return result;
+        }
+        
+        return narrow_name(scratch.path.data(), units, name, *name_size, *name_size);
+    }
+    
+    // Asynchronous RegNotifyChangeKeyValue on h_key itself
+    LONG reg_notify(HKEY h_key, DWORD filter, HANDLE h_event)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            // The backend signals a copy of the event, which the callback
+            // keeps open until it ran or the key closed
+            HANDLE h_copy = NULL;
+            if (!DuplicateHandle(GetCurrentProcess(), h_event, GetCurrentProcess(), &h_copy, 0, FALSE,
+                                 DUPLICATE_SAME_ACCESS))
+            {
+                return static_cast<LONG>(GetLastError());
+            }
+            
+            std::shared_ptr<void> event(h_copy, CloseHandle);
+            return key->owner->notify(key->key, [event]() { SetEvent(event.get()); });
+        }
+        return RegNotifyChangeKeyValue(h_key, FALSE, filter, h_event, TRUE);
+    }
+    
+    LONG reg_close(HKEY h_key)
+    {
+        if (reg_api::backend::handle* key = backend_of(h_key))
+        {
+            reg_api::backend::close(key);
+            return ERROR_SUCCESS;
+        }
+        return RegCloseKey(h_key);
+    }
+}
+
+// One watched key. The notification is armed thread-agnostic so whichever
+// pool thread runs the callback can re-arm it; the callback then diffs the
+// key against the snapshot taken at the previous notification.
+struct reg_api::watch_entry
+{
+    std::string key_path;
+    watch_callback callback;
+    DWORD filter = 0;
+    text_encoding encoding = text_encoding::ansi;
+    HKEY h_key = NULL;
+    HANDLE h_event = NULL;
+    HANDLE h_wait = NULL;
+    
+    std::mutex mutex;                 // Serializes callbacks of this watch
+    snapshot values;                  // Contents at the last notification
+    std::vector<char> buffer;         // Query buffer of the callback
+    unsigned long long calls = 0;     // Registry calls made by the callback
+    
+    ~watch_entry()
+    {
+        // Blocks until a running callback returns
+        if (h_wait != NULL)
+        {
+            UnregisterWaitEx(h_wait, INVALID_HANDLE_VALUE);
+        }
+        if (h_key != NULL)
+        {
+            reg_close(h_key);
+        }
+        if (h_event != NULL)
+        {
+            CloseHandle(h_event);
+        }
+    }
+    
+    LONG arm()
+    {
+        ++calls;
+        return reg_notify(h_key, filter | REG_NOTIFY_THREAD_AGNOSTIC, h_event);
+    }
+    
+    static void CALLBACK on_signal(PVOID context, BOOLEAN timed_out)
+    {
+        watch_entry* self = static_cast<watch_entry*>(context);
+        if (timed_out)
+        {
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(self->mutex);
+        
+        // Re-arm before reading so a change made during the diff still fires
+        self->arm();
+        
+        snapshot current = load_key(self->h_key, self->buffer, self->calls, self->encoding);
+        std::vector<std::string> changed = current.changed_names(self->values);
+        self->values = std::move(current);
+        
+        self->callback(self->key_path, changed);
+    }
+};
+
+// Write-behind queue: an intrusive Vyukov MPSC queue feeding one consumer
+// thread. Producers never block; the consumer drains whatever is queued,
+// keeps only the last operation per (key, value name) and applies the rest
+// in one pass. Flush markers travel through the same queue, so a flush
+// completes exactly when everything queued before it has been applied.
+struct reg_api::write_behind_queue
+{
+    struct node
+    {
+        std::atomic<node*> next{nullptr};
+        HKEY h_key = NULL;
+        bool is_delete = false;
+        DWORD type = REG_NONE;
+        std::string name;
+        std::vector<char> data;
+        std::promise<bool>* flushed = nullptr;   // Set on flush markers
+        bool wide = false;                       // Through the W API
+    };
+    
+    std::atomic<node*> head;                     // Producers push here
+    node* tail;                                  // Consumer side only
+    node stub;
+    
+    std::atomic<bool> sleeping{false};           // Consumer waits on wake
+    std::atomic<bool> stopping{false};
+    HANDLE wake = NULL;
+    std::thread thread;
+    
+    std::atomic<unsigned long long> syscalls{0};
+    std::atomic<unsigned long long> queued{0};
+    std::atomic<unsigned long long> applied{0};
+    std::atomic<unsigned long long> coalesced{0};
+    std::atomic<unsigned long long> failed{0};
+    std::atomic<size_t> depth{0};
+    std::atomic<size_t> max_depth{0};
+    
+    write_behind_queue()
+        : head(&stub)
+        , tail(&stub)
+    {
+    }
+    
+    ~write_behind_queue()
+    {
+        stop();
+    }
+    
+    bool running() const
+    {
+        return thread.joinable();
+    }
+    
+    void start()
+    {
+        if (running())
+        {
+            return;
+        }
+        
+        wake = CreateEventA(NULL, FALSE, FALSE, NULL);
+        stopping = false;
+        thread = std::thread([this]() { run(); });
+    }
+    
+    // Apply everything still queued, then end the thread
+    void stop()
+    {
+        if (!running())
+        {
+            return;
+        }
+        
+        stopping = true;
+        SetEvent(wake);
+        thread.join();
+        
+        CloseHandle(wake);
+        wake = NULL;
+    }
+    
+    void push(node* n)
+    {
+        if (n->flushed == nullptr)
+        {
+            ++queued;
+            size_t current = ++depth;
+            size_t highest = max_depth.load(std::memory_order_relaxed);
+            while (current > highest && !max_depth.compare_exchange_weak(highest, current))
+            {
+            }
+        }
+        
+        link(n);
+        
+        // Only pay for SetEvent when the consumer is actually waiting
+        if (sleeping.exchange(false))
+        {
+            SetEvent(wake);
+        }
+    }
+    
+    void link(node* n)
+    {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        node* prev = head.exchange(n);
+        prev->next.store(n);
+    }
+    
+    // Null when empty, or while a producer is between exchange and link
+    node* pop()
+    {
+        node* t = tail;
+        node* next = t->next.load();
+        
+        if (t == &stub)
+        {
+            if (next == nullptr)
+            {
+                return nullptr;
+            }
+            tail = next;
+            t = next;
+            next = next->next.load();
+        }
+        
+        if (next != nullptr)
+        {
+            tail = next;
+            return t;
+        }
+        
+        if (t != head.load())
+        {
+            return nullptr;
+        }
+        
+        link(&stub);
+        
+        next = t->next.load();
+        if (next != nullptr)
+        {
+            tail = next;
+            return t;
+        }
+        return nullptr;
+    }
+    
+    bool empty() const
+    {
+        return tail->next.load() == nullptr && head.load() == tail;
+    }
+    
+    void run()
+    {
+        std::vector<node*> pending;                     // Surviving operations, first-seen order
+        std::unordered_map<std::string, size_t> latest; // (key, lower-cased name) -> pending slot
+        std::string lookup;
+        bool ok = true;                                 // Since the last flush marker
+        
+        for (;;)
+        {
+            while (node* n = pop())
+            {
+                if (n->flushed != nullptr)
+                {
+                    ok = apply(pending, latest) && ok;
+                    n->flushed->set_value(ok);
+                    ok = true;
+                    delete n->flushed;
+                    delete n;
+                    continue;
+                }
+                
+                --depth;
+                
+                lookup.assign(reinterpret_cast<const char*>(&n->h_key), sizeof(n->h_key));
+                for (char ch : n->name)
+                {
+                    lookup.push_back(static_cast<char>(tolower(static_cast<unsigned char>(ch))));
+                }
+                
+                auto it = latest.find(lookup);
+                if (it != latest.end())
+                {
+                    // Last write wins
+                    ++coalesced;
+                    delete pending[it->second];
+                    pending[it->second] = n;
+                }
+                else
+                {
+                    latest.emplace(lookup, pending.size());
+                    pending.push_back(n);
+                }
+            }
+            
+            ok = apply(pending, latest) && ok;
+            
+            if (stopping && empty())
+            {
+                break;
+            }
+            
+            // Re-check after announcing the wait so no push is missed
+            sleeping = true;
+            if (empty() && !stopping)
+            {
+                WaitForSingleObject(wake, INFINITE);
+            }
+            sleeping = false;
+        }
+    }
+    
+    bool apply(std::vector<node*>& pending, std::unordered_map<std::string, size_t>& latest)
+    {
+        bool ok = true;
+        
+        for (node* n : pending)
+        {
+            ++syscalls;
+            LONG result = n->is_delete
+                ? reg_delete(n->h_key, n->name.c_str(), n->wide)
+                : reg_set(
+                    n->h_key,
+                    n->name.c_str(),
+                    n->type,
+                    n->data.data(),
+                    static_cast<DWORD>(n->data.size()),
+                    n->wide
+                );
+            
+            ++applied;
+            
+            // Deleting a value that never reached the registry is not an error
+            if (result != ERROR_SUCCESS && !(n->is_delete && result == ERROR_FILE_NOT_FOUND))
+            {
+                ++failed;
+                ok = false;
+            }
+            
+            delete n;
+        }
+        
+        pending.clear();
+        latest.clear();
+        return ok;
+    }
+};
+
+namespace
+{
+    // Process-wide pool of RegConnectRegistryA connections, shared by every
+    // reg_api of a (machine, root) pair. Registry handles can be used from
+    // several threads at once, so an in-use connection is shared too; idle
+    // ones are kept up to capacity, least recently used first to go.
+    struct remote_connection_pool
+    {
+        struct entry
+        {
+            std::string machine;          // Lower-cased, without leading backslashes
+            HKEY h_root_key;              // Predefined key that was connected
+            HKEY h_key;                   // Connection
+            size_t refs;
+            unsigned long long last_used;
+        };
+        
+        std::mutex mutex;
+        std::vector<entry> entries;
+        size_t idle_capacity = 64;
+        unsigned long long tick = 0;
+        reg_api::remote_pool_stats stats = reg_api::remote_pool_stats();
+        
+        static std::string normalize(const std::string& machine_name)
+        {
+            size_t start = machine_name.find_first_not_of('\\');
+            std::string machine = (start == std::string::npos) ? std::string() : machine_name.substr(start);
+            for (char& ch : machine)
+            {
+                ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+            }
+            return machine;
+        }
+        
+        // Take a reference on a pooled connection; caller holds mutex
+        bool reuse(const std::string& machine, HKEY h_root_key, HKEY& h_key)
+        {
+            for (entry& item : entries)
+            {
+                if (item.h_root_key == h_root_key && item.machine == machine)
+                {
+                    ++item.refs;
+                    item.last_used = ++tick;
+                    ++stats.reuses;
+                    h_key = item.h_key;
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        LONG acquire(const std::string& machine_name, HKEY h_root_key, HKEY& h_key)
+        {
+            std::string machine = normalize(machine_name);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (reuse(machine, h_root_key, h_key))
+                {
+                    return ERROR_SUCCESS;
+                }
+            }
+            
+            // Connecting can take seconds; do not hold up other hosts
+            std::string unc = "\\\\" + machine;
+            HKEY h_connected = NULL;
+            LONG result = RegConnectRegistryA(unc.c_str(), h_root_key, &h_connected);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            ++stats.connects;
+            if (result != ERROR_SUCCESS)
+            {
+                ++stats.failures;
+                return result;
+            }
+            
+            // Another thread may have connected to the host meanwhile
+            if (reuse(machine, h_root_key, h_key))
+            {
+                reg_close(h_connected);
+                return ERROR_SUCCESS;
+            }
+            
+            entry item;
+            item.machine = machine;
+            item.h_root_key = h_root_key;
+            item.h_key = h_connected;
+            item.refs = 1;
+            item.last_used = ++tick;
+            entries.push_back(item);
+            
+            h_key = h_connected;
+            return ERROR_SUCCESS;
+        }
+        
+        void release(HKEY h_key)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (entry& item : entries)
+            {
+                if (item.h_key == h_key)
+                {
+                    --item.refs;
+                    item.last_used = ++tick;
+                    break;
+                }
+            }
+            trim();
+        }
+        
+        // Close idle connections beyond the capacity; caller holds mutex
+        void trim()
+        {
+            for (;;)
+            {
+                size_t idle = 0;
+                auto oldest = entries.end();
+                for (auto it = entries.begin(); it != entries.end(); ++it)
+                {
+                    if (it->refs == 0)
+                    {
+                        ++idle;
+                        if (oldest == entries.end() || it->last_used < oldest->last_used)
+                        {
+                            oldest = it;
+                        }
+                    }
+                }
+                
+                if (idle <= idle_capacity)
+                {
+                    return;
+                }
+                
+                reg_close(oldest->h_key);
+                entries.erase(oldest);
+            }
+        }
+    };
+
+    // Never destroyed, so late releases from detached readers stay valid
+    remote_connection_pool& remote_pool()
+    {
+        static remote_connection_pool* instance = new remote_connection_pool();
+        return *instance;
+    }
+}
+
+// Shared with the prefetch threads; the keys they read wait here for chroot()
+struct reg_api::prefetch_state
+{
+    // One key of the plan; the fields below value_names are guarded by mutex
+    // once a thread claimed the key
+    struct key_entry
+    {
+        std::string key_path;                                     // As planned
+        std::string lookup_path;                                  // Lower-cased
+        std::vector<std::string> value_names;                     // Empty for every value
+        HKEY h_key = NULL;                                        // Open handle, NULL if not opened
+        HANDLE h_change = NULL;                                   // Signaled once the key changed
+        std::vector<std::pair<std::string, cached_value>> values; // Lower-cased name -> value
+        bool done = false;
+    };
+    
+    HKEY h_root_key = NULL;
+    REGSAM sam = KEY_READ | KEY_WRITE;            // KEY_READ on a remote registry
+    text_encoding encoding = text_encoding::ansi;
+    std::vector<key_entry> keys;
+    std::atomic<size_t> next{0};                  // Next key to claim
+    std::atomic<unsigned long long> syscalls{0};  // Registry calls of the threads
+    std::mutex mutex;
+    std::condition_variable ready;                // A key is done
+    size_t remaining = 0;                         // Keys not done yet, guarded by mutex
+    bool all_opened = true;                       // Guarded by mutex
+    std::promise<bool> finished;
+    
+    ~prefetch_state()
+    {
+        // Keys no chroot() took
+        for (key_entry& key : keys)
+        {
+            if (key.h_key != NULL)
+            {
+                reg_close(key.h_key);
+            }
+            if (key.h_change != NULL)
+            {
+                CloseHandle(key.h_change);
+            }
+        }
+    }
+    
+    void read_key(key_entry& key, std::vector<char>& buffer)
+    {
+        bool wide = (encoding == text_encoding::utf8);
+        unsigned long long calls = 0;
+        HKEY h_key = NULL;
+        HANDLE h_change = NULL;
+        std::vector<std::pair<std::string, cached_value>> values;
+        
+        ++calls;
+        if (reg_open(h_root_key, key.key_path.c_str(), sam, h_key, wide) != ERROR_SUCCESS)
+        {
+            h_key = NULL;
+        }
+        else
+        {
+            // Armed before the read, so chroot() can tell whether the values
+            // are still current. The thread exits before chroot() runs.
+            h_change = CreateEventA(NULL, TRUE, FALSE, NULL);
+            ++calls;
+            if (h_change != NULL && reg_notify(h_key, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET |
+                                                          REG_NOTIFY_THREAD_AGNOSTIC, h_change) != ERROR_SUCCESS)
+            {
+                CloseHandle(h_change);
+                h_change = NULL;
+            }
+        }
+        
+        if (h_change != NULL && key.value_names.empty())
+        {
+            snapshot all = load_key(h_key, buffer, calls, encoding);
+            values.reserve(all.m_index.size());
+            for (const snapshot::entry& item : all.m_index)
+            {
+                values.emplace_back();
+                values.back().first.assign(all.m_blob.data() + item.name_offset, item.name_size);
+                values.back().second.result = ERROR_SUCCESS;
+                values.back().second.type = item.type;
+                values.back().second.data.assign(all.m_blob.data() + item.data_offset,
+                                                 all.m_blob.data() + item.data_offset + item.data_size);
+            }
+        }
+        else if (h_change != NULL)
+        {
+            // Missing values are kept too, like the cache does
+            values.reserve(key.value_names.size());
+            for (const std::string& value_name : key.value_names)
+            {
+                DWORD type = REG_NONE;
+                DWORD data_size = 0;
+                LONG result = query_buffer(h_key, value_name.c_str(), buffer, type, data_size, calls, encoding);
+                if (result != ERROR_SUCCESS && result != ERROR_FILE_NOT_FOUND)
+                {
+                    continue;
+                }
+                
+                values.emplace_back();
+                values.back().first = value_name;
+                values.back().second.result = result;
+                values.back().second.type = (result == ERROR_SUCCESS) ? type : REG_NONE;
+                if (result == ERROR_SUCCESS)
+                {
+                    values.back().second.data.assign(buffer.data(), buffer.data() + data_size);
+                }
+            }
+        }
+        
+        for (std::pair<std::string, cached_value>& value : values)
+        {
+            for (char& ch : value.first)
+            {
+                ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+            }
+        }
+        
+        syscalls += calls;
+        
+        bool last = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            key.h_key = h_key;
+            key.h_change = h_change;
+            key.values = std::move(values);
+            key.done = true;
+            all_opened = all_opened && (h_key != NULL);
+            last = (--remaining == 0);
+        }
+        ready.notify_all();
+        
+        if (last)
+        {
+            finished.set_value(all_opened);
+        }
+    }
+    
+    // Block until every planned key is done
+    void wait_all()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]() { return remaining == 0; });
+    }
+};
+
+namespace
+{
+    // Bounded executor of the co_await API: a few threads taking tasks from
+    // one queue. Each task drains one instance, so instances never block
+    // each other for longer than a pass and the thread count stays fixed.
+    struct async_executor
+    {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::function<void()>> tasks;
+        
+        async_executor()
+        {
+            size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), 4);
+            for (size_t t = 0; t < threads; ++t)
+            {
+                std::thread([this]() { run(); }).detach();
+            }
+        }
+        
+        void post(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            ready.notify_one();
+        }
+        
+        void run()
+        {
+            for (;;)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this]() { return !tasks.empty(); });
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+    };
+    
+    // Never destroyed, its threads run until the process ends
+    async_executor& async_pool()
+    {
+        static async_executor* instance = new async_executor();
+        return *instance;
+    }
+}
+
+// Shared with the executor; at most one drain of an instance is queued or
+// running at a time, which keeps the instance single-threaded
+struct reg_api::async_strand
+{
+    std::mutex mutex;
+    std::condition_variable idle;               // scheduled went false
+    std::vector<async_request*> pending;        // Guarded by mutex
+    bool scheduled = false;                     // A drain is queued or running, guarded by mutex
+    async_scheduler scheduler;                  // Guarded by mutex
+    std::atomic<unsigned long long> operations{0};
+    std::atomic<unsigned long long> drains{0};
+    std::atomic<unsigned long long> reads{0};
+    std::atomic<size_t> largest_drain{0};
+    
+    // Block until no drain is queued or running
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return !scheduled; });
+    }
+};
+
 reg_api::reg_api(HKEY h_root_key)
     : m_h_root_key(h_root_key)
     , m_h_key(NULL)
-    , m_is_open(false)
+    , m_is_open(false)
+    , m_key_pooled(false)
+    , m_storage_mode(storage_mode::string)
+    , m_float_format(float_format::fixed5)
+    , m_obj_format(obj_format::legacy)
+    , m_obj_compression(0)
+    , m_chunk_threshold(0)
+    , m_chunk_size(default_chunk_size)
+    , m_chunk_key(chunk_key_state::unknown)
+    , m_text_encoding(text_encoding::ansi)
+    , m_syscall_count(0)
+    , m_cache_enabled(false)
+    , m_cache_stats()
+    , m_cache_generation(0)
+    , m_change_generation(0)
+    , m_watch_ok(false)
+    , m_watch_stop(NULL)
+    , m_memory_resource(nullptr)
+    , m_index_enabled(false)
+    , m_index_built(false)
+    , m_index_generation(0)
+    , m_index_stats()
+    , m_pool_capacity(0)
+    , m_pool_tick(0)
+    , m_pool_stats()
+    , m_next_watch_id(0)
+{
+}
+
+reg_api::~reg_api()
+{
+    // Awaited operations still use the instance
+    if (m_async)
+    {
+        m_async->wait_idle();
+    }
+    
+    m_watches.clear();
+    close();
+    m_write_behind.reset();
+    
+    // Prefetch threads may still use the root key
+    if (m_prefetch)
+    {
+        m_prefetch->wait_all();
+        m_prefetch.reset();
+    }
+    
+    // Views must not outlive the instance, so every pooled handle is idle now
+    for (pool_entry& entry : m_pool)
+    {
+        ++m_syscall_count;
+        reg_close(entry.h_key);
+    }
+    m_pool.clear();
+    
+    // Keys opened through the connection are all closed now
+    if (is_remote() && m_h_root_key != NULL)
+    {
+        remote_pool().release(m_h_root_key);
+    }
+}
+
+bool reg_api::chroot(const std::string& key_path, key_lifetime lifetime)
+{
+    op_scope scope(op_kind::chroot, &m_syscall_count);
+    
+    // Close any previously opened key
+    close();
+    
+    // A prefetched key comes with its handle and values
+    if (adopt_prefetched(key_path))
+    {
+        return true;
+    }
+    
+    // A remote registry is only read: its keys are opened, never created
+    if (is_remote())
+    {
+        return open_read_only(key_path);
+    }
+    
+    // Open the registry key, creating it if it doesn't exist
+    DWORD options = (lifetime == key_lifetime::volatile_key) ? REG_OPTION_VOLATILE : REG_OPTION_NON_VOLATILE;
+    LONG result = acquire_key(key_path, m_h_key, m_key_pooled, options);
+    
+    m_is_open = (result == ERROR_SUCCESS);
+    
+    if (m_is_open)
+    {
+        m_key_path = key_path;
+    }
+    
+    if (m_is_open && (m_cache_enabled || m_index_enabled))
+    {
+        start_watcher();
+    }
+    
+    return m_is_open;
+}
+
+void reg_api::close()
+{
+    // The cache and the index belong to the open key
+    stop_watcher();
+    m_cache.clear();
+    m_index_built = false;
+    m_index.clear();
+    m_index_names.clear();
+    m_index_dirty.clear();
+    m_chunk_key = chunk_key_state::unknown;
+    
+    if (m_is_open && m_h_key != NULL)
+    {
+        // Queued writes still refer to the handle
+        if (write_behind_enabled())
+        {
+            flush().wait();
+        }
+        
+        release_key(m_h_key, m_key_pooled);
+        m_h_key = NULL;
+        m_is_open = false;
+        m_key_pooled = false;
+        m_key_path.clear();
+    }
+}
+
+LONG reg_api::open_registry(HKEY h_root_key, const char* key_path, REGSAM sam, HKEY& h_key, DWORD options)
+{
+    // Keys of a remote registry are opened, never created
+    if (is_remote())
+    {
+        ++m_syscall_count;
+        return reg_open(h_root_key, key_path, sam, h_key, m_text_encoding == text_encoding::utf8);
+    }
+    return open_or_create(h_root_key, key_path, sam, h_key, m_syscall_count, m_text_encoding, options);
+}
+
+LONG reg_api::open_or_create(HKEY h_root_key, const char* key_path, REGSAM sam, HKEY& h_key,
+                             unsigned long long& calls, text_encoding encoding, DWORD options)
+{
+    bool wide = (encoding == text_encoding::utf8);
+    
+    // Try to open the registry key
+    ++calls;
+    LONG result = reg_open(h_root_key, key_path, sam, h_key, wide);
+    
+    // If key doesn't exist, try to create it
+    if (result != ERROR_SUCCESS)
+    {
+        ++calls;
+        result = reg_create(h_root_key, key_path, options, sam, h_key, wide);
+    }
+    
+    return result;
+}
+
+LONG reg_api::set_registry(HKEY h_key, const char* value_name, DWORD type, const void* data, DWORD data_size)
+{
+    ++m_syscall_count;
+    return reg_set(h_key, value_name, type, data, data_size, m_text_encoding == text_encoding::utf8);
+}
+
+LONG reg_api::delete_registry(HKEY h_key, const char* value_name)
+{
+    ++m_syscall_count;
+    return reg_delete(h_key, value_name, m_text_encoding == text_encoding::utf8);
+}
+
+LONG reg_api::acquire_key(const std::string& key_path, HKEY& h_key, bool& pooled, DWORD options)
+{
+    const REGSAM sam = is_remote() ? KEY_READ : KEY_READ | KEY_WRITE;
+    pooled = false;
+    
+    if (m_pool_capacity == 0)
+    {
+        return open_registry(m_h_root_key, key_path.c_str(), sam, h_key, options);
+    }
+    
+    // Key paths are case-insensitive
+    std::string pool_path(key_path);
+    for (char& ch : pool_path)
+    {
+        ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    
+    for (pool_entry& entry : m_pool)
+    {
+        if (entry.h_root_key == m_h_root_key && entry.sam == sam && entry.key_path == pool_path)
+        {
+            ++m_pool_stats.hits;
+            ++entry.refs;
+            entry.last_used = ++m_pool_tick;
+            h_key = entry.h_key;
+            pooled = true;
+            return ERROR_SUCCESS;
+        }
+    }
+    
+    ++m_pool_stats.misses;
+    
+    LONG result = open_registry(m_h_root_key, key_path.c_str(), sam, h_key, options);
+    if (result != ERROR_SUCCESS)
+    {
+        return result;
+    }
+    
+    // Make room by closing the least recently used idle handle
+    if (m_pool.size() >= m_pool_capacity)
+    {
+        auto victim = m_pool.end();
+        for (auto it = m_pool.begin(); it != m_pool.end(); ++it)
+        {
+            if (it->refs == 0 && (victim == m_pool.end() || it->last_used < victim->last_used))
+            {
+                victim = it;
+            }
+        }
+        
+        if (victim == m_pool.end())
+        {
+            // Every pooled handle is in use; hand this one out unpooled
+            return ERROR_SUCCESS;
+        }
+        
+        ++m_pool_stats.evictions;
+        ++m_syscall_count;
+        reg_close(victim->h_key);
+        m_pool.erase(victim);
+    }
+    
+    pool_entry entry;
+    entry.h_root_key = m_h_root_key;
+    entry.key_path = pool_path;
+    entry.sam = sam;
+    entry.h_key = h_key;
+    entry.refs = 1;
+    entry.last_used = ++m_pool_tick;
+    m_pool.push_back(entry);
+    
+    pooled = true;
+    return ERROR_SUCCESS;
+}
+
+void reg_api::release_key(HKEY h_key, bool pooled)
+{
+    if (!pooled)
+    {
+        ++m_syscall_count;
+        reg_close(h_key);
+        return;
+    }
+    
+    // Pooled handles stay open until evicted or the pool is cleared
+    for (pool_entry& entry : m_pool)
+    {
+        if (entry.h_key == h_key && entry.refs > 0)
+        {
+            --entry.refs;
+            entry.last_used = ++m_pool_tick;
+            return;
+        }
+    }
+}
+
+void reg_api::enable_handle_pool(size_t capacity)
+{
+    m_pool_capacity = capacity;
+    
+    // Shrink to the new capacity, idle handles first in LRU order
+    while (m_pool.size() > m_pool_capacity)
+    {
+        auto victim = m_pool.end();
+        for (auto it = m_pool.begin(); it != m_pool.end(); ++it)
+        {
+            if (it->refs == 0 && (victim == m_pool.end() || it->last_used < victim->last_used))
+            {
+                victim = it;
+            }
+        }
+        
+        if (victim == m_pool.end())
+        {
+            break;
+        }
+        
+        ++m_pool_stats.evictions;
+        ++m_syscall_count;
+        reg_close(victim->h_key);
+        m_pool.erase(victim);
+    }
+}
+
+void reg_api::clear_handle_pool()
+{
+    for (auto it = m_pool.begin(); it != m_pool.end(); )
+    {
+        if (it->refs == 0)
+        {
+            ++m_syscall_count;
+            reg_close(it->h_key);
+            it = m_pool.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+reg_api::pool_stats reg_api::get_pool_stats() const
+{
+    pool_stats stats = m_pool_stats;
+    stats.open_handles = m_pool.size();
+    return stats;
+}
+
+reg_api::key reg_api::open_key(const std::string& key_path)
+{
+    HKEY h_key = NULL;
+    bool pooled = false;
+    if (acquire_key(key_path, h_key, pooled) != ERROR_SUCCESS)
+    {
+        return key();
+    }
+    
+    return key(this, h_key, pooled);
+}
+
+reg_api::reg_api(const std::string& machine_name, HKEY h_root_key)
+    : reg_api(static_cast<HKEY>(NULL))
+{
+    m_machine_name = machine_name;
+    
+    HKEY h_connection = NULL;
+    ++m_syscall_count;
+    if (remote_pool().acquire(machine_name, h_root_key, h_connection) == ERROR_SUCCESS)
+    {
+        m_h_root_key = h_connection;
+    }
+}
+
+bool reg_api::is_remote() const
+{
+    return !m_machine_name.empty();
+}
+
+const std::string& reg_api::machine_name() const
+{
+    return m_machine_name;
+}
+
+void reg_api::set_remote_pool_capacity(size_t idle_capacity)
+{
+    remote_connection_pool& pool = remote_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.idle_capacity = idle_capacity;
+    pool.trim();
+}
+
+reg_api::remote_pool_stats reg_api::get_remote_pool_stats()
+{
+    remote_connection_pool& pool = remote_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    remote_pool_stats stats = pool.stats;
+    stats.open_connections = pool.entries.size();
+    return stats;
+}
+
+bool reg_api::open_read_only(const std::string& key_path, REGSAM sam)
+{
+    close();
+    
+    ++m_syscall_count;
+    m_is_open = (reg_open(m_h_root_key, key_path.c_str(), sam, m_h_key,
+                          m_text_encoding == text_encoding::utf8) == ERROR_SUCCESS);
+    if (m_is_open)
+    {
+        m_key_path = key_path;
+    }
+    else
+    {
+        m_h_key = NULL;
+    }
+    
+    // KEY_READ includes KEY_NOTIFY, so the cache works as for chroot()
+    if (m_is_open && (m_cache_enabled || m_index_enabled))
+    {
+        start_watcher();
+    }
+    return m_is_open;
+}
+
+size_t reg_api::read_remote(const std::vector<std::string>& machine_names, HKEY h_root_key,
+                            const std::string& key_path, const std::vector<std::string>& value_names,
+                            const remote_callback& on_result, size_t max_in_flight, DWORD timeout_ms)
+{
+    typedef std::chrono::steady_clock clock;
+    
+    // Shared with the readers, which may outlive the call after a timeout
+    struct fan_out
+    {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<std::string> machines;
+        std::string key_path;
+        std::vector<std::string> value_names;
+        HKEY h_root_key = NULL;
+        std::atomic<size_t> next{0};
+        std::vector<clock::time_point> started;  // Per host; time_point() until claimed
+        std::vector<bool> reported;              // Per host, guarded by mutex
+        std::vector<remote_result> finished;     // Completed but not yet handed out
+    };
+    
+    std::shared_ptr<fan_out> state = std::make_shared<fan_out>();
+    state->machines = machine_names;
+    state->key_path = key_path;
+    state->value_names = value_names;
+    state->h_root_key = h_root_key;
+    state->started.resize(machine_names.size());
+    state->reported.resize(machine_names.size(), false);
+    
+    size_t reader_count = std::min(std::max<size_t>(max_in_flight, 1), machine_names.size());
+    for (size_t r = 0; r < reader_count; ++r)
+    {
+        std::thread([state]()
+        {
+            for (;;)
+            {
+                size_t index = state->next.fetch_add(1);
+                if (index >= state->machines.size())
+                {
+                    return;
+                }
+                
+                clock::time_point start = clock::now();
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->started[index] = start;
+                }
+                state->ready.notify_all();
+                
+                remote_result result;
+                result.machine_name = state->machines[index];
+                result.status = ERROR_SUCCESS;
+                {
+                    reg_api api(state->machines[index], state->h_root_key);
+                    if (api.m_h_root_key == NULL)
+                    {
+                        result.status = ERROR_BAD_NETPATH;
+                    }
+                    else if (!api.open_read_only(state->key_path))
+                    {
+                        result.status = ERROR_FILE_NOT_FOUND;
+                    }
+                    else
+                    {
+                        result.values = state->value_names.empty() ? api.load_all() : api.load(state->value_names);
+                    }
+                }
+                result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+                
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->reported[index])
+                    {
+                        state->reported[index] = true;
+                        state->finished.push_back(std::move(result));
+                    }
+                }
+                state->ready.notify_all();
+            }
+        }).detach();
+    }
+    
+    // Hand results to on_result on this thread, in completion order; hosts
+    // past their deadline are reported as timed out
+    size_t succeeded = 0;
+    size_t remaining = machine_names.size();
+    const clock::duration timeout = std::chrono::milliseconds(timeout_ms);
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (remaining > 0)
+    {
+        clock::time_point now = clock::now();
+        clock::time_point next_deadline = clock::time_point::max();
+        
+        for (size_t i = 0; i < state->machines.size(); ++i)
+        {
+            if (state->reported[i] || state->started[i] == clock::time_point())
+            {
+                continue;
+            }
+            
+            if (now - state->started[i] >= timeout)
+            {
+                state->reported[i] = true;
+                
+                remote_result result;
+                result.machine_name = state->machines[i];
+                result.status = ERROR_TIMEOUT;
+                result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - state->started[i]);
+                state->finished.push_back(std::move(result));
+            }
+            else
+            {
+                next_deadline = std::min(next_deadline, state->started[i] + timeout);
+            }
+        }
+        
+        if (state->finished.empty())
+        {
+            if (next_deadline == clock::time_point::max())
+            {
+                state->ready.wait(lock);
+            }
+            else
+            {
+                state->ready.wait_until(lock, next_deadline);
+            }
+            continue;
+        }
+        
+        std::vector<remote_result> batch;
+        batch.swap(state->finished);
+        remaining -= batch.size();
+        
+        // The callback may take its time; readers keep going meanwhile
+        lock.unlock();
+        for (const remote_result& result : batch)
+        {
+            if (result.status == ERROR_SUCCESS)
+            {
+                ++succeeded;
+            }
+            on_result(result);
+        }
+        lock.lock();
+    }
+    
+    return succeeded;
+}
+
+reg_api::key::key()
+    : m_owner(nullptr)
+    , m_h_key(NULL)
+    , m_pooled(false)
+{
+}
+
+reg_api::key::key(reg_api* owner, HKEY h_key, bool pooled)
+    : m_owner(owner)
+    , m_h_key(h_key)
+    , m_pooled(pooled)
+{
+}
+
+reg_api::key::~key()
+{
+    close();
+}
+
+reg_api::key::key(key&& other) noexcept
+    : m_owner(other.m_owner)
+    , m_h_key(other.m_h_key)
+    , m_pooled(other.m_pooled)
+{
+    other.m_h_key = NULL;
+}
+
+reg_api::key& reg_api::key::operator=(key&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_owner = other.m_owner;
+        m_h_key = other.m_h_key;
+        m_pooled = other.m_pooled;
+        other.m_h_key = NULL;
+    }
+    return *this;
+}
+
+bool reg_api::key::is_open() const
+{
+    return m_h_key != NULL;
+}
+
+void reg_api::key::close()
+{
+    if (m_h_key != NULL)
+    {
+        m_owner->release_key(m_h_key, m_pooled);
+        m_h_key = NULL;
+    }
+}
+
+std::string reg_api::key::read_string(std::string_view value_name, const std::string& default_value)
+{
+    if (m_h_key == NULL)
+    {
+        return default_value;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (m_owner->query_registry(m_h_key, c_name(value_name).c_str(), type, data_size) != ERROR_SUCCESS)
+    {
+        return default_value;
+    }
+    
+    return decode_string(m_owner->m_read_buf.data(), data_size);
+}
+
+bool reg_api::key::write_string(std::string_view value_name, const std::string& value)
+{
+    if (m_h_key == NULL)
+    {
+        return false;
+    }
+    
+    // Include null terminator
+    return m_owner->set_registry(m_h_key, c_name(value_name).c_str(), REG_SZ,
+                                 value.c_str(), static_cast<DWORD>(value.length() + 1)) == ERROR_SUCCESS;
+}
+
+bool reg_api::key::value_exists(std::string_view value_name)
+{
+    if (m_h_key == NULL)
+    {
+        return false;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    return m_owner->query_registry(m_h_key, c_name(value_name).c_str(), type, data_size) == ERROR_SUCCESS;
+}
+
+bool reg_api::key::delete_value(std::string_view value_name)
+{
+    if (m_h_key == NULL)
+    {
+        return false;
+    }
+    
+    return m_owner->delete_registry(m_h_key, c_name(value_name).c_str()) == ERROR_SUCCESS;
+}
+
+// Cache of a shared key; never changed once published. A fill or an
+// invalidation copies the table and publishes the copy.
+struct reg_api::shared::cache_table
+{
+    unsigned long generation = 0;                         // Key generation of the values
+    std::unordered_map<std::string, cached_value> values; // Lower-cased name -> value
+};
+
+// Published key of a reg_api::shared; the handle and path never change,
+// only the cache table it points to is replaced
+struct reg_api::shared::opened_key
+{
+    HKEY h_key = NULL;
+    std::string key_path;
+    bool cached = false;                                // Cache and watcher in use
+    std::atomic<unsigned long long>* syscall_count = nullptr;
+    
+    mutable std::atomic<const cache_table*> cache{nullptr}; // Retired through epochs
+    mutable std::mutex cache_mutex;                     // Serializes table replacement
+    mutable std::atomic<unsigned long> write_epoch{0};  // Bumped by local writes
+    std::atomic<unsigned long> change_generation{0};    // Bumped on every key change
+    std::atomic<bool> watch_ok{false};                  // Notifications are armed
+    HANDLE watch_stop = NULL;
+    std::thread watch_thread;
+    
+    ~opened_key();
+    
+    void start_watcher();
+    
+    // Publish table in place of the current one; caller holds cache_mutex
+    void replace_cache(const cache_table* table) const
+    {
+        reg_epoch::retire(cache.exchange(table));
+    }
+};
+
+reg_api::shared::opened_key::~opened_key()
+{
+    watch_ok = false;
+    
+    if (watch_thread.joinable())
+    {
+        SetEvent(watch_stop);
+        watch_thread.join();
+    }
+    
+    if (watch_stop != NULL)
+    {
+        CloseHandle(watch_stop);
+    }
+    
+    if (h_key != NULL)
+    {
+        ++*syscall_count;
+        reg_close(h_key);
+    }
+    
+    // Unreachable now, like the key itself
+    delete cache.load();
+}
+
+void reg_api::shared::opened_key::start_watcher()
+{
+    watch_stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (watch_stop == NULL)
+    {
+        return;
+    }
+    
+    // Same scheme as reg_api::start_watcher(): the thread arms the
+    // notification itself and reports the first result
+    std::promise<bool> armed;
+    std::future<bool> armed_result = armed.get_future();
+    
+    watch_thread = std::thread([this, armed = std::move(armed)]() mutable
+    {
+        HANDLE h_change = CreateEventA(NULL, FALSE, FALSE, NULL);
+        bool first = true;
+        
+        for (;;)
+        {
+            LONG result = (h_change == NULL) ? ERROR_NOT_ENOUGH_MEMORY : reg_notify(
+                h_key,
+                REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET,
+                h_change
+            );
+            
+            if (first)
+            {
+                armed.set_value(result == ERROR_SUCCESS);
+                first = false;
+            }
+            
+            if (result != ERROR_SUCCESS)
+            {
+                watch_ok = false;
+                break;
+            }
+            
+            HANDLE handles[2] = { watch_stop, h_change };
+            DWORD wait = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            if (wait != WAIT_OBJECT_0 + 1)
+            {
+                break;
+            }
+            
+            change_generation.fetch_add(1, std::memory_order_release);
+        }
+        
+        if (h_change != NULL)
+        {
+            CloseHandle(h_change);
+        }
+    });
+    
+    watch_ok = armed_result.get();
+}
+
+reg_api::shared::shared(HKEY h_root_key)
+    : m_h_root_key(h_root_key)
+    , m_key(nullptr)
+    , m_storage_mode(storage_mode::string)
+    , m_float_format(float_format::fixed5)
+    , m_cache_enabled(false)
+    , m_syscall_count(0)
+    , m_cache_invalidations(0)
+{
+}
+
+reg_api::shared::~shared()
+{
+    close();
+    
+    // Retired keys count into m_syscall_count when they close their handle
+    reg_epoch::synchronize();
+}
+
+const reg_api::shared::opened_key* reg_api::shared::current() const
+{
+    return m_key.load(std::memory_order_acquire);
+}
+
+reg_api::shared::counter_shard& reg_api::shared::counters() const
+{
+    // Threads take shards in turn, so the first counter_shards threads
+    // never share a cache line
+    static std::atomic<size_t> next_shard{0};
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+    return m_counters[shard % counter_shards];
+}
+
+void reg_api::shared::publish(const opened_key* key)
+{
+    // Readers still inside the old key keep it until their guard ends
+    reg_epoch::retire(m_key.exchange(key, std::memory_order_acq_rel));
+}
+
+std::vector<char>& reg_api::shared::thread_buffer()
+{
+    thread_local std::vector<char> buffer;
+    return buffer;
+}
+
+bool reg_api::shared::chroot(const std::string& key_path)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    return open_locked(key_path);
+}
+
+bool reg_api::shared::open_locked(const std::string& key_path)
+{
+    std::unique_ptr<opened_key> key(new opened_key());
+    key->syscall_count = &m_syscall_count;
+    key->key_path = key_path;
+    
+    unsigned long long calls = 0;
+    LONG result = open_or_create(m_h_root_key, key_path.c_str(), KEY_READ | KEY_WRITE, key->h_key, calls);
+    m_syscall_count += calls;
+    
+    if (result != ERROR_SUCCESS)
+    {
+        // Like reg_api::chroot(), a failed open leaves no key open
+        key->h_key = NULL;
+        publish(nullptr);
+        return false;
+    }
+    
+    if (m_cache_enabled)
+    {
+        key->cached = true;
+        key->start_watcher();
+    }
+    
+    // Readers switch to the new key without ever seeing none open
+    publish(key.release());
+    return true;
+}
+
+void reg_api::shared::close()
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    
+    // Readers still holding the key keep the handle open until they finish
+    publish(nullptr);
+}
+
+bool reg_api::shared::is_open() const
+{
+    return m_key.load(std::memory_order_acquire) != nullptr;
+}
+
+LONG reg_api::shared::query_value(const opened_key& key, std::string_view value_name, DWORD& type, DWORD& data_size) const
+{
+    std::vector<char>& buffer = thread_buffer();
+    c_name name(value_name);
+    unsigned long long calls = 0;
+    
+    if (!key.cached || !key.watch_ok.load(std::memory_order_acquire))
+    {
+        LONG result = query_buffer(key.h_key, name.c_str(), buffer, type, data_size, calls);
+        m_syscall_count.fetch_add(calls, std::memory_order_relaxed);
+        return result;
+    }
+    
+    // Registry value names are case-insensitive
+    thread_local std::string lookup;
+    lookup.assign(value_name);
+    for (char& ch : lookup)
+    {
+        ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    
+    unsigned long generation = key.change_generation.load(std::memory_order_acquire);
+    unsigned long epoch = key.write_epoch.load(std::memory_order_acquire);
+    
+    // Hits read the published table without locking; the caller's guard keeps it alive
+    const cache_table* table = key.cache.load(std::memory_order_acquire);
+    if (table != nullptr && table->generation == generation)
+    {
+        auto it = table->values.find(lookup);
+        if (it != table->values.end())
+        {
+            counters().hits.fetch_add(1, std::memory_order_relaxed);
+            
+            const cached_value& cached = it->second;
+            if (cached.result == ERROR_SUCCESS)
+            {
+                if (buffer.size() < cached.data.size() + 1)
+                {
+                    buffer.resize(cached.data.size() + 1);
+                }
+                memcpy(buffer.data(), cached.data.data(), cached.data.size());
+                type = cached.type;
+                data_size = static_cast<DWORD>(cached.data.size());
+            }
+            return cached.result;
+        }
+    }
+    
+    counters().misses.fetch_add(1, std::memory_order_relaxed);
+    
+    LONG result = query_buffer(key.h_key, name.c_str(), buffer, type, data_size, calls);
+    m_syscall_count.fetch_add(calls, std::memory_order_relaxed);
+    
+    if (result != ERROR_SUCCESS && result != ERROR_FILE_NOT_FOUND)
+    {
+        return result;
+    }
+    
+    std::lock_guard<std::mutex> lock(key.cache_mutex);
+    
+    // A change or a local write since the query may have made it stale
+    if (key.change_generation.load(std::memory_order_acquire) != generation ||
+        key.write_epoch.load(std::memory_order_acquire) != epoch)
+    {
+        return result;
+    }
+    
+    // Copy on fill; misses are rare once the cache is warm
+    const cache_table* current_table = key.cache.load(std::memory_order_relaxed);
+    std::unique_ptr<cache_table> filled(new cache_table());
+    filled->generation = generation;
+    if (current_table != nullptr && current_table->generation == generation)
+    {
+        filled->values = current_table->values;
+    }
+    else if (current_table != nullptr)
+    {
+        m_cache_invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // Missing values are cached too so repeated probes stay in memory
+    cached_value& cached = filled->values[lookup];
+    cached.result = result;
+    cached.type = (result == ERROR_SUCCESS) ? type : REG_NONE;
+    if (result == ERROR_SUCCESS)
+    {
+        cached.data.assign(buffer.data(), buffer.data() + data_size);
+    }
+    else
+    {
+        cached.data.clear();
+    }
+    
+    key.replace_cache(filled.release());
+    return result;
+}
+
+void reg_api::shared::invalidate_cached(const opened_key& key, std::string_view value_name)
+{
+    if (!key.cached)
+    {
+        return;
+    }
+    
+    std::string lookup(value_name);
+    for (char& ch : lookup)
+    {
+        ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    
+    std::lock_guard<std::mutex> lock(key.cache_mutex);
+    
+    // Fills that queried before the write see the new epoch and drop their value
+    key.write_epoch.fetch_add(1, std::memory_order_acq_rel);
+    
+    const cache_table* table = key.cache.load(std::memory_order_relaxed);
+    if (table != nullptr && table->values.count(lookup) != 0)
+    {
+        std::unique_ptr<cache_table> pruned(new cache_table(*table));
+        pruned->values.erase(lookup);
+        key.replace_cache(pruned.release());
+    }
+}
+
+std::string reg_api::shared::read_string(std::string_view value_name, const std::string& default_value) const
+{
+    epoch_guard guard;
+    const opened_key* key = current();
+    if (key == nullptr)
+    {
+        return default_value;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (query_value(*key, value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return default_value;
+    }
+    
+    return decode_string(thread_buffer().data(), data_size);
+}
+
+bool reg_api::shared::read_into(std::string_view value_name, std::string& out) const
+{
+    epoch_guard guard;
+    const opened_key* key = current();
+    if (key == nullptr)
+    {
+        return false;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (query_value(*key, value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    const std::vector<char>& buffer = thread_buffer();
+    out.assign(buffer.data(), strnlen(buffer.data(), data_size));
+    return true;
+}
+
+bool reg_api::shared::value_exists(std::string_view value_name) const
+{
+    epoch_guard guard;
+    const opened_key* key = current();
+    if (key == nullptr)
+    {
+        return false;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    return query_value(*key, value_name, type, data_size) == ERROR_SUCCESS;
+}
+
+bool reg_api::shared::write_string(std::string_view value_name, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    
+    // Include null terminator
+    return set_value(value_name, REG_SZ, value.c_str(), static_cast<DWORD>(value.length() + 1));
+}
+
+bool reg_api::shared::set_value(std::string_view value_name, DWORD type, const void* data, DWORD data_size)
+{
+    // Only writers retire keys, and the caller is one
+    const opened_key* key = current();
+    if (key == nullptr)
+    {
+        return false;
+    }
+    
+    ++m_syscall_count;
+    LONG result = reg_set(key->h_key, c_name(value_name).c_str(), type, data, data_size, false);
+    
+    invalidate_cached(*key, value_name);
+    return (result == ERROR_SUCCESS);
+}
+
+bool reg_api::shared::delete_value(std::string_view value_name)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    
+    const opened_key* key = current();
+    if (key == nullptr)
+    {
+        return false;
+    }
+    
+    ++m_syscall_count;
+    LONG result = reg_delete(key->h_key, c_name(value_name).c_str(), false);
+    
+    invalidate_cached(*key, value_name);
+    return (result == ERROR_SUCCESS);
+}
+
+void reg_api::shared::set_storage_mode(storage_mode mode)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    m_storage_mode = mode;
+}
+
+void reg_api::shared::set_float_format(float_format format)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    m_float_format = format;
+}
+
+void reg_api::shared::enable_cache(bool enable)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    m_cache_enabled = enable;
+    
+    // The cache lives in the published key, so publish a fresh one
+    const opened_key* key = current();
+    if (key != nullptr && key->cached != enable)
+    {
+        std::string key_path = key->key_path;
+        open_locked(key_path);
+    }
+}
+
+reg_api::cache_stats reg_api::shared::get_cache_stats() const
+{
+    cache_stats stats;
+    stats.hits = 0;
+    stats.misses = 0;
+    for (const counter_shard& shard : m_counters)
+    {
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.misses += shard.misses.load(std::memory_order_relaxed);
+    }
+    stats.invalidations = m_cache_invalidations.load(std::memory_order_relaxed);
+    stats.entries = 0;
+    
+    epoch_guard guard;
+    const opened_key* key = current();
+    if (key != nullptr)
+    {
+        const cache_table* table = key->cache.load(std::memory_order_acquire);
+        if (table != nullptr)
+        {
+            stats.entries = table->values.size();
+        }
+    }
+    return stats;
+}
+
+unsigned long long reg_api::shared::syscall_count() const
+{
+    return m_syscall_count.load(std::memory_order_relaxed);
+}
+
+std::string reg_api::read_string(std::string_view value_name, const std::string& default_value)
+{
+    op_scope scope(op_kind::read_string, &m_syscall_count);
+    
+    if (!m_is_open)
+    {
+        return default_value;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    
+    if (query_value(value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return default_value;
+    }
+    
+    std::string value = decode_string(m_read_buf.data(), data_size);
+    scope.bytes_out(value.size());
+    return value;
+}
+
+reg_api::c_name::c_name(std::string_view name)
+{
+    if (name.size() < sizeof(m_small))
+    {
+        memcpy(m_small, name.data(), name.size());
+        m_small[name.size()] = '\0';
+        m_ptr = m_small;
+    }
+    else
+    {
+        m_large.assign(name.data(), name.size());
+        m_ptr = m_large.c_str();
+    }
+}
+
+bool reg_api::read_into(std::string_view value_name, std::string& out)
+{
+    op_scope scope(op_kind::read_string, &m_syscall_count);
+    
+    if (!m_is_open)
+    {
+        return false;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    
+    if (query_value(value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    // assign() reuses the existing capacity of out
+    out.assign(m_read_buf.data(), strnlen(m_read_buf.data(), data_size));
+    scope.bytes_out(out.size());
+    return true;
+}
+
+bool reg_api::read_into(std::string_view value_name, char* buffer, size_t capacity, size_t* length)
+{
+    op_scope scope(op_kind::read_string, &m_syscall_count);
+    
+    if (!m_is_open)
+    {
+        return false;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    
+    if (query_value(value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    size_t str_size = strnlen(m_read_buf.data(), data_size);
+    if (length != nullptr)
+    {
+        *length = str_size;
+    }
+    
+    // Leave the buffer untouched when the string and its terminator do not fit
+    if (str_size >= capacity)
+    {
+        return false;
+    }
+    
+    memcpy(buffer, m_read_buf.data(), str_size);
+    buffer[str_size] = '\0';
+    scope.bytes_out(str_size);
+    return true;
+}
+
+std::string reg_api::decode_string(const char* data, DWORD data_size)
+{
+    // The stored data need not be null terminated
+    return std::string(data, strnlen(data, data_size));
+}
+
+int reg_api::compare_names(const char* a, size_t a_size, const char* b, size_t b_size)
+{
+    size_t common = (a_size < b_size) ? a_size : b_size;
+    for (size_t i = 0; i < common; ++i)
+    {
+        int ca = toupper(static_cast<unsigned char>(a[i]));
+        int cb = toupper(static_cast<unsigned char>(b[i]));
+        if (ca != cb)
+        {
+            return (ca < cb) ? -1 : 1;
+        }
+    }
+    
+    if (a_size == b_size)
+    {
+        return 0;
+    }
+    return (a_size < b_size) ? -1 : 1;
+}
+
+LONG reg_api::query_value(std::string_view value_name, DWORD& type, DWORD& data_size)
+{
+    if (!m_cache_enabled || !m_watch_ok)
+    {
+        return query_registry(m_h_key, c_name(value_name).c_str(), type, data_size);
+    }
+    
+    // Drop everything once the key changed behind our back
+    unsigned long generation = m_change_generation.load(std::memory_order_acquire);
+    if (generation != m_cache_generation)
+    {
+        m_cache.clear();
+        m_cache_generation = generation;
+        ++m_cache_stats.invalidations;
+    }
+    
+    // Registry value names are case-insensitive
+    m_cache_key.assign(value_name);
+    for (char& ch : m_cache_key)
+    {
+        ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    
+    auto it = m_cache.find(m_cache_key);
+    if (it != m_cache.end())
+    {
+        ++m_cache_stats.hits;
+        
+        const cached_value& cached = it->second;
+        if (cached.result == ERROR_SUCCESS)
+        {
+            if (m_read_buf.size() < cached.data.size() + 1)
+            {
+                m_read_buf.resize(cached.data.size() + 1);
+            }
+            memcpy(m_read_buf.data(), cached.data.data(), cached.data.size());
+            type = cached.type;
+            data_size = static_cast<DWORD>(cached.data.size());
+        }
+        return cached.result;
+    }
+    
+    ++m_cache_stats.misses;
+    
+    LONG result = query_registry(m_h_key, c_name(value_name).c_str(), type, data_size);
+    
+    // Missing values are cached too so repeated probes stay in memory
+    if (result == ERROR_SUCCESS || result == ERROR_FILE_NOT_FOUND)
+    {
+        cached_value& cached = m_cache[m_cache_key];
+        cached.result = result;
+        cached.type = (result == ERROR_SUCCESS) ? type : REG_NONE;
+        if (result == ERROR_SUCCESS)
+        {
+            cached.data.assign(m_read_buf.data(), m_read_buf.data() + data_size);
+        }
+        else
+        {
+            cached.data.clear();
+        }
+    }
+    
+    return result;
+}
+
+LONG reg_api::query_registry(HKEY h_key, const char* value_name, DWORD& type, DWORD& data_size)
+{
+    return query_buffer(h_key, value_name, m_read_buf, type, data_size, m_syscall_count, m_text_encoding);
+}
+
+LONG reg_api::query_buffer(HKEY h_key, const char* value_name, std::vector<char>& buffer,
+                           DWORD& type, DWORD& data_size, unsigned long long& calls,
+                           text_encoding encoding)
+{
+    if (buffer.size() < initial_read_buffer_size)
+    {
+        buffer.resize(initial_read_buffer_size);
+    }
+    
+    LONG result = ERROR_MORE_DATA;
+    
+    // Optimistic read into the reused buffer; only retry with the reported
+    // size when the value is larger (it may grow again between the calls)
+    while (result == ERROR_MORE_DATA)
+    {
+        // Keep one byte spare so callers can terminate string data in place
+        data_size = static_cast<DWORD>(buffer.size() - 1);
+        
+        ++calls;
+        result = reg_query(h_key, value_name, &type, buffer.data(), &data_size,
+                           encoding == text_encoding::utf8);
+        
+        if (result == ERROR_MORE_DATA)
+        {
+            buffer.resize(static_cast<size_t>(data_size) + 1);
+        }
+    }
+    
+    return result;
+}
+
+reg_api::snapshot reg_api::load_all()
+{
+    if (!m_is_open)
+    {
+        return snapshot();
+    }
+    
+    return load_key(m_h_key, m_read_buf, m_syscall_count, m_text_encoding);
+}
+
+reg_api::snapshot reg_api::load_key(HKEY h_key, std::vector<char>& buffer, unsigned long long& calls,
+                                    text_encoding encoding)
+{
+    snapshot result;
+    bool wide = (encoding == text_encoding::utf8);
+    
+    // Presize from the key info so the enumeration does not need retries
+    DWORD value_count = 0;
+    DWORD max_name_size = 0;
+    DWORD max_data_size = 0;
+    ++calls;
+    LONG status = reg_info(h_key, NULL, NULL, &value_count, &max_name_size, &max_data_size, wide);
+    
+    if (status != ERROR_SUCCESS)
+    {
+        return result;
+    }
+    
+    scratch_scope scratch;
+    std::pmr::vector<char> name_buf(static_cast<size_t>(max_name_size) + 1, scratch_scope::resource());
+    if (buffer.size() < static_cast<size_t>(max_data_size) + 1)
+    {
+        buffer.resize(static_cast<size_t>(max_data_size) + 1);
+    }
+    
+    result.m_index.reserve(value_count);
+    
+    for (DWORD index = 0; ; )
+    {
+        DWORD name_size = static_cast<DWORD>(name_buf.size());
+        DWORD data_size = static_cast<DWORD>(buffer.size() - 1);
+        DWORD type = REG_NONE;
+        
+        ++calls;
+        status = reg_enum_value(h_key, index, name_buf.data(), &name_size, &type, buffer.data(), &data_size, wide);
+        
+        if (status == ERROR_NO_MORE_ITEMS)
+        {
+            break;
+        }
+        
+        if (status == ERROR_MORE_DATA)
+        {
+            // The key changed since RegQueryInfoKeyA; grow both and retry
+            name_buf.resize(name_buf.size() * 2);
+            if (buffer.size() < static_cast<size_t>(data_size) + 1)
+            {
+                buffer.resize(static_cast<size_t>(data_size) + 1);
+            }
+            else
+            {
+                buffer.resize(buffer.size() * 2);
+            }
+            continue;
+        }
+        
+        if (status != ERROR_SUCCESS)
+        {
+            break;
+        }
+        
+        snapshot::entry item;
+        item.type = type;
+        item.data_offset = static_cast<DWORD>(result.m_blob.size());
+        item.data_size = data_size;
+        result.m_blob.insert(result.m_blob.end(), buffer.data(), buffer.data() + data_size);
+        result.add_name(item, name_buf.data(), name_size);
+        result.m_index.push_back(item);
+        
+        ++index;
+    }
+    
+    result.seal();
+    return result;
+}
+
+reg_api::snapshot reg_api::load(const std::vector<std::string>& value_names)
+{
+    std::vector<const char*> names;
+    names.reserve(value_names.size());
+    for (const std::string& value_name : value_names)
+    {
+        names.push_back(value_name.c_str());
+    }
+    
+    return load_names(names.data(), names.size());
+}
+
+reg_api::snapshot reg_api::load_names(const char* const* value_names, size_t count)
+{
+    snapshot result;
+    if (!m_is_open || count == 0)
+    {
+        return result;
+    }
+    
+    // Backends have no bulk query
+    if (backend_of(m_h_key) != nullptr)
+    {
+        return load_each(value_names, count);
+    }
+    
+    if (m_text_encoding == text_encoding::utf8)
+    {
+        if (load_names_wide(value_names, count, result))
+        {
+            return result;
+        }
+        return load_each(value_names, count);
+    }
+    
+    scratch_scope scratch;
+    std::pmr::vector<VALENTA> entries(count, scratch_resource());
+    for (size_t i = 0; i < count; ++i)
+    {
+        entries[i].ve_valuename = const_cast<LPSTR>(value_names[i]);
+        entries[i].ve_valuelen = 0;
+        entries[i].ve_valueptr = 0;
+        entries[i].ve_type = REG_NONE;
+    }
+    
+    // The data lands directly in the snapshot blob; start from a guess and
+    // let ERROR_MORE_DATA report the exact size
+    DWORD total_size = static_cast<DWORD>(count * 64);
+    LONG status = ERROR_MORE_DATA;
+    while (status == ERROR_MORE_DATA)
+    {
+        result.m_blob.resize(total_size);
+        
+        ++m_syscall_count;
+        status = RegQueryMultipleValuesA(
+            m_h_key,
+            entries.data(),
+            static_cast<DWORD>(entries.size()),
+            result.m_blob.data(),
+            &total_size
+        );
+    }
+    
+    if (status == ERROR_SUCCESS)
+    {
+        result.m_blob.resize(total_size);
+        result.m_index.reserve(entries.size());
+        
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            snapshot::entry item;
+            item.type = entries[i].ve_type;
+            item.data_offset = static_cast<DWORD>(reinterpret_cast<const char*>(entries[i].ve_valueptr) - result.m_blob.data());
+            item.data_size = entries[i].ve_valuelen;
+            result.add_name(item, value_names[i], strlen(value_names[i]));
+            result.m_index.push_back(item);
+        }
+        
+        result.seal();
+        return result;
+    }
+    
+    // RegQueryMultipleValuesA fails as a whole when any value is missing;
+    // fall back to one query per name and skip the absent ones
+    return load_each(value_names, count);
+}
+
+bool reg_api::load_names_wide(const char* const* value_names, size_t count, snapshot& result)
+{
+    // All names are converted up front into one buffer
+    scratch_scope scratch;
+    std::pmr::vector<wchar_t> names(scratch_resource());
+    std::pmr::vector<size_t> name_offsets(count, scratch_resource());
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t size = strlen(value_names[i]);
+        name_offsets[i] = names.size();
+        names.resize(names.size() + size + 1);
+        size_t units = utf8_to_utf16(value_names[i], size, names.data() + name_offsets[i]);
+        names.resize(name_offsets[i] + units + 1);
+        names.back() = L'\0';
+    }
+    
+    std::pmr::vector<VALENTW> entries(count, scratch_resource());
+    for (size_t i = 0; i < count; ++i)
+    {
+        entries[i].ve_valuename = names.data() + name_offsets[i];
+        entries[i].ve_valuelen = 0;
+        entries[i].ve_valueptr = 0;
+        entries[i].ve_type = REG_NONE;
+    }
+    
+    std::vector<char>& data = m_read_buf;
+    DWORD total_size = static_cast<DWORD>(count * 128);
+    LONG status = ERROR_MORE_DATA;
+    while (status == ERROR_MORE_DATA)
+    {
+        if (data.size() < total_size)
+        {
+            data.resize(total_size);
+        }
+        total_size = static_cast<DWORD>(data.size());
+        
+        ++m_syscall_count;
+        status = RegQueryMultipleValuesW(
+            m_h_key,
+            entries.data(),
+            static_cast<DWORD>(entries.size()),
+            reinterpret_cast<LPWSTR>(data.data()),
+            &total_size
+        );
+    }
+    
+    if (status != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    // Copy into the snapshot, converting strings back to UTF-8
+    std::pmr::vector<wchar_t> units(scratch_resource());
+    result.m_blob.reserve(total_size);
+    result.m_index.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* value = reinterpret_cast<const char*>(entries[i].ve_valueptr);
+        DWORD value_size = entries[i].ve_valuelen;
+        
+        snapshot::entry item;
+        item.type = entries[i].ve_type;
+        item.data_offset = static_cast<DWORD>(result.m_blob.size());
+        
+        if (is_string_type(item.type))
+        {
+            size_t unit_count = value_size / sizeof(wchar_t);
+            units.resize(unit_count);
+            memcpy(units.data(), value, unit_count * sizeof(wchar_t));
+            
+            result.m_blob.resize(item.data_offset + unit_count * 3);
+            size_t size = utf16_to_utf8(units.data(), unit_count, result.m_blob.data() + item.data_offset);
+            result.m_blob.resize(item.data_offset + size);
+            item.data_size = static_cast<DWORD>(size);
+        }
+        else
+        {
+            result.m_blob.insert(result.m_blob.end(), value, value + value_size);
+            item.data_size = value_size;
+        }
+        
+        result.add_name(item, value_names[i], strlen(value_names[i]));
+        result.m_index.push_back(item);
+    }
+    
+    result.seal();
+    return true;
+}
+
+reg_api::snapshot reg_api::load_each(const char* const* value_names, size_t count)
+{
+    snapshot result;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* value_name = value_names[i];
+        DWORD type = REG_NONE;
+        DWORD data_size = 0;
+        if (query_value(value_name, type, data_size) != ERROR_SUCCESS)
+        {
+            continue;
+        }
+        
+        snapshot::entry item;
+        item.type = type;
+        item.data_offset = static_cast<DWORD>(result.m_blob.size());
+        item.data_size = data_size;
+        result.m_blob.insert(result.m_blob.end(), m_read_buf.data(), m_read_buf.data() + data_size);
+        result.add_name(item, value_name, strlen(value_name));
+        result.m_index.push_back(item);
+    }
+    
+    result.seal();
+    return result;
+}
+
+reg_api::snapshot::snapshot()
+{
+}
+
+size_t reg_api::snapshot::size() const
+{
+    return m_index.size();
+}
+
+bool reg_api::snapshot::empty() const
+{
+    return m_index.empty();
+}
+
+std::string reg_api::snapshot::name_at(size_t index) const
+{
+    const entry& item = m_index.at(index);
+    return std::string(m_blob.data() + item.name_offset, item.name_size);
+}
+
+bool reg_api::snapshot::contains(std::string_view value_name) const
+{
+    return lookup(value_name) != nullptr;
+}
+
+bool reg_api::snapshot::find(std::string_view value_name, DWORD& type, const char*& data, DWORD& data_size) const
+{
+    const entry* item = lookup(value_name);
+    if (item == nullptr)
+    {
+        return false;
+    }
+    
+    type = item->type;
+    data = m_blob.data() + item->data_offset;
+    data_size = item->data_size;
+    return true;
+}
+
+std::string reg_api::snapshot::read_string(std::string_view value_name, const std::string& default_value) const
+{
+    const entry* item = lookup(value_name);
+    if (item == nullptr)
+    {
+        return default_value;
+    }
+    
+    return decode_string(m_blob.data() + item->data_offset, item->data_size);
+}
+
+void reg_api::snapshot::add_name(entry& item, const char* name, size_t name_size)
+{
+    item.name_offset = static_cast<DWORD>(m_blob.size());
+    item.name_size = static_cast<DWORD>(name_size);
+    m_blob.insert(m_blob.end(), name, name + name_size);
+}
+
+void reg_api::snapshot::seal()
+{
+    const char* blob = m_blob.data();
+    std::sort(m_index.begin(), m_index.end(), [blob](const entry& a, const entry& b)
+    {
+        return compare_names(blob + a.name_offset, a.name_size, blob + b.name_offset, b.name_size) < 0;
+    });
+    
+    m_blob.shrink_to_fit();
+    m_index.shrink_to_fit();
+}
+
+const reg_api::snapshot::entry* reg_api::snapshot::lookup(std::string_view value_name) const
+{
+    const char* blob = m_blob.data();
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), value_name, [blob](const entry& item, std::string_view name)
+    {
+        return compare_names(blob + item.name_offset, item.name_size, name.data(), name.size()) < 0;
+    });
+    
+    if (it == m_index.end() ||
+        compare_names(blob + it->name_offset, it->name_size, value_name.data(), value_name.size()) != 0)
+    {
+        return nullptr;
+    }
+    
+    return &*it;
+}
+
+unsigned long long reg_api::watch(const std::string& key_path, watch_callback callback, DWORD filter)
+{
+    std::unique_ptr<watch_entry> entry(new watch_entry());
+    entry->key_path = key_path;
+    entry->callback = std::move(callback);
+    entry->filter = filter;
+    entry->encoding = m_text_encoding;
+    
+    ++m_syscall_count;
+    if (reg_open(m_h_root_key, key_path.c_str(), KEY_NOTIFY | KEY_QUERY_VALUE, entry->h_key,
+                 m_text_encoding == text_encoding::utf8) != ERROR_SUCCESS)
+    {
+        entry->h_key = NULL;
+        return 0;
+    }
+    
+    entry->h_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (entry->h_event == NULL || entry->arm() != ERROR_SUCCESS)
+    {
+        return 0;
+    }
+    
+    // Baseline for the first diff, taken after arming so nothing is missed
+    entry->values = load_key(entry->h_key, entry->buffer, entry->calls, entry->encoding);
+    
+    if (!RegisterWaitForSingleObject(&entry->h_wait, entry->h_event, &watch_entry::on_signal,
+                                     entry.get(), INFINITE, WT_EXECUTEDEFAULT))
+    {
+        entry->h_wait = NULL;
+        return 0;
+    }
+    
+    unsigned long long id = ++m_next_watch_id;
+    m_watches.emplace(id, std::move(entry));
+    return id;
+}
+
+bool reg_api::unwatch(unsigned long long id)
+{
+    return m_watches.erase(id) != 0;
+}
+
+size_t reg_api::watch_count() const
+{
+    return m_watches.size();
+}
+
+std::vector<std::string> reg_api::snapshot::changed_names(const snapshot& other) const
+{
+    std::vector<std::string> changed;
+    
+    // Both indexes are sorted the same way, so one merge pass finds every
+    // difference
+    const char* a_blob = other.m_blob.data();
+    const char* b_blob = m_blob.data();
+    size_t a = 0;
+    size_t b = 0;
+    
+    while (a < other.m_index.size() || b < m_index.size())
+    {
+        int order;
+        if (a == other.m_index.size())
+        {
+            order = 1;
+        }
+        else if (b == m_index.size())
+        {
+            order = -1;
+        }
+        else
+        {
+            order = compare_names(a_blob + other.m_index[a].name_offset, other.m_index[a].name_size,
+                                  b_blob + m_index[b].name_offset, m_index[b].name_size);
+        }
+        
+        if (order < 0)
+        {
+            // Removed
+            const entry& item = other.m_index[a++];
+            changed.emplace_back(a_blob + item.name_offset, item.name_size);
+        }
+        else if (order > 0)
+        {
+            // Added
+            const entry& item = m_index[b++];
+            changed.emplace_back(b_blob + item.name_offset, item.name_size);
+        }
+        else
+        {
+            const entry& before = other.m_index[a++];
+            const entry& after = m_index[b++];
+            if (before.type != after.type || before.data_size != after.data_size ||
+                memcmp(a_blob + before.data_offset, b_blob + after.data_offset, after.data_size) != 0)
+            {
+                changed.emplace_back(b_blob + after.name_offset, after.name_size);
+            }
+        }
+    }
+    
+    return changed;
+}
+
+namespace
+{
+    // export_tree() file layout. Integers are little-endian, sections are
+    // 4-byte aligned and follow each other in this order:
+    //   tree_header
+    //   key records     sorted by path, case-insensitive
+    //   value records   grouped by key, sorted by name within each key
+    //   string pool     key paths and value names, not terminated
+    //   value blob
+    // Record offsets are relative to the string pool or the blob.
+    const uint32_t tree_magic = 0x45525452; // "RTRE"
+    const uint32_t tree_version = 1;
+
+    struct tree_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t key_count;
+        uint32_t value_count;
+        uint32_t keys_offset;
+        uint32_t values_offset;
+        uint32_t strings_offset;
+        uint32_t strings_size;
+        uint32_t blob_offset;
+        uint32_t blob_size;
+    };
+
+    size_t align4(size_t size)
+    {
+        return (size + 3) & ~static_cast<size_t>(3);
+    }
+}
+
+struct reg_api::tree_file::key_record
+{
+    uint32_t path_offset;
+    uint32_t path_size;
+    uint32_t first_value;
+    uint32_t value_count;
+};
+
+struct reg_api::tree_file::value_record
+{
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint32_t type;
+    uint32_t data_offset;
+    uint32_t data_size;
+};
+
+// Subtree collected by export_tree() before it is laid out
+struct reg_api::tree_export
+{
+    std::vector<std::pair<std::string, snapshot>> keys; // Relative path, values
+    std::vector<char> buffer;                           // Query buffer
+};
+
+bool reg_api::collect_tree(HKEY h_key, const std::string& relative_path, tree_export& out)
+{
+    bool wide = (m_text_encoding == text_encoding::utf8);
+    out.keys.emplace_back(relative_path, load_key(h_key, out.buffer, m_syscall_count, m_text_encoding));
+    
+    DWORD subkey_count = 0;
+    DWORD max_subkey_size = 0;
+    ++m_syscall_count;
+    if (reg_info(h_key, &subkey_count, &max_subkey_size, NULL, NULL, NULL, wide) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    bool ok = true;
+    std::vector<char> name(static_cast<size_t>(max_subkey_size) + 1);
+    
+    for (DWORD index = 0; ; )
+    {
+        DWORD name_size = static_cast<DWORD>(name.size());
+        ++m_syscall_count;
+        LONG result = reg_enum_key(h_key, index, name.data(), &name_size, wide);
+        
+        if (result == ERROR_NO_MORE_ITEMS)
+        {
+            break;
+        }
+        
+        if (result == ERROR_MORE_DATA)
+        {
+            // A longer subkey appeared since RegQueryInfoKeyA
+            name.resize(name.size() * 2);
+            continue;
+        }
+        
+        if (result != ERROR_SUCCESS)
+        {
+            return false;
+        }
+        
+        std::string child_path = relative_path.empty()
+            ? std::string(name.data(), name_size)
+            : relative_path + "\\" + std::string(name.data(), name_size);
+        
+        HKEY h_child = NULL;
+        ++m_syscall_count;
+        if (reg_open(h_key, name.data(), KEY_READ, h_child, wide) == ERROR_SUCCESS)
+        {
+            ok = collect_tree(h_child, child_path, out) && ok;
+            ++m_syscall_count;
+            reg_close(h_child);
+        }
+        else
+        {
+            ok = false;
+        }
+        
+        ++index;
+    }
+    
+    return ok;
+}
+
+bool reg_api::export_tree(const std::string& key_path, const std::string& file_path)
+{
+    HKEY h_key = NULL;
+    ++m_syscall_count;
+    if (reg_open(m_h_root_key, key_path.c_str(), KEY_READ, h_key, m_text_encoding == text_encoding::utf8) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    tree_export tree;
+    bool ok = collect_tree(h_key, "", tree);
+    ++m_syscall_count;
+    reg_close(h_key);
+    
+    if (!ok)
+    {
+        return false;
+    }
+    
+    std::sort(tree.keys.begin(), tree.keys.end(), [](const std::pair<std::string, snapshot>& a,
+                                                     const std::pair<std::string, snapshot>& b)
+    {
+        return compare_names(a.first.data(), a.first.size(), b.first.data(), b.first.size()) < 0;
+    });
+    
+    // Lay out the tables first, then the string pool and the blob
+    std::vector<tree_file::key_record> key_records;
+    std::vector<tree_file::value_record> value_records;
+    std::vector<char> strings;
+    std::vector<char> blob;
+    
+    for (const auto& key : tree.keys)
+    {
+        tree_file::key_record record;
+        record.path_offset = static_cast<uint32_t>(strings.size());
+        record.path_size = static_cast<uint32_t>(key.first.size());
+        record.first_value = static_cast<uint32_t>(value_records.size());
+        record.value_count = static_cast<uint32_t>(key.second.m_index.size());
+        strings.insert(strings.end(), key.first.begin(), key.first.end());
+        key_records.push_back(record);
+        
+        // Snapshot entries are already sorted by name
+        const char* source = key.second.m_blob.data();
+        for (const snapshot::entry& item : key.second.m_index)
+        {
+            tree_file::value_record value;
+            value.name_offset = static_cast<uint32_t>(strings.size());
+            value.name_size = item.name_size;
+            value.type = item.type;
+            value.data_offset = static_cast<uint32_t>(blob.size());
+            value.data_size = item.data_size;
+            strings.insert(strings.end(), source + item.name_offset, source + item.name_offset + item.name_size);
+            blob.insert(blob.end(), source + item.data_offset, source + item.data_offset + item.data_size);
+            value_records.push_back(value);
+        }
+    }
+    
+    tree_header header;
+    header.magic = tree_magic;
+    header.version = tree_version;
+    header.key_count = static_cast<uint32_t>(key_records.size());
+    header.value_count = static_cast<uint32_t>(value_records.size());
+    
+    size_t offset = align4(sizeof(header));
+    const size_t keys_offset = offset;
+    offset = align4(offset + key_records.size() * sizeof(tree_file::key_record));
+    const size_t values_offset = offset;
+    offset = align4(offset + value_records.size() * sizeof(tree_file::value_record));
+    const size_t strings_offset = offset;
+    offset = align4(offset + strings.size());
+    const size_t blob_offset = offset;
+    const size_t total_size = offset + blob.size();
+    
+    // Offsets are 32-bit
+    if (total_size > 0xFFFFFFFFu)
+    {
+        return false;
+    }
+    
+    header.keys_offset = static_cast<uint32_t>(keys_offset);
+    header.values_offset = static_cast<uint32_t>(values_offset);
+    header.strings_offset = static_cast<uint32_t>(strings_offset);
+    header.strings_size = static_cast<uint32_t>(strings.size());
+    header.blob_offset = static_cast<uint32_t>(blob_offset);
+    header.blob_size = static_cast<uint32_t>(blob.size());
+    
+    std::vector<char> file(total_size, '\0');
+    memcpy(file.data(), &header, sizeof(header));
+    if (!key_records.empty())
+    {
+        memcpy(file.data() + keys_offset, key_records.data(), key_records.size() * sizeof(tree_file::key_record));
+    }
+    if (!value_records.empty())
+    {
+        memcpy(file.data() + values_offset, value_records.data(), value_records.size() * sizeof(tree_file::value_record));
+    }
+    if (!strings.empty())
+    {
+        memcpy(file.data() + strings_offset, strings.data(), strings.size());
+    }
+    if (!blob.empty())
+    {
+        memcpy(file.data() + blob_offset, blob.data(), blob.size());
+    }
+    
+    HANDLE h_file = CreateFileA(file_path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h_file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    
+    DWORD written = 0;
+    ok = WriteFile(h_file, file.data(), static_cast<DWORD>(file.size()), &written, NULL) && written == file.size();
+    CloseHandle(h_file);
+    return ok;
+}
+
+bool reg_api::import_tree(const std::string& file_path, const std::string& key_path)
+{
+    // A remote registry is only read
+    if (is_remote())
+    {
+        return false;
+    }
+    
+    tree_file tree;
+    if (!tree.open(file_path))
+    {
+        return false;
+    }
+    
+    // The open key may be one of those rewritten below
+    m_cache.clear();
+    
+    const std::string prefix = key_path.empty() ? std::string() : key_path + "\\";
+    const tree_file::key_record* keys = tree.keys();
+    const tree_file::value_record* values = tree.values();
+    const tree_header* header = reinterpret_cast<const tree_header*>(tree.m_base);
+    const char* strings = tree.m_base + header->strings_offset;
+    const char* blob = tree.m_base + header->blob_offset;
+    bool ok = true;
+    
+    for (uint32_t k = 0; k < header->key_count; ++k)
+    {
+        const tree_file::key_record& key = keys[k];
+        std::string path = (key.path_size == 0)
+            ? key_path
+            : prefix + std::string(strings + key.path_offset, key.path_size);
+        
+        HKEY h_key = NULL;
+        if (open_or_create(m_h_root_key, path.c_str(), KEY_WRITE, h_key, m_syscall_count, m_text_encoding) != ERROR_SUCCESS)
+        {
+            ok = false;
+            continue;
+        }
+        
+        // Names and data go to the registry straight from the mapping
+        for (uint32_t v = key.first_value; v < key.first_value + key.value_count; ++v)
+        {
+            const tree_file::value_record& value = values[v];
+            c_name name(std::string_view(strings + value.name_offset, value.name_size));
+            if (set_registry(h_key, name.c_str(), value.type, blob + value.data_offset, value.data_size) != ERROR_SUCCESS)
+            {
+                ok = false;
+            }
+        }
+        
+        ++m_syscall_count;
+        reg_close(h_key);
+    }
+    
+    return ok;
+}
+
+namespace
+{
+    // Append-only storage for the paths of keys queued by walk(). Blocks are
+    // never moved or freed before the walk ends, so views handed to other
+    // walkers stay valid
+    struct name_arena
+    {
+        static constexpr size_t block_size = 64 * 1024;
+        
+        std::vector<std::unique_ptr<char[]>> blocks;
+        size_t used = 0;
+        size_t capacity = 0;
+        
+        // parent + "\\" + name, or name alone under the walked key
+        std::string_view join(std::string_view parent, const char* name, size_t name_size)
+        {
+            size_t size = parent.empty() ? name_size : parent.size() + 1 + name_size;
+            if (capacity - used < size)
+            {
+                capacity = std::max(block_size, size);
+                blocks.emplace_back(new char[capacity]);
+                used = 0;
+            }
+            
+            char* out = blocks.back().get() + used;
+            used += size;
+            
+            char* p = out;
+            if (!parent.empty())
+            {
+                memcpy(p, parent.data(), parent.size());
+                p += parent.size();
+                *p++ = '\\';
+            }
+            memcpy(p, name, name_size);
+            return std::string_view(out, size);
+        }
+    };
+
+    // RegEnumKeyEx over every subkey of h_key into a name buffer presized
+    // from RegQueryInfoKey; on_name(name, size) is called for each. False if
+    // the enumeration failed
+    template<typename Buffer, typename Callback>
+    bool for_each_subkey(HKEY h_key, DWORD max_subkey_size, Buffer& name,
+                         unsigned long long& calls, bool wide, Callback on_name)
+    {
+        if (name.size() < static_cast<size_t>(max_subkey_size) + 1)
+        {
+            name.resize(static_cast<size_t>(max_subkey_size) + 1);
+        }
+        
+        for (DWORD index = 0; ; )
+        {
+            DWORD name_size = static_cast<DWORD>(name.size());
+            ++calls;
+            LONG result = reg_enum_key(h_key, index, name.data(), &name_size, wide);
+            
+            if (result == ERROR_NO_MORE_ITEMS)
+            {
+                return true;
+            }
+            
+            if (result == ERROR_MORE_DATA)
+            {
+                // A longer subkey appeared since RegQueryInfoKey
+                name.resize(name.size() * 2);
+                continue;
+            }
+            
+            if (result != ERROR_SUCCESS)
+            {
+                return false;
+            }
+            
+            on_name(name.data(), static_cast<size_t>(name_size));
+            ++index;
+        }
+    }
+}
+
+std::vector<std::string> reg_api::subkey_names(const std::string& key_path)
+{
+    std::vector<std::string> names;
+    if (!m_is_open)
+    {
+        return names;
+    }
+    
+    bool wide = (m_text_encoding == text_encoding::utf8);
+    HKEY h_key = m_h_key;
+    if (!key_path.empty())
+    {
+        ++m_syscall_count;
+        if (reg_open(m_h_key, key_path.c_str(), KEY_READ, h_key, wide) != ERROR_SUCCESS)
+        {
+            return names;
+        }
+    }
+    
+    DWORD subkey_count = 0;
+    DWORD max_subkey_size = 0;
+    ++m_syscall_count;
+    if (reg_info(h_key, &subkey_count, &max_subkey_size, NULL, NULL, NULL, wide) == ERROR_SUCCESS)
+    {
+        names.reserve(subkey_count);
+        scratch_scope scratch;
+        std::pmr::vector<char> name(scratch_resource());
+        for_each_subkey(h_key, max_subkey_size, name, m_syscall_count, wide,
+                        [&names](const char* subkey, size_t size) { names.emplace_back(subkey, size); });
+    }
+    
+    if (h_key != m_h_key)
+    {
+        ++m_syscall_count;
+        reg_close(h_key);
+    }
+    
+    return names;
+}
+
+// Keys waiting to be visited sit in per-walker deques. A walker takes its
+// own newest key first (depth first, hot in the registry's cache) and,
+// when it runs dry, steals the oldest key of another walker; the oldest
+// keys are the highest in the tree, so a steal moves a whole large subtree.
+struct reg_api::tree_walk
+{
+    struct item
+    {
+        HKEY h_key;            // Opened by the parent's walker, closed after the visit
+        std::string_view path; // In the arena of the walker that queued it
+        size_t depth;
+    };
+    
+    struct walker
+    {
+        std::mutex mutex;              // Guards queue
+        std::deque<item> queue;
+        name_arena names;              // Owner-only
+        std::vector<char> buffer;      // Value data for load_key()
+        std::vector<char> name;        // Subkey names
+        unsigned long long calls = 0;
+    };
+    
+    const walk_callback& on_node;
+    walk_options options;
+    text_encoding encoding;
+    bool wide;
+    std::vector<std::unique_ptr<walker>> walkers;
+    
+    std::atomic<size_t> pending{0};  // Keys queued or being visited
+    std::atomic<size_t> queued{0};   // Keys sitting in a deque
+    std::atomic<size_t> sleepers{0};
+    std::atomic<bool> failed{false};
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+    
+    tree_walk(const walk_callback& callback, const walk_options& walk, text_encoding text, size_t walker_count)
+        : on_node(callback), options(walk), encoding(text), wide(text == text_encoding::utf8)
+    {
+        for (size_t i = 0; i < walker_count; ++i)
+        {
+            walkers.emplace_back(new walker());
+        }
+    }
+    
+    void push(walker& self, const item& next)
+    {
+        pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(self.mutex);
+            self.queue.push_back(next);
+        }
+        queued.fetch_add(1);
+        
+        if (sleepers.load() > 0)
+        {
+            // Taking the mutex orders this with a walker about to wait
+            { std::lock_guard<std::mutex> lock(idle_mutex); }
+            idle.notify_one();
+        }
+    }
+    
+    bool take(size_t index, item& out)
+    {
+        {
+            walker& self = *walkers[index];
+            std::lock_guard<std::mutex> lock(self.mutex);
+            if (!self.queue.empty())
+            {
+                out = self.queue.back();
+                self.queue.pop_back();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        
+        for (size_t i = 1; i < walkers.size(); ++i)
+        {
+            walker& victim = *walkers[(index + i) % walkers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.queue.empty())
+            {
+                out = victim.queue.front();
+                victim.queue.pop_front();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    void visit(walker& self, const item& current)
+    {
+        DWORD subkey_count = 0;
+        DWORD max_subkey_size = 0;
+        DWORD value_count = 0;
+        ++self.calls;
+        if (reg_info(current.h_key, &subkey_count, &max_subkey_size, &value_count, NULL, NULL, wide) != ERROR_SUCCESS)
+        {
+            failed.store(true);
+            subkey_count = 0;
+        }
+        
+        snapshot values;
+        if (options.values)
+        {
+            values = load_key(current.h_key, self.buffer, self.calls, encoding);
+        }
+        
+        size_t slash = current.path.rfind('\\');
+        tree_node node;
+        node.path = current.path;
+        node.name = (slash == std::string_view::npos) ? current.path : current.path.substr(slash + 1);
+        node.depth = current.depth;
+        node.subkey_count = subkey_count;
+        node.value_count = value_count;
+        node.values = options.values ? &values : nullptr;
+        
+        if (on_node(node) && subkey_count > 0 && current.depth < options.max_depth)
+        {
+            bool ok = for_each_subkey(current.h_key, max_subkey_size, self.name, self.calls, wide,
+                [&](const char* subkey, size_t size)
+                {
+                    item child;
+                    child.h_key = NULL;
+                    ++self.calls;
+                    if (reg_open(current.h_key, subkey, KEY_READ, child.h_key, wide) != ERROR_SUCCESS)
+                    {
+                        failed.store(true);
+                        return;
+                    }
+                    child.path = self.names.join(current.path, subkey, size);
+                    child.depth = current.depth + 1;
+                    push(self, child);
+                });
+            if (!ok)
+            {
+                failed.store(true);
+            }
+        }
+        
+        ++self.calls;
+        reg_close(current.h_key);
+        
+        if (pending.fetch_sub(1) == 1)
+        {
+            // Last key done; wake every idle walker so it can return
+            { std::lock_guard<std::mutex> lock(idle_mutex); }
+            idle.notify_all();
+        }
+    }
+    
+    void run(size_t index)
+    {
+        walker& self = *walkers[index];
+        for (;;)
+        {
+            item next;
+            if (take(index, next))
+            {
+                visit(self, next);
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            sleepers.fetch_add(1);
+            idle.wait(lock, [this]() { return queued.load() > 0 || pending.load() == 0; });
+            sleepers.fetch_sub(1);
+            if (pending.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+};
+
+bool reg_api::walk(const std::string& key_path, const walk_callback& on_node, const walk_options& options)
+{
+    bool wide = (m_text_encoding == text_encoding::utf8);
+    HKEY h_key = NULL;
+    ++m_syscall_count;
+    if (reg_open(m_h_root_key, key_path.c_str(), KEY_READ, h_key, wide) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    
+    size_t walker_count = options.threads;
+    if (walker_count == 0)
+    {
+        walker_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    
+    tree_walk state(on_node, options, m_text_encoding, walker_count);
+    
+    tree_walk::item root;
+    root.h_key = h_key;
+    root.path = std::string_view();
+    root.depth = 0;
+    state.push(*state.walkers[0], root);
+    
+    // The calling thread is walker 0
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < walker_count; ++i)
+    {
+        threads.emplace_back([&state, i]() { state.run(i); });
+    }
+    state.run(0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    
+    for (const std::unique_ptr<tree_walk::walker>& self : state.walkers)
+    {
+        m_syscall_count += self->calls;
+    }
+    
+    return !state.failed.load();
+}
+
+reg_api::tree_file::tree_file()
+    : m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(NULL)
+    , m_base(nullptr)
+    , m_size(0)
+{
+}
+
+reg_api::tree_file::~tree_file()
+{
+    close();
+}
+
+reg_api::tree_file::tree_file(tree_file&& other) noexcept
+    : m_file(other.m_file)
+    , m_mapping(other.m_mapping)
+    , m_base(other.m_base)
+    , m_size(other.m_size)
+{
+    other.m_file = INVALID_HANDLE_VALUE;
+    other.m_mapping = NULL;
+    other.m_base = nullptr;
+    other.m_size = 0;
+}
+
+reg_api::tree_file& reg_api::tree_file::operator=(tree_file&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_file = other.m_file;
+        m_mapping = other.m_mapping;
+        m_base = other.m_base;
+        m_size = other.m_size;
+        other.m_file = INVALID_HANDLE_VALUE;
+        other.m_mapping = NULL;
+        other.m_base = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+bool reg_api::tree_file::open(const std::string& file_path)
+{
+    close();
+    
+    m_file = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(sizeof(tree_header)) ||
+        file_size.QuadPart > 0xFFFFFFFFLL)
+    {
+        close();
+        return false;
+    }
+    
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping != NULL)
+    {
+        m_base = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (m_base == nullptr)
+    {
+        close();
+        return false;
+    }
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    
+    // Validate every offset once so lookups can trust the tables
+    const tree_header* header = reinterpret_cast<const tree_header*>(m_base);
+    const unsigned long long size = m_size;
+    bool valid = header->magic == tree_magic && header->version == tree_version &&
+        header->keys_offset % 4 == 0 && header->values_offset % 4 == 0 &&
+        header->keys_offset + 1ULL * header->key_count * sizeof(key_record) <= size &&
+        header->values_offset + 1ULL * header->value_count * sizeof(value_record) <= size &&
+        header->strings_offset + 1ULL * header->strings_size <= size &&
+        header->blob_offset + 1ULL * header->blob_size <= size;
+    
+    for (uint32_t k = 0; valid && k < header->key_count; ++k)
+    {
+        const key_record& key = keys()[k];
+        valid = key.path_offset + 1ULL * key.path_size <= header->strings_size &&
+                key.first_value + 1ULL * key.value_count <= header->value_count;
+    }
+    
+    for (uint32_t v = 0; valid && v < header->value_count; ++v)
+    {
+        const value_record& value = values()[v];
+        valid = value.name_offset + 1ULL * value.name_size <= header->strings_size &&
+                value.data_offset + 1ULL * value.data_size <= header->blob_size;
+    }
+    
+    if (!valid)
+    {
+        close();
+        return false;
+    }
+    
+    return true;
+}
+
+void reg_api::tree_file::close()
+{
+    if (m_base != nullptr)
+    {
+        UnmapViewOfFile(m_base);
+        m_base = nullptr;
+    }
+    if (m_mapping != NULL)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+}
+
+bool reg_api::tree_file::is_open() const
+{
+    return m_base != nullptr;
+}
+
+const reg_api::tree_file::key_record* reg_api::tree_file::keys() const
+{
+    return reinterpret_cast<const key_record*>(m_base + reinterpret_cast<const tree_header*>(m_base)->keys_offset);
+}
+
+const reg_api::tree_file::value_record* reg_api::tree_file::values() const
+{
+    return reinterpret_cast<const value_record*>(m_base + reinterpret_cast<const tree_header*>(m_base)->values_offset);
+}
+
+size_t reg_api::tree_file::key_count() const
+{
+    return is_open() ? reinterpret_cast<const tree_header*>(m_base)->key_count : 0;
+}
+
+std::string reg_api::tree_file::key_at(size_t index) const
+{
+    if (index >= key_count())
+    {
+        throw std::out_of_range("tree_file key index out of range");
+    }
+    
+    const key_record& key = keys()[index];
+    const char* strings = m_base + reinterpret_cast<const tree_header*>(m_base)->strings_offset;
+    return std::string(strings + key.path_offset, key.path_size);
+}
+
+bool reg_api::tree_file::contains_key(std::string_view key_path) const
+{
+    return find_key(key_path) != nullptr;
+}
+
+const reg_api::tree_file::key_record* reg_api::tree_file::find_key(std::string_view key_path) const
+{
+    if (!is_open())
+    {
+        return nullptr;
+    }
+    
+    const key_record* first = keys();
+    const key_record* last = first + key_count();
+    const char* strings = m_base + reinterpret_cast<const tree_header*>(m_base)->strings_offset;
+    
+    const key_record* it = std::lower_bound(first, last, key_path, [strings](const key_record& key, std::string_view path)
+    {
+        return compare_names(strings + key.path_offset, key.path_size, path.data(), path.size()) < 0;
+    });
+    
+    if (it == last || compare_names(strings + it->path_offset, it->path_size, key_path.data(), key_path.size()) != 0)
+    {
+        return nullptr;
+    }
+    
+    return it;
+}
+
+const reg_api::tree_file::value_record* reg_api::tree_file::find_value(const key_record& key, std::string_view value_name) const
+{
+    const value_record* first = values() + key.first_value;
+    const value_record* last = first + key.value_count;
+    const char* strings = m_base + reinterpret_cast<const tree_header*>(m_base)->strings_offset;
+    
+    const value_record* it = std::lower_bound(first, last, value_name, [strings](const value_record& value, std::string_view name)
+    {
+        return compare_names(strings + value.name_offset, value.name_size, name.data(), name.size()) < 0;
+    });
+    
+    if (it == last || compare_names(strings + it->name_offset, it->name_size, value_name.data(), value_name.size()) != 0)
+    {
+        return nullptr;
+    }
+    
+    return it;
+}
+
+bool reg_api::tree_file::find(std::string_view key_path, std::string_view value_name,
+                              DWORD& type, const char*& data, DWORD& data_size) const
+{
+    const key_record* key = find_key(key_path);
+    if (key == nullptr)
+    {
+        return false;
+    }
+    
+    const value_record* value = find_value(*key, value_name);
+    if (value == nullptr)
+    {
+        return false;
+    }
+    
+    type = value->type;
+    data = m_base + reinterpret_cast<const tree_header*>(m_base)->blob_offset + value->data_offset;
+    data_size = value->data_size;
+    return true;
+}
+
+std::string reg_api::tree_file::read_string(std::string_view key_path, std::string_view value_name,
+                                            const std::string& default_value) const
+{
+    DWORD type = REG_NONE;
+    const char* data = nullptr;
+    DWORD data_size = 0;
+    if (!find(key_path, value_name, type, data, data_size))
+    {
+        return default_value;
+    }
+    
+    return decode_string(data, data_size);
+}
+
+reg_api::snapshot reg_api::tree_file::load(std::string_view key_path) const
+{
+    snapshot result;
+    
+    const key_record* key = find_key(key_path);
+    if (key == nullptr)
+    {
+        return result;
+    }
+    
+    const tree_header* header = reinterpret_cast<const tree_header*>(m_base);
+    const char* strings = m_base + header->strings_offset;
+    const char* blob = m_base + header->blob_offset;
+    
+    result.m_index.reserve(key->value_count);
+    for (uint32_t v = key->first_value; v < key->first_value + key->value_count; ++v)
+    {
+        const value_record& value = values()[v];
+        
+        snapshot::entry item;
+        item.type = value.type;
+        item.data_offset = static_cast<DWORD>(result.m_blob.size());
+        item.data_size = value.data_size;
+        result.m_blob.insert(result.m_blob.end(), blob + value.data_offset, blob + value.data_offset + value.data_size);
+        result.add_name(item, strings + value.name_offset, value.name_size);
+        result.m_index.push_back(item);
+    }
+    
+    result.seal();
+    return result;
+}
+
+namespace
+{
+    const uint32_t slot_magic = 0x544C5352;   // "RSLT"
+    const uint32_t slot_version = 2;      // 2: slot claims take the named mutex
+    
+    // Largest table create() makes; keeps the mapping size well within a DWORD
+    const size_t max_slot_count = 1 << 20;
+    
+    // A sequence that stays at one odd value this long belongs to a writer
+    // that died mid-write; a live one holds it for a few stores
+    const std::chrono::milliseconds slot_stuck_time(100);
+    
+    // Wait for an even sequence and return it in value; false if it stayed
+    // at the same odd value for slot_stuck_time
+    bool wait_even(const std::atomic<uint32_t>& sequence, uint32_t& value, std::memory_order order)
+    {
+        typedef std::chrono::steady_clock clock;
+        
+        value = sequence.load(order);
+        uint32_t odd = value;
+        clock::time_point since;
+        for (int spin = 0; (value & 1) != 0; ++spin)
+        {
+            // Writers that keep moving the sequence are alive
+            if (value != odd)
+            {
+                odd = value;
+                spin = 0;
+            }
+            
+            if (spin < 64)
+            {
+                YieldProcessor();
+            }
+            else
+            {
+                clock::time_point now = clock::now();
+                if (spin == 64)
+                {
+                    since = now;
+                }
+                else if (now - since >= slot_stuck_time)
+                {
+                    return false;
+                }
+                std::this_thread::yield();
+            }
+            value = sequence.load(order);
+        }
+        return true;
+    }
+}
+
+// First 64 bytes of the mapping
+struct reg_api::slot_table::header
+{
+    std::atomic<uint32_t> magic;  // Stored last by the creator
+    uint32_t version;
+    uint32_t slot_count;
+    std::atomic<uint32_t> used;   // Slots with a name, which never changes again
+    uint32_t reserved[12];
+};
+
+// Two cache lines per slot, so neighbouring slots do not share one
+struct reg_api::slot_table::record
+{
+    std::atomic<uint32_t> sequence;                // Odd while a write is in progress
+    std::atomic<uint32_t> size;                    // Bytes of data in use
+    char name[max_name_size + 1];                  // Null terminated
+    std::atomic<uint64_t> data[max_data_size / 8]; // Word-wise so torn reads stay defined
+};
+
+reg_api::slot_table::slot_table()
+    : m_mapping(NULL)
+    , m_base(nullptr)
+    , m_naming(NULL)
+{
+    static_assert(sizeof(header) == 64 && sizeof(record) == 128, "slot table layout");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+                  "slots are shared between processes");
+}
+
+reg_api::slot_table::~slot_table()
+{
+    close();
+}
+
+reg_api::slot_table::slot_table(slot_table&& other) noexcept
+    : m_mapping(other.m_mapping)
+    , m_base(other.m_base)
+    , m_naming(other.m_naming)
+    , m_name(std::move(other.m_name))
+{
+    other.m_mapping = NULL;
+    other.m_base = nullptr;
+    other.m_naming = NULL;
+    other.m_name.clear();
+}
+
+reg_api::slot_table& reg_api::slot_table::operator=(slot_table&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        m_mapping = other.m_mapping;
+        m_base = other.m_base;
+        m_naming = other.m_naming;
+        m_name = std::move(other.m_name);
+        other.m_mapping = NULL;
+        other.m_base = nullptr;
+        other.m_naming = NULL;
+        other.m_name.clear();
+    }
+    return *this;
+}
+
+bool reg_api::slot_table::create(const std::string& mapping_name, size_t slot_count)
+{
+    close();
+    
+    if (slot_count == 0 || slot_count > max_slot_count)
+    {
+        return false;
+    }
+    
+    DWORD mapping_size = static_cast<DWORD>(sizeof(header) + slot_count * sizeof(record));
+    m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, mapping_size, mapping_name.c_str());
+    if (m_mapping == NULL)
+    {
+        return false;
+    }
+    
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        // Someone else created it first; use it as it is
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+        return open(mapping_name);
+    }
+    
+    m_base = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (m_base == nullptr || !open_naming(mapping_name))
+    {
+        close();
+        return false;
+    }
+    m_name = mapping_name;
+    
+    // The page-file pages start zeroed; the magic publishes the header
+    header* table_header = table();
+    table_header->version = slot_version;
+    table_header->slot_count = static_cast<uint32_t>(slot_count);
+    table_header->magic.store(slot_magic, std::memory_order_release);
+    return true;
+}
+
+bool reg_api::slot_table::open(const std::string& mapping_name)
+{
+    close();
+    
+    m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mapping_name.c_str());
+    if (m_mapping != NULL)
+    {
+        m_base = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    }
+    if (m_base == nullptr)
+    {
+        close();
+        return false;
+    }
+    
+    // The creator may still be filling in the header
+    header* table_header = table();
+    for (int spin = 0; table_header->magic.load(std::memory_order_acquire) != slot_magic; ++spin)
+    {
+        if (spin == 1000)
+        {
+            close();
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    
+    if (table_header->version != slot_version || table_header->slot_count == 0 ||
+        table_header->slot_count > max_slot_count || !open_naming(mapping_name))
+    {
+        close();
+        return false;
+    }
+    
+    m_name = mapping_name;
+    return true;
+}
+
+bool reg_api::slot_table::open_naming(const std::string& mapping_name)
+{
+    // Same namespace as the mapping: a Global\ or Local\ prefix carries over
+    m_naming = CreateMutexA(NULL, FALSE, (mapping_name + ".naming").c_str());
+    return m_naming != NULL;
+}
+
+void reg_api::slot_table::close()
+{
+    if (m_naming != NULL)
+    {
+        CloseHandle(m_naming);
+        m_naming = NULL;
+    }
+    if (m_base != nullptr)
+    {
+        UnmapViewOfFile(m_base);
+        m_base = nullptr;
+    }
+    if (m_mapping != NULL)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+    m_name.clear();
+}
+
+bool reg_api::slot_table::is_open() const
+{
+    return m_base != nullptr;
+}
+
+const std::string& reg_api::slot_table::name() const
+{
+    return m_name;
+}
+
+size_t reg_api::slot_table::capacity() const
+{
+    return (m_base != nullptr) ? table()->slot_count : 0;
+}
+
+size_t reg_api::slot_table::size() const
+{
+    return (m_base != nullptr) ? table()->used.load(std::memory_order_acquire) : 0;
+}
+
+reg_api::slot_table::header* reg_api::slot_table::table() const
+{
+    return static_cast<header*>(m_base);
+}
+
+reg_api::slot_table::record* reg_api::slot_table::records() const
+{
+    return reinterpret_cast<record*>(static_cast<char*>(m_base) + sizeof(header));
+}
+
+size_t reg_api::slot_table::find(std::string_view name) const
+{
+    if (m_base == nullptr || name.size() > max_name_size)
+    {
+        return npos;
+    }
+    
+    // Names below used are complete and immutable
+    uint32_t used = table()->used.load(std::memory_order_acquire);
+    const record* slots = records();
+    for (uint32_t i = 0; i < used; ++i)
+    {
+        if (memcmp(slots[i].name, name.data(), name.size()) == 0 && slots[i].name[name.size()] == '\0')
+        {
+            return i;
+        }
+    }
+    return npos;
+}
+
+size_t reg_api::slot_table::slot(std::string_view name)
+{
+    size_t index = find(name);
+    if (index != npos || m_base == nullptr || name.empty() || name.size() > max_name_size)
+    {
+        return index;
+    }
+    
+    // A claim writes the name before publishing it in used, so one cut short
+    // by its owner dying (WAIT_ABANDONED) left nothing to repair
+    DWORD wait = WaitForSingleObject(m_naming, INFINITE);
+    if (wait != WAIT_OBJECT_0 && wait != WAIT_ABANDONED)
+    {
+        return npos;
+    }
+    
+    // Another process may have claimed the name meanwhile
+    header* table_header = table();
+    index = find(name);
+    uint32_t used = table_header->used.load(std::memory_order_relaxed);
+    if (index == npos && used < table_header->slot_count)
+    {
+        record& claimed = records()[used];
+        memcpy(claimed.name, name.data(), name.size());
+        claimed.name[name.size()] = '\0';
+        table_header->used.store(used + 1, std::memory_order_release);
+        index = used;
+    }
+    
+    ReleaseMutex(m_naming);
+    return index;
+}
+
+bool reg_api::slot_table::lock_record(record& slot, uint32_t& sequence)
+{
+    for (;;)
+    {
+        if (!wait_even(slot.sequence, sequence, std::memory_order_relaxed))
+        {
+            return false;
+        }
+        if (slot.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                                std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    
+    // Readers that see any of the data stores also see the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+}
+
+bool reg_api::slot_table::store(size_t index, const void* data, size_t size)
+{
+    if (m_base == nullptr || index >= this->size() || size > max_data_size)
+    {
+        return false;
+    }
+    
+    uint64_t words[max_data_size / 8] = {};
+    memcpy(words, data, size);
+    
+    record& slot = records()[index];
+    uint32_t sequence = 0;
+    if (!lock_record(slot, sequence))
+    {
+        return false;
+    }
+    
+    for (size_t w = 0; w < (size + 7) / 8; ++w)
+    {
+        slot.data[w].store(words[w], std::memory_order_relaxed);
+    }
+    slot.size.store(static_cast<uint32_t>(size), std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    return true;
+}
+
+bool reg_api::slot_table::load(size_t index, void* data, size_t capacity, size_t* size) const
+{
+    if (m_base == nullptr || index >= this->size())
+    {
+        return false;
+    }
+    
+    const record& slot = records()[index];
+    uint64_t words[max_data_size / 8];
+    uint32_t before = 0;
+    size_t length = 0;
+    
+    for (;;)
+    {
+        if (!wait_even(slot.sequence, before, std::memory_order_acquire))
+        {
+            return false;
+        }
+        
+        length = std::min<size_t>(slot.size.load(std::memory_order_relaxed), max_data_size);
+        for (size_t w = 0; w < (length + 7) / 8; ++w)
+        {
+            words[w] = slot.data[w].load(std::memory_order_relaxed);
+        }
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before)
+        {
+            break;
+        }
+    }
+    
+    // Sequence 0: claimed but never stored
+    if (before == 0 || length > capacity)
+    {
+        return false;
+    }
+    
+    memcpy(data, words, length);
+    if (size != nullptr)
+    {
+        *size = length;
+    }
+    return true;
+}
+
+bool reg_api::slot_table::add(std::string_view name, long long delta, long long* result)
+{
+    size_t index = slot(name);
+    if (index == npos)
+    {
+        return false;
+    }
+    
+    record& slot = records()[index];
+    uint32_t sequence = 0;
+    if (!lock_record(slot, sequence))
+    {
+        return false;
+    }
+    
+    // Writers are serialized by the odd sequence, so this read is stable
+    long long value = 0;
+    if (slot.size.load(std::memory_order_relaxed) == sizeof(value))
+    {
+        uint64_t word = slot.data[0].load(std::memory_order_relaxed);
+        memcpy(&value, &word, sizeof(value));
+    }
+    
+    value = static_cast<long long>(static_cast<unsigned long long>(value) + static_cast<unsigned long long>(delta));
+    uint64_t word = 0;
+    memcpy(&word, &value, sizeof(value));
+    slot.data[0].store(word, std::memory_order_relaxed);
+    slot.size.store(sizeof(value), std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    
+    if (result != nullptr)
+    {
+        *result = value;
+    }
+    return true;
+}
+
+bool reg_api::publish_slots(std::string_view value_name, const slot_table& table)
+{
+    return table.is_open() && write_string(value_name, table.name());
+}
+
+bool reg_api::open_slots(std::string_view value_name, slot_table& table)
+{
+    std::string mapping_name;
+    return read_into(value_name, mapping_name) && table.open(mapping_name);
+}
+
+reg_api::batch reg_api::begin_batch(bool transacted)
+{
+    return batch(*this, transacted);
+}
+
+reg_api::batch::batch(reg_api& owner, bool transacted)
+    : m_owner(&owner)
+    , m_transacted(transacted)
+    , m_applied(0)
+    , m_skipped(0)
+    , m_compare(true)
+{
+}
+
+bool reg_api::batch::write_string(std::string_view value_name, const std::string& value)
+{
+    // Include null terminator
+    add(value_name, false, REG_SZ, value.c_str(), static_cast<DWORD>(value.length() + 1));
+    return true;
+}
+
+bool reg_api::batch::delete_value(std::string_view value_name)
+{
+    add(value_name, true, REG_NONE, NULL, 0);
+    return true;
+}
+
+void reg_api::batch::add(std::string_view value_name, bool is_delete, DWORD type, const void* data, DWORD data_size)
+{
+    op entry;
+    entry.is_delete = is_delete;
+    entry.type = type;
+    entry.name_offset = m_arena.size();
+    entry.data_offset = entry.name_offset + value_name.size() + 1;
+    entry.data_size = data_size;
+    
+    // Offsets rather than pointers, the arena may move while it grows
+    m_arena.insert(m_arena.end(), value_name.begin(), value_name.end());
+    m_arena.push_back('\0');
+    if (data_size > 0)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        m_arena.insert(m_arena.end(), bytes, bytes + data_size);
+    }
+    
+    m_ops.push_back(entry);
+}
+
+bool reg_api::batch::commit()
+{
+    m_applied = 0;
+    m_skipped = 0;
+    
+    if (!m_owner->m_is_open)
+    {
+        return false;
+    }
+    
+    if (!m_transacted)
+    {
+        bool ok = apply(m_owner->m_h_key, true);
+        clear();
+        return ok;
+    }
+    
+    // Backends have no kernel transactions to make this atomic
+    if (backend_of(m_owner->m_h_root_key) != nullptr)
+    {
+        return false;
+    }
+    
+    // Reopen the current key inside a kernel transaction so that either all
+    // operations become visible or none do
+    ++m_owner->m_syscall_count;
+    HANDLE h_transaction = CreateTransaction(NULL, NULL, 0, 0, 0, 0, NULL);
+    if (h_transaction == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    
+    HKEY h_key = NULL;
+    ++m_owner->m_syscall_count;
+    LONG result = (m_owner->m_text_encoding == text_encoding::utf8)
+        ? RegOpenKeyTransactedW(
+            m_owner->m_h_root_key,
+            widen(m_owner->m_key_path.c_str(), thread_scratch().path),
+            0,
+            KEY_READ | KEY_WRITE,
+            &h_key,
+            h_transaction,
+            NULL
+        )
+        : RegOpenKeyTransactedA(
+            m_owner->m_h_root_key,
+            m_owner->m_key_path.c_str(),
+            0,
+            KEY_READ | KEY_WRITE,
+            &h_key,
+            h_transaction,
+            NULL
+        );
+    
+    bool ok = (result == ERROR_SUCCESS);
+    if (ok)
+    {
+        // Compare against the transacted view, the cache may not see it
+        ok = apply(h_key, false);
+        
+        ++m_owner->m_syscall_count;
+        reg_close(h_key);
+    }
+    
+    ++m_owner->m_syscall_count;
+    if (ok)
+    {
+        ok = (CommitTransaction(h_transaction) != FALSE);
+    }
+    else
+    {
+        RollbackTransaction(h_transaction);
+    }
+    
+    CloseHandle(h_transaction);
+    
+    if (!ok)
+    {
+        m_applied = 0;
+        m_skipped = 0;
+    }
+    
+    clear();
+    return ok;
+}
+
+bool reg_api::batch::apply(HKEY h_key, bool use_cache)
+{
+    bool ok = true;
+    
+    for (const op& entry : m_ops)
+    {
+        const char* name = m_arena.data() + entry.name_offset;
+        const char* data = m_arena.data() + entry.data_offset;
+        
+        DWORD type = REG_NONE;
+        DWORD data_size = 0;
+        LONG current = ERROR_SUCCESS;
+        if (!m_compare)
+        {
+            // sync() already knows these differ
+            current = entry.is_delete ? ERROR_SUCCESS : ERROR_FILE_NOT_FOUND;
+        }
+        else
+        {
+            current = use_cache
+                ? m_owner->query_value(name, type, data_size)
+                : m_owner->query_registry(h_key, name, type, data_size);
+        }
+        
+        if (entry.is_delete)
+        {
+            if (current == ERROR_FILE_NOT_FOUND)
+            {
+                ++m_skipped;
+                continue;
+            }
+            
+            m_owner->invalidate_cached(name);
+            if (m_owner->delete_registry(h_key, name) == ERROR_SUCCESS)
+            {
+                ++m_applied;
+            }
+            else
+            {
+                ok = false;
+            }
+            continue;
+        }
+        
+        // Skip byte-identical writes to avoid hive churn and notifications
+        if (current == ERROR_SUCCESS && type == entry.type && data_size == entry.data_size &&
+            memcmp(m_owner->m_read_buf.data(), data, data_size) == 0)
+        {
+            ++m_skipped;
+            continue;
+        }
+        
+        m_owner->invalidate_cached(name);
+        LONG result = m_owner->set_registry(h_key, name, entry.type, data, entry.data_size);
+        
+        if (result == ERROR_SUCCESS)
+        {
+            ++m_applied;
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+    
+    return ok;
+}
+
+void reg_api::batch::clear()
+{
+    m_arena.clear();
+    m_ops.clear();
+}
+
+size_t reg_api::batch::size() const
+{
+    return m_ops.size();
+}
+
+size_t reg_api::batch::applied() const
+{
+    return m_applied;
+}
+
+size_t reg_api::batch::skipped() const
+{
+    return m_skipped;
+}
+
+reg_api::snapshot reg_api::queued_values(const batch& pending)
+{
+    snapshot result;
+    result.m_index.reserve(pending.m_ops.size());
+    for (const batch::op& queued : pending.m_ops)
+    {
+        if (queued.is_delete)
+        {
+            continue;
+        }
+        
+        const char* name = pending.m_arena.data() + queued.name_offset;
+        const char* data = pending.m_arena.data() + queued.data_offset;
+        
+        snapshot::entry item;
+        item.type = queued.type;
+        item.data_offset = static_cast<DWORD>(result.m_blob.size());
+        item.data_size = queued.data_size;
+        result.m_blob.insert(result.m_blob.end(), data, data + queued.data_size);
+        result.add_name(item, name, strlen(name));
+        result.m_index.push_back(item);
+    }
+    
+    result.seal();
+    return result;
+}
+
+reg_api::sync_result reg_api::sync(const snapshot& desired, const sync_options& options)
+{
+    sync_result result = sync_result();
+    if (!m_is_open)
+    {
+        return result;
+    }
+    
+    // Compare against what is really stored, not what is still queued
+    if (write_behind_enabled())
+    {
+        flush().wait();
+    }
+    
+    // Every value is needed to find the extra ones, otherwise only the
+    // desired names in one bulk query
+    snapshot current;
+    if (options.delete_extra)
+    {
+        current = load_all();
+    }
+    else
+    {
+        std::vector<std::string> names;
+        names.reserve(desired.size());
+        for (const snapshot::entry& item : desired.m_index)
+        {
+            names.emplace_back(desired.m_blob.data() + item.name_offset, item.name_size);
+        }
+        current = load(names);
+    }
+    
+    std::string name;
+    batch pending = begin_batch(options.transacted);
+    pending.m_compare = false;
+    
+    for (const snapshot::entry& item : desired.m_index)
+    {
+        const char* data = desired.m_blob.data() + item.data_offset;
+        name.assign(desired.m_blob.data() + item.name_offset, item.name_size);
+        
+        const snapshot::entry* stored = current.lookup(name);
+        if (stored != nullptr && stored->type == item.type && stored->data_size == item.data_size &&
+            memcmp(current.m_blob.data() + stored->data_offset, data, item.data_size) == 0)
+        {
+            ++result.skipped;
+            continue;
+        }
+        
+        pending.add(name, false, item.type, data, item.data_size);
+        ++result.sets;
+    }
+    
+    if (options.delete_extra)
+    {
+        for (const snapshot::entry& item : current.m_index)
+        {
+            name.assign(current.m_blob.data() + item.name_offset, item.name_size);
+            if (desired.lookup(name) == nullptr)
+            {
+                pending.add(name, true, REG_NONE, NULL, 0);
+                ++result.deletes;
+            }
+        }
+    }
+    
+    result.ok = options.dry_run || pending.size() == 0 || pending.commit();
+    return result;
+}
+
+void reg_api::set_storage_mode(storage_mode mode)
+{
+    m_storage_mode = mode;
+}
+
+reg_api::storage_mode reg_api::get_storage_mode() const
+{
+    return m_storage_mode;
+}
+
+void reg_api::set_float_format(float_format format)
+{
+    m_float_format = format;
+}
+
+reg_api::float_format reg_api::get_float_format() const
+{
+    return m_float_format;
+}
+
+void reg_api::set_text_encoding(text_encoding encoding)
+{
+    // Cached strings and indexed names are held in the old encoding
+    if (encoding != m_text_encoding)
+    {
+        m_cache.clear();
+        m_index_built = false;
+    }
+    m_text_encoding = encoding;
+}
+
+reg_api::text_encoding reg_api::get_text_encoding() const
+{
+    return m_text_encoding;
+}
+
+void reg_api::enable_cache(bool enable)
+{
+    if (enable == m_cache_enabled)
+    {
+        return;
+    }
+    
+    m_cache_enabled = enable;
+    m_cache_stats = cache_stats();
+    
+    if (enable && m_is_open)
+    {
+        start_watcher();
+    }
+    else if (!enable)
+    {
+        // The index still relies on the notifications
+        if (!m_index_enabled)
+        {
+            stop_watcher();
+        }
+        m_cache.clear();
+    }
+}
+
+bool reg_api::cache_enabled() const
+{
+    return m_cache_enabled;
+}
+
+reg_api::cache_stats reg_api::get_cache_stats() const
+{
+    cache_stats stats = m_cache_stats;
+    stats.entries = m_cache.size();
+    return stats;
+}
+
+std::future<bool> reg_api::prefetch(const std::vector<prefetch_key>& plan, size_t threads)
+{
+    // The earlier plan's threads may still use the root key
+    if (m_prefetch)
+    {
+        m_prefetch->wait_all();
+        m_syscall_count += m_prefetch->syscalls.load();
+        m_prefetch.reset();
+    }
+    
+    std::shared_ptr<prefetch_state> state = std::make_shared<prefetch_state>();
+    state->h_root_key = m_h_root_key;
+    state->sam = is_remote() ? KEY_READ : KEY_READ | KEY_WRITE;
+    state->encoding = m_text_encoding;
+    state->keys.resize(plan.size());
+    for (size_t i = 0; i < plan.size(); ++i)
+    {
+        prefetch_state::key_entry& key = state->keys[i];
+        key.key_path = plan[i].key_path;
+        key.lookup_path = plan[i].key_path;
+        for (char& ch : key.lookup_path)
+        {
+            ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+        }
+        key.value_names = plan[i].value_names;
+    }
+    state->remaining = plan.size();
+    
+    std::future<bool> result = state->finished.get_future();
+    if (plan.empty() || m_h_root_key == NULL)
+    {
+        // Nothing to read, or a remote host that could not be reached
+        state->remaining = 0;
+        state->finished.set_value(plan.empty());
+        for (prefetch_state::key_entry& key : state->keys)
+        {
+            key.done = true;
+        }
+        m_prefetch = state;
+        return result;
+    }
+    
+    size_t thread_count = std::min(std::max<size_t>(threads, 1), plan.size());
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        std::thread([state]()
+        {
+            std::vector<char> buffer;
+            for (;;)
+            {
+                size_t index = state->next.fetch_add(1);
+                if (index >= state->keys.size())
+                {
+                    return;
+                }
+                state->read_key(state->keys[index], buffer);
+            }
+        }).detach();
+    }
+    
+    m_prefetch = state;
+    return result;
+}
+
+bool reg_api::adopt_prefetched(const std::string& key_path)
+{
+    if (!m_prefetch)
+    {
+        return false;
+    }
+    
+    std::string lookup_path(key_path);
+    for (char& ch : lookup_path)
+    {
+        ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    
+    prefetch_state& state = *m_prefetch;
+    HKEY h_key = NULL;
+    HANDLE h_change = NULL;
+    std::vector<std::pair<std::string, cached_value>> values;
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        auto it = std::find_if(state.keys.begin(), state.keys.end(),
+                               [&lookup_path](const prefetch_state::key_entry& key) { return key.lookup_path == lookup_path; });
+        if (it == state.keys.end())
+        {
+            return false;
+        }
+        
+        state.ready.wait(lock, [&it]() { return it->done; });
+        
+        // Each prefetched key is taken once
+        h_key = it->h_key;
+        h_change = it->h_change;
+        values = std::move(it->values);
+        it->h_key = NULL;
+        it->h_change = NULL;
+    }
+    
+    if (h_key == NULL)
+    {
+        return false;
+    }
+    
+    m_h_key = h_key;
+    m_key_pooled = false;
+    m_is_open = true;
+    m_key_path = key_path;
+    
+    if (m_cache_enabled || m_index_enabled)
+    {
+        start_watcher();
+    }
+    
+    // The watcher reports changes from here on; the prefetch event covers
+    // the time before it was armed
+    if (m_cache_enabled && m_watch_ok && h_change != NULL && state.encoding == m_text_encoding)
+    {
+        unsigned long generation = m_change_generation.load(std::memory_order_acquire);
+        if (WaitForSingleObject(h_change, 0) == WAIT_TIMEOUT)
+        {
+            for (std::pair<std::string, cached_value>& value : values)
+            {
+                m_cache[std::move(value.first)] = std::move(value.second);
+            }
+            m_cache_generation = generation;
+        }
+    }
+    
+    if (h_change != NULL)
+    {
+        CloseHandle(h_change);
+    }
+    return true;
+}
+
+void reg_api::invalidate_cached(std::string_view value_name)
+{
+    if (m_index_built)
+    {
+        m_index_dirty.emplace_back(value_name);
+    }
+    
+    if (m_cache.empty())
+    {
+        return;
+    }
+    
+    m_cache_key.assign(value_name);
+    for (char& ch : m_cache_key)
+    {
+        ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    m_cache.erase(m_cache_key);
+}
+
+void reg_api::enable_value_index(bool enable)
+{
+    if (enable == m_index_enabled)
+    {
+        return;
+    }
+    
+    m_index_enabled = enable;
+    m_index_stats = index_stats();
+    m_index_built = false;
+    m_index.clear();
+    m_index_names.clear();
+    m_index_dirty.clear();
+    
+    if (enable && m_is_open && !m_cache_enabled)
+    {
+        start_watcher();
+    }
+    else if (!enable && !m_cache_enabled)
+    {
+        stop_watcher();
+    }
+}
+
+bool reg_api::value_index_enabled() const
+{
+    return m_index_enabled;
+}
+
+reg_api::index_stats reg_api::get_index_stats() const
+{
+    index_stats stats = m_index_stats;
+    stats.entries = m_index.size();
+    return stats;
+}
+
+std::vector<reg_api::index_entry>::iterator reg_api::index_lower_bound(std::string_view name)
+{
+    return std::lower_bound(m_index.begin(), m_index.end(), name,
+                            [](const index_entry& entry, std::string_view key)
+                            {
+                                return compare_names(entry.name.data(), entry.name.size(), key.data(), key.size()) < 0;
+                            });
+}
+
+reg_api::index_range reg_api::find_prefix(std::string_view prefix)
+{
+    refresh_index();
+    
+    // Names sharing a prefix are adjacent in the case-insensitive order
+    auto first = index_lower_bound(prefix);
+    auto last = std::upper_bound(first, m_index.end(), prefix,
+                                 [](std::string_view key, const index_entry& entry)
+                                 {
+                                     size_t size = std::min(entry.name.size(), key.size());
+                                     return compare_names(key.data(), key.size(), entry.name.data(), size) < 0;
+                                 });
+    
+    index_range range;
+    range.first = m_index.data() + (first - m_index.begin());
+    range.last = m_index.data() + (last - m_index.begin());
+    return range;
+}
+
+reg_api::index_range reg_api::find_range(std::string_view first, std::string_view last)
+{
+    refresh_index();
+    
+    auto begin = index_lower_bound(first);
+    auto end = index_lower_bound(last);
+    if (end < begin)
+    {
+        end = begin;
+    }
+    
+    index_range range;
+    range.first = m_index.data() + (begin - m_index.begin());
+    range.last = m_index.data() + (end - m_index.begin());
+    return range;
+}
+
+void reg_api::refresh_index()
+{
+    if (!m_index_enabled || !m_is_open)
+    {
+        m_index.clear();
+        return;
+    }
+    
+    ++m_index_stats.queries;
+    
+    // Read the generation first, so a change during the rebuild is not lost.
+    // Without notifications the index cannot be trusted between queries.
+    unsigned long generation = m_change_generation.load(std::memory_order_acquire);
+    if (!m_index_built || !m_watch_ok || generation != m_index_generation)
+    {
+        rebuild_index();
+        m_index_generation = generation;
+        m_index_built = true;
+        m_index_dirty.clear();
+        ++m_index_stats.rebuilds;
+        return;
+    }
+    
+    // Our own changes, applied before their notification arrives
+    for (const std::string& value_name : m_index_dirty)
+    {
+        patch_index(value_name);
+    }
+    m_index_dirty.clear();
+}
+
+void reg_api::rebuild_index()
+{
+    bool wide = (m_text_encoding == text_encoding::utf8);
+    m_index.clear();
+    m_index_names.clear();
+    
+    DWORD value_count = 0;
+    DWORD max_name_size = 0;
+    ++m_syscall_count;
+    if (reg_info(m_h_key, NULL, NULL, &value_count, &max_name_size, NULL, wide) != ERROR_SUCCESS)
+    {
+        return;
+    }
+    
+    // Offsets first: the name storage may move while it grows
+    scratch_scope scratch;
+    std::pmr::vector<std::pair<size_t, DWORD>> spans(scratch_resource());
+    spans.reserve(value_count);
+    m_index.reserve(value_count);
+    
+    std::pmr::vector<char> name(static_cast<size_t>(max_name_size) + 1, scratch_resource());
+    for (DWORD index = 0; ; )
+    {
+        DWORD name_size = static_cast<DWORD>(name.size());
+        DWORD type = REG_NONE;
+        
+        // Names and types only; the data is never read
+        ++m_syscall_count;
+        LONG result = reg_enum_value(m_h_key, index, name.data(), &name_size, &type, NULL, NULL, wide);
+        
+        if (result == ERROR_NO_MORE_ITEMS)
+        {
+            break;
+        }
+        
+        if (result == ERROR_MORE_DATA)
+        {
+            // A longer name appeared since RegQueryInfoKey
+            name.resize(name.size() * 2);
+            continue;
+        }
+        
+        if (result != ERROR_SUCCESS)
+        {
+            break;
+        }
+        
+        spans.emplace_back(m_index_names.size(), name_size);
+        m_index_names.insert(m_index_names.end(), name.data(), name.data() + name_size);
+        
+        index_entry entry;
+        entry.type = type;
+        m_index.push_back(entry);
+        
+        ++index;
+    }
+    
+    for (size_t i = 0; i < m_index.size(); ++i)
+    {
+        m_index[i].name = std::string_view(m_index_names.data() + spans[i].first, spans[i].second);
+    }
+    
+    std::sort(m_index.begin(), m_index.end(), [](const index_entry& a, const index_entry& b)
+              {
+                  return compare_names(a.name.data(), a.name.size(), b.name.data(), b.name.size()) < 0;
+              });
+}
+
+void reg_api::patch_index(const std::string& value_name)
+{
+    DWORD type = REG_NONE;
+    ++m_syscall_count;
+    LONG result = reg_query(m_h_key, value_name.c_str(), &type, NULL, NULL, m_text_encoding == text_encoding::utf8);
+    
+    auto it = index_lower_bound(value_name);
+    bool found = (it != m_index.end() &&
+                  compare_names(it->name.data(), it->name.size(), value_name.data(), value_name.size()) == 0);
+    
+    ++m_index_stats.patches;
+    
+    if (result != ERROR_SUCCESS)
+    {
+        if (found && result == ERROR_FILE_NOT_FOUND)
+        {
+            // Its name stays in the storage until the next rebuild
+            m_index.erase(it);
+        }
+        return;
+    }
+    
+    if (found)
+    {
+        it->type = type;
+        return;
+    }
+    
+    // Grow the name storage by hand so every entry can be re-pointed
+    if (m_index_names.capacity() - m_index_names.size() < value_name.size())
+    {
+        std::vector<char> grown;
+        grown.reserve(std::max(m_index_names.capacity() * 2, m_index_names.size() + value_name.size()));
+        grown.assign(m_index_names.begin(), m_index_names.end());
+        for (index_entry& entry : m_index)
+        {
+            entry.name = std::string_view(grown.data() + (entry.name.data() - m_index_names.data()), entry.name.size());
+        }
+        m_index_names.swap(grown);
+    }
+    
+    size_t position = static_cast<size_t>(it - m_index.begin());
+    size_t offset = m_index_names.size();
+    m_index_names.insert(m_index_names.end(), value_name.begin(), value_name.end());
+    
+    index_entry entry;
+    entry.name = std::string_view(m_index_names.data() + offset, value_name.size());
+    entry.type = type;
+    m_index.insert(m_index.begin() + position, entry);
+}
+
+void reg_api::start_watcher()
+{
+    stop_watcher();
+    
+    m_watch_stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (m_watch_stop == NULL)
+    {
+        return;
+    }
+    
+    // Asynchronous notifications are tied to the thread that registered them,
+    // so the watcher thread arms them itself and reports the first result
+    std::promise<bool> armed;
+    std::future<bool> armed_result = armed.get_future();
+    
+    HKEY h_key = m_h_key;
+    HANDLE h_stop = m_watch_stop;
+    
+    m_watch_thread = std::thread([this, h_key, h_stop, armed = std::move(armed)]() mutable
+    {
+        HANDLE h_change = CreateEventA(NULL, FALSE, FALSE, NULL);
+        bool first = true;
+        
+        for (;;)
+        {
+            LONG result = (h_change == NULL) ? ERROR_NOT_ENOUGH_MEMORY : reg_notify(
+                h_key,
+                REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET,
+                h_change
+            );
+            
+            if (first)
+            {
+                armed.set_value(result == ERROR_SUCCESS);
+                first = false;
+            }
+            
+            if (result != ERROR_SUCCESS)
+            {
+                // Without notifications the cache could go stale; bypass it
+                m_watch_ok = false;
+                break;
+            }
+            
+            HANDLE handles[2] = { h_stop, h_change };
+            DWORD wait = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            if (wait != WAIT_OBJECT_0 + 1)
+            {
+                break;
+            }
+            
+            m_change_generation.fetch_add(1, std::memory_order_release);
+        }
+        
+        if (h_change != NULL)
+        {
+            CloseHandle(h_change);
+        }
+    });
+    
+    m_watch_ok = armed_result.get();
+    
+    // Anything cached before the notification was armed may be stale
+    m_cache.clear();
+    m_index_built = false;
+}
+
+void reg_api::stop_watcher()
+{
+    m_watch_ok = false;
+    
+    if (m_watch_thread.joinable())
+    {
+        SetEvent(m_watch_stop);
+        m_watch_thread.join();
+    }
+    
+    if (m_watch_stop != NULL)
+    {
+        CloseHandle(m_watch_stop);
+        m_watch_stop = NULL;
+    }
+}
+
+unsigned long long reg_api::syscall_count() const
+{
+    // Include the calls made by the write-behind and prefetch threads
+    return m_syscall_count + (m_write_behind ? m_write_behind->syscalls.load() : 0) +
+           (m_prefetch ? m_prefetch->syscalls.load() : 0);
+}
+
+void reg_api::reset_syscall_count()
+{
+    m_syscall_count = 0;
+    if (m_write_behind)
+    {
+        m_write_behind->syscalls = 0;
+    }
+    if (m_prefetch)
+    {
+        m_prefetch->syscalls = 0;
+    }
+}
+
+namespace
+{
+    // Bump allocator behind reg_api::scratch_scope, one per thread.
+    // Deallocation is a no-op; reset() reclaims everything at once.
+    class scratch_arena : public std::pmr::memory_resource
+    {
+        public:
+            int depth = 0;                          // Open scratch_scopes
+            reg_api::scratch_stats stats = reg_api::scratch_stats();
+            
+            ~scratch_arena()
+            {
+                release();
+            }
+            
+            // Forget every allocation; when the span outgrew its block, keep
+            // a single block as large as all of them instead
+            void reset()
+            {
+                if (m_head != nullptr && m_head->next != nullptr)
+                {
+                    size_t size = std::min(m_capacity, max_retained);
+                    release();
+                    add_block(size);
+                }
+                
+                if (m_head != nullptr)
+                {
+                    m_cursor = reinterpret_cast<char*>(m_head + 1);
+                    m_end = reinterpret_cast<char*>(m_head) + m_head->size;
+                }
+                stats.retained_bytes = (m_head != nullptr) ? m_head->size : 0;
+            }
+            
+        private:
+            struct block
+            {
+                block* next;
+                size_t size;  // Including this header
+            };
+            
+            static constexpr size_t first_block_size = 4096;
+            static constexpr size_t max_retained = 1024 * 1024;
+            
+            block* m_head = nullptr;  // Newest block
+            char* m_cursor = nullptr;
+            char* m_end = nullptr;
+            size_t m_capacity = 0;    // Bytes of every block
+            
+            void add_block(size_t size)
+            {
+                block* fresh = static_cast<block*>(::operator new(size));
+                fresh->next = m_head;
+                fresh->size = size;
+                m_head = fresh;
+                m_capacity += size;
+                m_cursor = reinterpret_cast<char*>(fresh + 1);
+                m_end = reinterpret_cast<char*>(fresh) + size;
+                ++stats.heap_blocks;
+            }
+            
+            void release()
+            {
+                while (m_head != nullptr)
+                {
+                    block* next = m_head->next;
+                    ::operator delete(m_head);
+                    m_head = next;
+                }
+                m_cursor = m_end = nullptr;
+                m_capacity = 0;
+            }
+            
+            size_t in_use() const
+            {
+                // Earlier blocks are full, only the newest is partially used
+                return m_capacity - (m_head != nullptr ? m_head->size : 0) +
+                       static_cast<size_t>(m_cursor - reinterpret_cast<const char*>(m_head));
+            }
+            
+            void* do_allocate(size_t bytes, size_t alignment) override
+            {
+                uintptr_t aligned = (reinterpret_cast<uintptr_t>(m_cursor) + alignment - 1) & ~(uintptr_t(alignment) - 1);
+                if (m_head == nullptr || aligned + bytes > reinterpret_cast<uintptr_t>(m_end))
+                {
+                    // Double each time, so a long span needs few blocks
+                    size_t need = sizeof(block) + bytes + alignment;
+                    add_block(std::max(need, (m_head != nullptr) ? m_head->size * 2 : first_block_size));
+                    aligned = (reinterpret_cast<uintptr_t>(m_cursor) + alignment - 1) & ~(uintptr_t(alignment) - 1);
+                }
+                
+                m_cursor = reinterpret_cast<char*>(aligned + bytes);
+                stats.peak_bytes = std::max(stats.peak_bytes, in_use());
+                return reinterpret_cast<void*>(aligned);
+            }
+            
+            void do_deallocate(void*, size_t, size_t) override
+            {
+            }
+            
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+            {
+                return this == &other;
+            }
+    };
+    
+    scratch_arena& thread_arena()
+    {
+        thread_local scratch_arena arena;
+        return arena;
+    }
+}
+
+reg_api::scratch_scope::scratch_scope()
+{
+    ++thread_arena().depth;
+}
+
+reg_api::scratch_scope::~scratch_scope()
+{
+    scratch_arena& arena = thread_arena();
+    if (--arena.depth == 0)
+    {
+        arena.reset();
+    }
+}
+
+std::pmr::memory_resource* reg_api::scratch_scope::resource()
+{
+    return &thread_arena();
+}
+
+reg_api::scratch_stats reg_api::scratch_scope::get_stats()
+{
+    return thread_arena().stats;
+}
+
+void reg_api::set_memory_resource(std::pmr::memory_resource* resource)
+{
+    m_memory_resource = resource;
+}
+
+std::pmr::memory_resource* reg_api::get_memory_resource() const
+{
+    return m_memory_resource;
+}
+
+std::pmr::memory_resource* reg_api::scratch_resource() const
+{
+    return (m_memory_resource != nullptr) ? m_memory_resource : scratch_scope::resource();
+}
+
+
+
+bool reg_api::write_string(std::string_view value_name, const std::string& value)
+{
+    op_scope scope(op_kind::write_string, &m_syscall_count);
+    scope.bytes_in(value.size());
+    
+    // Include null terminator
+    return set_value(value_name, REG_SZ, value.c_str(), static_cast<DWORD>(value.length() + 1));
+}
+
+bool reg_api::set_value(std::string_view value_name, DWORD type, const void* data, DWORD data_size)
+{
+    if (!m_is_open)
+    {
+        return false;
+    }
+    
+    invalidate_cached(value_name);
+    
+    // A chunked object also owns a subkey, which goes when anything else
+    // replaces its manifest
+    if (may_be_chunked(value_name))
+    {
+        // The manifest is checked and replaced directly, after anything still queued for it
+        if (write_behind_enabled())
+        {
+            flush().wait();
+        }
+        
+        c_name name(value_name);
+        DWORD stored_type = REG_NONE;
+        DWORD stored_size = 0;
+        if (query_registry(m_h_key, name.c_str(), stored_type, stored_size) == ERROR_SUCCESS &&
+            stored_type == REG_BINARY && is_chunked(m_read_buf.data(), stored_size))
+        {
+            // Manifest first, so no reader finds one without its chunks
+            LONG result = set_registry(m_h_key, name.c_str(), type, data, data_size);
+            if (result == ERROR_SUCCESS)
+            {
+                ++m_syscall_count;
+                reg_delete_tree(m_h_key, chunk_key_path(value_name).c_str(), m_text_encoding == text_encoding::utf8);
+            }
+            return (result == ERROR_SUCCESS);
+        }
+    }
+    
+    if (write_behind_enabled())
+    {
+        queue_write(value_name, type, data, data_size);
+        return true;
+    }
+    
+    c_name name(value_name);
+    LONG result = set_registry(m_h_key, name.c_str(), type, data, data_size);
+    
+    return (result == ERROR_SUCCESS);
+}
+
+bool reg_api::value_exists(std::string_view value_name)
+{
+    op_scope scope(op_kind::value_exists, &m_syscall_count);
+    
+    if (!m_is_open)
+    {
+        return false;
+    }
+    
+    DWORD type = 0;
+    DWORD data_size = 0;
+    
+    // Answer from the cache when it is active
+    if (m_cache_enabled && m_watch_ok)
+    {
+        return (query_value(value_name, type, data_size) == ERROR_SUCCESS);
+    }
+    
+    c_name name(value_name);
+    ++m_syscall_count;
+    LONG result = reg_query(m_h_key, name.c_str(), &type, NULL, &data_size, m_text_encoding == text_encoding::utf8);
+    
+    return (result == ERROR_SUCCESS);
+}
+
+bool reg_api::delete_value(std::string_view value_name)
+{
+    op_scope scope(op_kind::delete_value, &m_syscall_count);
+    
+    if (!m_is_open)
+    {
+        return false;
+    }
+    
+    invalidate_cached(value_name);
+    
+    c_name name(value_name);
+    
+    // A chunked object also owns a subkey; only a manifest says it has one
+    if (may_be_chunked(value_name))
+    {
+        // The manifest is checked and deleted directly, after anything still queued for it
+        if (write_behind_enabled())
+        {
+            flush().wait();
+        }
+        
+        DWORD type = REG_NONE;
+        DWORD data_size = 0;
+        if (query_registry(m_h_key, name.c_str(), type, data_size) == ERROR_SUCCESS &&
+            type == REG_BINARY && is_chunked(m_read_buf.data(), data_size))
+        {
+            // Manifest first, so no reader finds one without its chunks
+            LONG result = delete_registry(m_h_key, name.c_str());
+            if (result == ERROR_SUCCESS)
+            {
+                ++m_syscall_count;
+                reg_delete_tree(m_h_key, chunk_key_path(value_name).c_str(), m_text_encoding == text_encoding::utf8);
+            }
+            return (result == ERROR_SUCCESS);
+        }
+    }
+    
+    if (write_behind_enabled())
+    {
+        queue_write(value_name, REG_NONE, nullptr, 0);
+        return true;
+    }
+    
+    LONG result = delete_registry(m_h_key, name.c_str());
+    
+    return (result == ERROR_SUCCESS);
+}
+
+
+void reg_api::enable_write_behind(bool enable)
+{
+    if (enable)
+    {
+        if (!m_write_behind)
+        {
+            m_write_behind.reset(new write_behind_queue());
+        }
+        m_write_behind->start();
+    }
+    else if (m_write_behind)
+    {
+        m_write_behind->stop();
+    }
+}
+
+bool reg_api::write_behind_enabled() const
+{
+    return m_write_behind && m_write_behind->running();
+}
+
+std::future<bool> reg_api::flush()
+{
+    std::promise<bool>* flushed = new std::promise<bool>();
+    std::future<bool> result = flushed->get_future();
+    
+    if (!write_behind_enabled())
+    {
+        // Writes are applied synchronously; nothing is pending
+        flushed->set_value(true);
+        delete flushed;
+        return result;
+    }
+    
+    write_behind_queue::node* marker = new write_behind_queue::node();
+    marker->flushed = flushed;
+    m_write_behind->push(marker);
+    return result;
+}
+
+reg_api::write_behind_stats reg_api::get_write_behind_stats() const
+{
+    write_behind_stats stats = {};
+    if (m_write_behind)
+    {
+        stats.queued = m_write_behind->queued;
+        stats.applied = m_write_behind->applied;
+        stats.coalesced = m_write_behind->coalesced;
+        stats.failed = m_write_behind->failed;
+        stats.depth = m_write_behind->depth;
+        stats.max_depth = m_write_behind->max_depth;
+    }
+    return stats;
+}
+
+void reg_api::queue_write(std::string_view value_name, DWORD type, const void* data, DWORD data_size)
+{
+    write_behind_queue::node* n = new write_behind_queue::node();
+    n->h_key = m_h_key;
+    n->name.assign(value_name);
+    n->is_delete = (data == nullptr);
+    n->type = type;
+    n->wide = (m_text_encoding == text_encoding::utf8);
+    if (data != nullptr)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        n->data.assign(bytes, bytes + data_size);
+    }
+    m_write_behind->push(n);
+}
+
+void reg_api::set_async_scheduler(async_scheduler scheduler)
+{
+    if (!m_async)
+    {
+        m_async = std::make_shared<async_strand>();
+    }
+    
+    std::lock_guard<std::mutex> lock(m_async->mutex);
+    m_async->scheduler = std::move(scheduler);
+}
+
+reg_api::async_stats reg_api::get_async_stats() const
+{
+    async_stats stats = {};
+    if (m_async)
+    {
+        stats.operations = m_async->operations;
+        stats.drains = m_async->drains;
+        stats.reads = m_async->reads;
+        stats.largest_drain = m_async->largest_drain;
+    }
+    return stats;
+}
+
+void reg_api::submit_async(async_request& request)
+{
+    if (!m_async)
+    {
+        m_async = std::make_shared<async_strand>();
+    }
+    
+    bool start = false;
+    {
+        std::lock_guard<std::mutex> lock(m_async->mutex);
+        m_async->pending.push_back(&request);
+        start = !m_async->scheduled;
+        m_async->scheduled = true;
+    }
+    
+    // Operations queued while a drain runs join its next pass
+    if (start)
+    {
+        std::shared_ptr<async_strand> strand = m_async;
+        async_pool().post([this, strand]() { drain_async(); });
+    }
+}
+
+void reg_api::drain_async()
+{
+    // The instance may be gone once scheduled is cleared; the mutex must not be
+    std::shared_ptr<async_strand> strand = m_async;
+    
+    std::vector<async_request*> requests;
+    for (;;)
+    {
+        async_scheduler scheduler;
+        {
+            std::lock_guard<std::mutex> lock(strand->mutex);
+            requests.clear();
+            requests.swap(strand->pending);
+            if (requests.empty())
+            {
+                strand->scheduled = false;
+                strand->idle.notify_all();
+                return;
+            }
+            scheduler = strand->scheduler;
+        }
+        
+        ++strand->drains;
+        strand->operations += requests.size();
+        size_t largest = strand->largest_drain.load(std::memory_order_relaxed);
+        while (requests.size() > largest && !strand->largest_drain.compare_exchange_weak(largest, requests.size()))
+        {
+        }
+        
+        run_async(requests);
+        
+        // A resumed coroutine may end and free its request, or queue another
+        for (async_request* request : requests)
+        {
+            void (*resume)(void*) = request->resume;
+            void* address = request->address;
+            if (scheduler)
+            {
+                scheduler([resume, address]() { resume(address); });
+            }
+            else
+            {
+                resume(address);
+            }
+        }
+    }
+}
+
+void reg_api::run_async(const std::vector<async_request*>& requests)
+{
+    size_t first = 0;
+    while (first < requests.size())
+    {
+        // Serve runs of reads or writes together, keeping their order
+        async_request::kind op = requests[first]->op;
+        size_t last = first + 1;
+        while (op != async_request::kind::call && last < requests.size() && requests[last]->op == op)
+        {
+            ++last;
+        }
+        
+        if (op == async_request::kind::read)
+        {
+            // One query for the distinct names; the cache serves what it holds
+            std::vector<const char*> names;
+            for (size_t i = first; i < last; ++i)
+            {
+                const char* name = requests[i]->name.c_str();
+                bool seen = std::any_of(names.begin(), names.end(), [name](const char* other)
+                {
+                    return strcmp(name, other) == 0;
+                });
+                if (!seen)
+                {
+                    names.push_back(name);
+                }
+            }
+            
+            unsigned long long calls = m_syscall_count;
+            std::shared_ptr<const snapshot> values = std::make_shared<snapshot>(
+                m_cache_enabled ? load_each(names.data(), names.size()) : load_names(names.data(), names.size()));
+            m_async->reads += m_syscall_count - calls;
+            
+            for (size_t i = first; i < last; ++i)
+            {
+                requests[i]->values = values;
+            }
+        }
+        else if (op == async_request::kind::write)
+        {
+            batch pending = begin_batch();
+            for (size_t i = first; i < last; ++i)
+            {
+                const async_request& request = *requests[i];
+                pending.add(request.name, request.is_delete, request.type, request.data.data(),
+                            static_cast<DWORD>(request.data.size()));
+            }
+            
+            bool ok = pending.commit();
+            for (size_t i = first; i < last; ++i)
+            {
+                requests[i]->ok = ok;
+            }
+        }
+        else
+        {
+            requests[first]->ok = requests[first]->invoke();
+        }
+        
+        first = last;
+    }
+}
+
+namespace
+{
+    // Decode table for the Base64 alphabet; 0xFF marks characters outside it
+    struct b64_decode_table
+    {
+        unsigned char value[256];
+
+        constexpr b64_decode_table()
+            : value()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                value[i] = 0xFF;
+            }
+            for (int i = 0; i < 26; ++i)
+            {
+                value['A' + i] = static_cast<unsigned char>(i);
+                value['a' + i] = static_cast<unsigned char>(26 + i);
+            }
+            for (int i = 0; i < 10; ++i)
+            {
+                value['0' + i] = static_cast<unsigned char>(52 + i);
+            }
+            value['+'] = 62;
+            value['/'] = 63;
+        }
+    };
+
+    constexpr b64_decode_table b64_table;
+
+    const char b64_alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        "abcdefghijklmnopqrstuvwxyz"
+        "0123456789+/";
+
+    // Scalar encoder; handles any length including the padded tail
+    size_t b64_encode_scalar(const unsigned char* in, size_t in_size, char* out)
+    {
+        char* start = out;
+        size_t i = 0;
+        for (; i + 3 <= in_size; i += 3)
+        {
+            uint32_t triple = (uint32_t(in[i]) << 16) | (uint32_t(in[i + 1]) << 8) | in[i + 2];
+            *out++ = b64_alphabet[(triple >> 18) & 0x3F];
+            *out++ = b64_alphabet[(triple >> 12) & 0x3F];
+            *out++ = b64_alphabet[(triple >> 6) & 0x3F];
+            *out++ = b64_alphabet[triple & 0x3F];
+        }
+
+        size_t rest = in_size - i;
+        if (rest > 0)
+        {
+            uint32_t triple = uint32_t(in[i]) << 16;
+            if (rest > 1)
+            {
+                triple |= uint32_t(in[i + 1]) << 8;
+            }
+            *out++ = b64_alphabet[(triple >> 18) & 0x3F];
+            *out++ = b64_alphabet[(triple >> 12) & 0x3F];
+            *out++ = (rest > 1) ? b64_alphabet[(triple >> 6) & 0x3F] : '=';
+            *out++ = '=';
+        }
+
+        return static_cast<size_t>(out - start);
+    }
+
+    // Scalar decoder; stops at the first character outside the alphabet
+    // (padding included), like the original implementation
+    size_t b64_decode_scalar(const unsigned char* in, size_t in_size, char* out)
+    {
+        char* start = out;
+        size_t i = 0;
+        for (; i + 4 <= in_size; i += 4)
+        {
+            unsigned char a = b64_table.value[in[i]];
+            unsigned char b = b64_table.value[in[i + 1]];
+            unsigned char c = b64_table.value[in[i + 2]];
+            unsigned char d = b64_table.value[in[i + 3]];
+            if ((a | b | c | d) & 0x80)
+            {
+                break;
+            }
+
+            uint32_t triple = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+            *out++ = static_cast<char>(triple >> 16);
+            *out++ = static_cast<char>(triple >> 8);
+            *out++ = static_cast<char>(triple);
+        }
+
+        // Partial group: 2 characters give one byte, 3 give two
+        unsigned char group[4];
+        size_t count = 0;
+        for (; i < in_size && count < 4; ++i)
+        {
+            unsigned char v = b64_table.value[in[i]];
+            if (v == 0xFF)
+            {
+                break;
+            }
+            group[count++] = v;
+        }
+
+        if (count >= 2)
+        {
+            *out++ = static_cast<char>((group[0] << 2) | (group[1] >> 4));
+        }
+        if (count >= 3)
+        {
+            *out++ = static_cast<char>((group[1] << 4) | (group[2] >> 2));
+        }
+
+        return static_cast<size_t>(out - start);
+    }
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define REG_API_X86_SIMD 1
+
+#if defined(__GNUC__) || defined(__clang__)
+#define REG_API_TARGET(isa) __attribute__((target(isa)))
+#else
+#define REG_API_TARGET(isa)
+#endif
+
+    // Map 6-bit indices to the alphabet (Mula's pshufb range lookup)
+    REG_API_TARGET("ssse3")
+    inline __m128i b64_lookup_ssse3(__m128i indices)
+    {
+        const __m128i shift_lut = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+        __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+        result = _mm_shuffle_epi8(shift_lut, result);
+        return _mm_add_epi8(result, indices);
+    }
+
+    // Spread 12 input bytes into 16 6-bit indices, one per byte
+    REG_API_TARGET("ssse3")
+    inline __m128i b64_split_ssse3(__m128i in)
+    {
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t1, t3);
+    }
+
+    // Translate 16 characters to 6-bit values; false if any is outside the alphabet
+    REG_API_TARGET("ssse3")
+    inline bool b64_translate_ssse3(__m128i chars, __m128i& values)
+    {
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('Z' + 1)));
+        const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('z' + 1)));
+        const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+        const __m128i plus = _mm_cmpeq_epi8(chars, _mm_set1_epi8('+'));
+        const __m128i slash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+
+        const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+        if (_mm_movemask_epi8(valid) != 0xFFFF)
+        {
+            return false;
+        }
+
+        __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-65));
+        shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+        shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+        shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(19)));
+        shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(16)));
+        values = _mm_add_epi8(chars, shift);
+        return true;
+    }
+
+    // Pack 16 6-bit values into 12 bytes at the bottom of the register
+    REG_API_TARGET("ssse3")
+    inline __m128i b64_pack_ssse3(__m128i values)
+    {
+        const __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        const __m128i joined = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        return _mm_shuffle_epi8(joined, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+
+    REG_API_TARGET("ssse3")
+    size_t b64_encode_ssse3(const unsigned char* in, size_t in_size, char* out)
+    {
+        size_t i = 0;
+        char* o = out;
+
+        // Each step reads 16 bytes and consumes 12
+        for (; i + 16 <= in_size; i += 12, o += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(o), b64_lookup_ssse3(b64_split_ssse3(block)));
+        }
+
+        return static_cast<size_t>(o - out) + b64_encode_scalar(in + i, in_size - i, o);
+    }
+
+    REG_API_TARGET("ssse3")
+    size_t b64_decode_ssse3(const unsigned char* in, size_t in_size, char* out)
+    {
+        size_t i = 0;
+        char* o = out;
+
+        // Each step writes 16 bytes and keeps 12; the remaining input
+        // guarantees the caller's buffer has room for the spare 4
+        for (; i + 24 <= in_size; i += 16, o += 12)
+        {
+            __m128i values;
+            if (!b64_translate_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), values))
+            {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(o), b64_pack_ssse3(values));
+        }
+
+        return static_cast<size_t>(o - out) + b64_decode_scalar(in + i, in_size - i, o);
+    }
+
+    REG_API_TARGET("avx2")
+    size_t b64_encode_avx2(const unsigned char* in, size_t in_size, char* out)
+    {
+        size_t i = 0;
+        char* o = out;
+
+        const __m256i shuffle = _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        const __m256i shift_lut = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+        // Each step reads 12 bytes into each lane (28 bytes in total) and consumes 24
+        for (; i + 28 <= in_size; i += 24, o += 32)
+        {
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+            __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+            block = _mm256_shuffle_epi8(block, shuffle);
+            const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+            const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+            const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            const __m256i indices = _mm256_or_si256(t1, t3);
+
+            __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+            result = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), indices);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(o), result);
+        }
+
+        return static_cast<size_t>(o - out) + b64_encode_ssse3(in + i, in_size - i, o);
+    }
+
+    REG_API_TARGET("avx2")
+    size_t b64_decode_avx2(const unsigned char* in, size_t in_size, char* out)
+    {
+        size_t i = 0;
+        char* o = out;
+
+        const __m256i pack_shuffle = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const __m256i pack_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+        // Each step writes 32 bytes and keeps 24; see b64_decode_ssse3
+        for (; i + 48 <= in_size; i += 32, o += 24)
+        {
+            const __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+            const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), chars));
+            const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), chars));
+            const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+            const __m256i plus = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('+'));
+            const __m256i slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+
+            const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+            if (_mm256_movemask_epi8(valid) != -1)
+            {
+                break;
+            }
+
+            __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-65));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(19)));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(16)));
+            const __m256i values = _mm256_add_epi8(chars, shift);
+
+            const __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            const __m256i joined = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+            const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(joined, pack_shuffle), pack_lanes);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(o), packed);
+        }
+
+        return static_cast<size_t>(o - out) + b64_decode_ssse3(in + i, in_size - i, o);
+    }
+
+    // CPU feature probe for the dispatch below
+    struct cpu_features
+    {
+        bool ssse3;
+        bool sse42;
+        bool avx2;
+
+        cpu_features()
+            : ssse3(false)
+            , sse42(false)
+            , avx2(false)
+        {
+#if defined(_MSC_VER)
+            int regs[4];
+            __cpuid(regs, 0);
+            int max_leaf = regs[0];
+
+            __cpuid(regs, 1);
+            ssse3 = (regs[2] & (1 << 9)) != 0;
+            sse42 = (regs[2] & (1 << 20)) != 0;
+            bool osxsave = (regs[2] & (1 << 27)) != 0;
+
+            // AVX2 also needs the OS to preserve the YMM state
+            if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+            {
+                __cpuidex(regs, 7, 0);
+                avx2 = (regs[1] & (1 << 5)) != 0;
+            }
+#else
+            __builtin_cpu_init();
+            ssse3 = __builtin_cpu_supports("ssse3") != 0;
+            sse42 = __builtin_cpu_supports("sse4.2") != 0;
+            avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+        }
+    };
+#endif
+
+    typedef size_t (*b64_codec_fn)(const unsigned char* in, size_t in_size, char* out);
+
+    // Pick the widest encoder the CPU supports, once
+    b64_codec_fn b64_encoder()
+    {
+#if defined(REG_API_X86_SIMD)
+        static const cpu_features features;
+        static const b64_codec_fn encoder =
+            features.avx2 ? b64_encode_avx2 : (features.ssse3 ? b64_encode_ssse3 : b64_encode_scalar);
+        return encoder;
+#else
+        return b64_encode_scalar;
+#endif
+    }
+
+    // Pick the widest decoder the CPU supports, once
+    b64_codec_fn b64_decoder()
+    {
+#if defined(REG_API_X86_SIMD)
+        static const cpu_features features;
+        static const b64_codec_fn decoder =
+            features.avx2 ? b64_decode_avx2 : (features.ssse3 ? b64_decode_ssse3 : b64_decode_scalar);
+        return decoder;
+#else
+        return b64_decode_scalar;
+#endif
+    }
+}
+
+namespace
+{
+    // CRC-32C (Castagnoli), reflected, table for the portable path
+    struct crc32c_table
+    {
+        uint32_t entries[256];
+
+        crc32c_table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0u);
+                }
+                entries[i] = crc;
+            }
+        }
+    };
+
+    uint32_t crc32c_scalar(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        static const crc32c_table table;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    // Multiply a CRC register by a 32x32 GF(2) matrix
+    uint32_t gf2_times(const uint32_t* matrix, uint32_t vector)
+    {
+        uint32_t sum = 0;
+        for (; vector != 0; vector >>= 1, ++matrix)
+        {
+            if (vector & 1)
+            {
+                sum ^= *matrix;
+            }
+        }
+        return sum;
+    }
+    
+    void gf2_square(uint32_t* square, const uint32_t* matrix)
+    {
+        for (int n = 0; n < 32; ++n)
+        {
+            square[n] = gf2_times(matrix, matrix[n]);
+        }
+    }
+    
+    // The register crc32c_scalar() would hold after zero_bytes more zero
+    // bytes, in O(log n) matrix squarings (zlib's crc32_combine method)
+    uint32_t crc32c_zeros(uint32_t crc, size_t zero_bytes)
+    {
+        uint32_t odd[32];
+        uint32_t even[32];
+        
+        // Operator for one zero bit, then for two and four
+        odd[0] = 0x82F63B78u;
+        for (int n = 1; n < 32; ++n)
+        {
+            odd[n] = 1u << (n - 1);
+        }
+        gf2_square(even, odd);
+        gf2_square(odd, even);
+        
+        while (zero_bytes != 0)
+        {
+            gf2_square(even, odd);
+            if (zero_bytes & 1)
+            {
+                crc = gf2_times(even, crc);
+            }
+            zero_bytes >>= 1;
+            if (zero_bytes == 0)
+            {
+                break;
+            }
+            
+            gf2_square(odd, even);
+            if (zero_bytes & 1)
+            {
+                crc = gf2_times(odd, crc);
+            }
+            zero_bytes >>= 1;
+        }
+        return crc;
+    }
+
+#if defined(REG_API_X86_SIMD)
+    // The SSE4.2 crc32 instruction computes the same polynomial
+    REG_API_TARGET("sse4.2")
+    uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        size_t i = 0;
+#if defined(_M_X64) || defined(__x86_64__)
+        uint64_t crc64 = crc;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = static_cast<uint32_t>(crc64);
+#endif
+        for (; i < size; ++i)
+        {
+            crc = _mm_crc32_u8(crc, data[i]);
+        }
+        return crc;
+    }
+#endif
+
+    // Object frames written by write_obj in obj_format::framed
+    const uint32_t obj_frame_magic = 0x4A424F52;   // "ROBJ"
+    const uint16_t obj_frame_version = 1;
+    const uint16_t obj_frame_compressed = 0x0001;  // Payload is XPRESS compressed
+
+    struct obj_frame_header
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t flags;
+        uint32_t type_id;       // reg_api::obj_type_id<T>()
+        uint32_t size;          // sizeof(T)
+        uint32_t payload_size;  // Bytes following the header
+        uint32_t crc;           // CRC-32C of the object bytes
+    };
+
+    // XPRESS without the API's own block header; the frame stores the size
+    const DWORD obj_compression_algorithm = COMPRESS_ALGORITHM_XPRESS | COMPRESS_RAW;
+
+    // Compression handles are reusable but not thread-safe: one pair per thread
+    struct obj_codec
+    {
+        COMPRESSOR_HANDLE compressor = NULL;
+        DECOMPRESSOR_HANDLE decompressor = NULL;
+
+        ~obj_codec()
+        {
+            if (compressor != NULL)
+            {
+                CloseCompressor(compressor);
+            }
+            if (decompressor != NULL)
+            {
+                CloseDecompressor(decompressor);
+            }
+        }
+    };
+
+    obj_codec& thread_obj_codec()
+    {
+        thread_local obj_codec codec;
+        return codec;
+    }
+
+    // Compressed size, or 0 if it does not fit in out_capacity
+    size_t obj_compress(const void* in, size_t in_size, void* out, size_t out_capacity)
+    {
+        obj_codec& codec = thread_obj_codec();
+        if (codec.compressor == NULL && !CreateCompressor(obj_compression_algorithm, NULL, &codec.compressor))
+        {
+            codec.compressor = NULL;
+            return 0;
+        }
+
+        SIZE_T written = 0;
+        if (!Compress(codec.compressor, in, in_size, out, out_capacity, &written))
+        {
+            return 0;
+        }
+        return written;
+    }
+
+    bool obj_decompress(const void* in, size_t in_size, void* out, size_t out_size)
+    {
+        obj_codec& codec = thread_obj_codec();
+        if (codec.decompressor == NULL && !CreateDecompressor(obj_compression_algorithm, NULL, &codec.decompressor))
+        {
+            codec.decompressor = NULL;
+            return false;
+        }
+
+        SIZE_T written = 0;
+        return Decompress(codec.decompressor, in, in_size, out, out_size, &written) && written == out_size;
+    }
+}
+
+uint32_t reg_api::crc32c(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+#if defined(REG_API_X86_SIMD)
+    static const cpu_features features;
+    if (features.sse42)
+    {
+        return ~crc32c_sse42(0xFFFFFFFFu, bytes, size);
+    }
+#endif
+    return ~crc32c_scalar(0xFFFFFFFFu, bytes, size);
+}
+
+uint32_t reg_api::obj_type_hash(const char* tag, size_t size, size_t align, unsigned version)
+{
+    // The tag, then the layout facts; nothing compiler-specific goes in
+    uint32_t hash = hash_bytes(2166136261u, tag, strlen(tag));
+    const uint64_t facts[3] = { size, align, version };
+    return hash_bytes(hash, facts, sizeof(facts));
+}
+
+uint32_t reg_api::hash_bytes(uint32_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+DWORD reg_api::encode_framed(const void* obj, size_t obj_size, uint32_t type_id)
+{
+    obj_frame_header header;
+    header.magic = obj_frame_magic;
+    header.version = obj_frame_version;
+    header.flags = 0;
+    header.type_id = type_id;
+    header.size = static_cast<uint32_t>(obj_size);
+    header.crc = crc32c(obj, obj_size);
+    
+    if (m_frame_buf.size() < sizeof(header) + obj_size)
+    {
+        m_frame_buf.resize(sizeof(header) + obj_size);
+    }
+    char* payload = m_frame_buf.data() + sizeof(header);
+    
+    // Keep the compressed form only when it is actually smaller
+    size_t payload_size = 0;
+    if (m_obj_compression != 0 && obj_size >= m_obj_compression)
+    {
+        payload_size = obj_compress(obj, obj_size, payload, obj_size - 1);
+    }
+    
+    if (payload_size != 0)
+    {
+        header.flags |= obj_frame_compressed;
+    }
+    else
+    {
+        memcpy(payload, obj, obj_size);
+        payload_size = obj_size;
+    }
+    
+    header.payload_size = static_cast<uint32_t>(payload_size);
+    memcpy(m_frame_buf.data(), &header, sizeof(header));
+    return static_cast<DWORD>(sizeof(header) + payload_size);
+}
+
+bool reg_api::is_framed(const char* data, DWORD data_size)
+{
+    if (data_size < sizeof(obj_frame_header))
+    {
+        return false;
+    }
+    
+    obj_frame_header header;
+    memcpy(&header, data, sizeof(header));
+    return header.magic == obj_frame_magic && header.payload_size == data_size - sizeof(header);
+}
+
+const char* reg_api::decode_framed(const char* data, DWORD data_size, uint32_t type_id, void* out, size_t out_size)
+{
+    obj_frame_header header;
+    memcpy(&header, data, sizeof(header));
+    const char* payload = data + sizeof(header);
+    
+    if (sizeof(header) + static_cast<size_t>(header.payload_size) > data_size)
+    {
+        return "Corrupt object data for key: ";
+    }
+    if (header.version != obj_frame_version)
+    {
+        return "Unsupported object format for key: ";
+    }
+    if (header.type_id != type_id)
+    {
+        return "Object type mismatch for key: ";
+    }
+    if (header.size != out_size)
+    {
+        return "Data size mismatch for key: ";
+    }
+    
+    if (header.flags & obj_frame_compressed)
+    {
+        if (!obj_decompress(payload, header.payload_size, out, out_size))
+        {
+            return "Corrupt object data for key: ";
+        }
+    }
+    else
+    {
+        if (header.payload_size != out_size)
+        {
+            return "Corrupt object data for key: ";
+        }
+        memcpy(out, payload, out_size);
+    }
+    
+    if (crc32c(out, out_size) != header.crc)
+    {
+        return "Checksum mismatch for key: ";
+    }
+    
+    return nullptr;
+}
+
+const char* reg_api::decode_b64_into(const char* data, DWORD data_size, void* out, size_t out_size)
+{
+    size_t encoded_size = strnlen(data, data_size);
+    if (encoded_size == 0)
+    {
+        return "Key not found in registry: ";
+    }
+    
+    // Decode all but the last group in place; only the last group (which
+    // may carry padding) goes through a 3-byte scratch buffer
+    size_t body_size = (encoded_size - 1) / 4 * 4;
+    size_t body_bytes = body_size / 4 * 3;
+    if (body_bytes > out_size)
+    {
+        return "Data size mismatch for key: ";
+    }
+    
+    char* dest = static_cast<char*>(out);
+    size_t written = b64_d(data, body_size, dest);
+    
+    // Decoding stops at the first character outside the alphabet
+    if (written == body_bytes)
+    {
+        char tail[3];
+        size_t tail_written = b64_d(data + body_size, encoded_size - body_size, tail);
+        if (written + tail_written <= out_size)
+        {
+            memcpy(dest + written, tail, tail_written);
+        }
+        written += tail_written;
+    }
+    
+    if (written != out_size)
+    {
+        return "Data size mismatch for key: ";
+    }
+    return nullptr;
+}
+
+void reg_api::set_obj_format(obj_format format)
+{
+    m_obj_format = format;
+}
+
+reg_api::obj_format reg_api::get_obj_format() const
+{
+    return m_obj_format;
+}
+
+void reg_api::set_obj_compression(size_t threshold)
+{
+    m_obj_compression = threshold;
+}
+
+size_t reg_api::get_obj_compression() const
+{
+    return m_obj_compression;
+}
+
+namespace
+{
+    // Manifest stored under the value name of a chunked object; chunk i is
+    // the value "i" of the chunk subkey
+    const uint32_t chunk_manifest_magic = 0x4B484352;   // "RCHK"
+    const uint16_t chunk_manifest_version = 1;
+
+    struct chunk_manifest
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t flags;         // Reserved, 0
+        uint32_t type_id;       // reg_api::obj_type_id<T>()
+        uint32_t chunk_size;    // Bytes per chunk; the last one may be shorter
+        uint32_t chunk_count;
+        uint32_t crc;           // CRC-32C of the whole object
+        uint64_t size;          // sizeof(T)
+    };
+
+    // Most readers a single object read spreads its chunks over
+    const size_t max_chunk_readers = 8;
+
+    // Value name of chunk index, null terminated
+    void chunk_value_name(uint32_t index, char (&name)[16])
+    {
+        *std::to_chars(name, name + sizeof(name) - 1, index).ptr = '\0';
+    }
+    
+    // Unpack the manifest in data and check it describes an object of
+    // type_id and obj_size bytes; returns null or the error prefix
+    const char* check_manifest(const char* data, DWORD data_size, uint32_t type_id, size_t obj_size,
+                               chunk_manifest& manifest)
+    {
+        memcpy(&manifest, data, std::min<size_t>(data_size, sizeof(manifest)));
+        
+        if (manifest.version != chunk_manifest_version)
+        {
+            return "Unsupported object format for key: ";
+        }
+        if (manifest.type_id != type_id)
+        {
+            return "Object type mismatch for key: ";
+        }
+        if (manifest.size != obj_size)
+        {
+            return "Data size mismatch for key: ";
+        }
+        if (manifest.chunk_size == 0 ||
+            manifest.chunk_count != (obj_size + manifest.chunk_size - 1) / manifest.chunk_size)
+        {
+            return "Corrupt object data for key: ";
+        }
+        return nullptr;
+    }
+}
+
+std::string reg_api::chunk_key_path(std::string_view value_name)
+{
+    return ".reg_api_chunks\\" + std::string(value_name);
+}
+
+void reg_api::set_obj_chunking(size_t threshold, size_t chunk_size)
+{
+    m_chunk_threshold = threshold;
+    m_chunk_size = (chunk_size == 0) ? default_chunk_size : chunk_size;
+}
+
+size_t reg_api::get_obj_chunking() const
+{
+    return m_chunk_threshold;
+}
+
+bool reg_api::is_chunked(const char* data, DWORD data_size)
+{
+    if (data_size != sizeof(chunk_manifest))
+    {
+        return false;
+    }
+    
+    uint32_t magic;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == chunk_manifest_magic;
+}
+
+bool reg_api::chunks_obj(std::string_view value_name, size_t obj_size) const
+{
+    // Key names cannot contain backslashes
+    return m_chunk_threshold != 0 && obj_size >= m_chunk_threshold &&
+           !value_name.empty() && value_name.find('\\') == std::string_view::npos;
+}
+
+bool reg_api::write_chunked(std::string_view value_name, const void* obj, size_t obj_size, uint32_t type_id)
 {
+    if (!m_is_open || obj_size / m_chunk_size >= 0xFFFFFFFFu)
+    {
+        return false;
+    }
+    
+    // The manifest is written directly, after anything still queued for it
+    if (write_behind_enabled())
+    {
+        flush().wait();
+    }
+    
+    c_name name(value_name);
+    
+    // Chunks of a previous, larger object are dropped afterwards
+    uint32_t old_count = 0;
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (query_registry(m_h_key, name.c_str(), type, data_size) == ERROR_SUCCESS &&
+        type == REG_BINARY && is_chunked(m_read_buf.data(), data_size))
+    {
+        chunk_manifest old;
+        memcpy(&old, m_read_buf.data(), sizeof(old));
+        old_count = old.chunk_count;
+    }
+    
+    HKEY h_chunks = NULL;
+    std::string chunk_path = chunk_key_path(value_name);
+    if (open_or_create(m_h_key, chunk_path.c_str(), KEY_READ | KEY_WRITE, h_chunks, m_syscall_count, m_text_encoding) != ERROR_SUCCESS)
+    {
+        return false;
+    }
+    m_chunk_key = chunk_key_state::present;
+    
+    chunk_manifest manifest;
+    manifest.magic = chunk_manifest_magic;
+    manifest.version = chunk_manifest_version;
+    manifest.flags = 0;
+    manifest.type_id = type_id;
+    manifest.chunk_size = static_cast<uint32_t>(m_chunk_size);
+    manifest.chunk_count = static_cast<uint32_t>((obj_size + m_chunk_size - 1) / m_chunk_size);
+    manifest.crc = crc32c(obj, obj_size);
+    manifest.size = obj_size;
+    
+    // Stream each chunk from the object itself
+    bool ok = true;
+    const char* bytes = static_cast<const char*>(obj);
+    char chunk_name[16];
+    for (uint32_t i = 0; ok && i < manifest.chunk_count; ++i)
+    {
+        size_t offset = static_cast<size_t>(i) * m_chunk_size;
+        size_t length = std::min(m_chunk_size, obj_size - offset);
+        chunk_value_name(i, chunk_name);
+        ok = set_registry(h_chunks, chunk_name, REG_BINARY, bytes + offset, static_cast<DWORD>(length)) == ERROR_SUCCESS;
+    }
+    
+    // The manifest goes last so it never describes chunks not yet written
+    if (ok)
+    {
+        invalidate_cached(value_name);
+        ok = set_registry(m_h_key, name.c_str(), REG_BINARY, &manifest, sizeof(manifest)) == ERROR_SUCCESS;
+    }
+    
+    for (uint32_t i = manifest.chunk_count; ok && i < old_count; ++i)
+    {
+        chunk_value_name(i, chunk_name);
+        delete_registry(h_chunks, chunk_name);
+    }
+    
+    ++m_syscall_count;
+    reg_close(h_chunks);
+    return ok;
 }
 
-reg_api::~reg_api()
+bool reg_api::may_be_chunked(std::string_view value_name)
 {
-    close();
+    if (value_name.empty() || value_name.find('\\') != std::string_view::npos)
+    {
+        return false;
+    }
+    
+    // Keys without chunked objects, most of them, cost one probe
+    if (m_chunk_key == chunk_key_state::unknown)
+    {
+        HKEY h_chunks = NULL;
+        std::string chunk_root = chunk_key_path("");
+        chunk_root.pop_back();
+        ++m_syscall_count;
+        bool found = reg_open(m_h_key, chunk_root.c_str(), KEY_QUERY_VALUE, h_chunks,
+                              m_text_encoding == text_encoding::utf8) == ERROR_SUCCESS;
+        if (found)
+        {
+            reg_close(h_chunks);
+        }
+        m_chunk_key = found ? chunk_key_state::present : chunk_key_state::absent;
+    }
+    return m_chunk_key == chunk_key_state::present;
 }
 
-bool reg_api::chroot(const std::string& key_path)
+const char* reg_api::read_chunked(std::string_view value_name, DWORD data_size, uint32_t type_id, void* out, size_t out_size)
 {
-    // Close any previously opened key
-    close();
+    chunk_manifest manifest;
+    const char* error = check_manifest(m_read_buf.data(), data_size, type_id, out_size, manifest);
+    if (error != nullptr)
+    {
+        return error;
+    }
     
-    // Try to open the registry key
-    LONG result = RegOpenKeyExA(
-        m_h_root_key,
-        key_path.c_str(),
-        0,
-        KEY_READ | KEY_WRITE,
-        &m_h_key
-    );
+    HKEY h_chunks = NULL;
+    std::string chunk_path = chunk_key_path(value_name);
+    ++m_syscall_count;
+    bool wide = (m_text_encoding == text_encoding::utf8);
+    if (reg_open(m_h_key, chunk_path.c_str(), KEY_QUERY_VALUE, h_chunks, wide) != ERROR_SUCCESS)
+    {
+        return "Missing object chunks for key: ";
+    }
     
-    // If key doesn't exist, try to create it
-    if (result != ERROR_SUCCESS)
+    // Readers claim chunk indexes from a shared counter and query each
+    // chunk straight into its place in out
+    char* dest = static_cast<char*>(out);
+    std::atomic<uint32_t> next(0);
+    std::atomic<bool> ok(true);
+    std::atomic<unsigned long long> calls(0);
+    
+    auto reader = [&]()
     {
-        result = RegCreateKeyExA(
-            m_h_root_key,
-            key_path.c_str(),
-            0,
-            NULL,
-            REG_OPTION_NON_VOLATILE,
-            KEY_READ | KEY_WRITE,
-            NULL,
-            &m_h_key,
-            NULL
-        );
+        char chunk_name[16];
+        for (;;)
+        {
+            uint32_t i = next.fetch_add(1);
+            if (i >= manifest.chunk_count || !ok.load(std::memory_order_relaxed))
+            {
+                break;
+            }
+            
+            size_t offset = static_cast<size_t>(i) * manifest.chunk_size;
+            DWORD expected = static_cast<DWORD>(std::min<size_t>(manifest.chunk_size, out_size - offset));
+            DWORD chunk_size = expected;
+            DWORD type = REG_NONE;
+            chunk_value_name(i, chunk_name);
+            
+            calls.fetch_add(1, std::memory_order_relaxed);
+            LONG result = reg_query(h_chunks, chunk_name, &type, dest + offset, &chunk_size, wide);
+            
+            if (result != ERROR_SUCCESS || type != REG_BINARY || chunk_size != expected)
+            {
+                ok = false;
+            }
+        }
+    };
+    
+    size_t reader_count = std::min<size_t>(manifest.chunk_count, max_chunk_readers);
+    reader_count = std::min<size_t>(reader_count, std::max(1u, std::thread::hardware_concurrency()));
+    
+    std::vector<std::thread> readers;
+    for (size_t r = 1; r < reader_count; ++r)
+    {
+        readers.emplace_back(reader);
+    }
+    reader();
+    for (std::thread& thread : readers)
+    {
+        thread.join();
     }
     
-    m_is_open = (result == ERROR_SUCCESS);
-    return m_is_open;
+    m_syscall_count += calls.load();
+    ++m_syscall_count;
+    reg_close(h_chunks);
+    
+    if (!ok)
+    {
+        return "Missing object chunks for key: ";
+    }
+    if (crc32c(out, out_size) != manifest.crc)
+    {
+        return "Checksum mismatch for key: ";
+    }
+    return nullptr;
 }
 
-void reg_api::close()
+namespace
 {
-    if (m_is_open && m_h_key != NULL)
+    // Query chunks first..last of an object back to back into region
+    bool read_chunk_span(HKEY h_chunks, const chunk_manifest& manifest, uint32_t first, uint32_t last,
+                         std::pmr::vector<char>& region, unsigned long long& calls, bool wide)
     {
-        RegCloseKey(m_h_key);
-        m_h_key = NULL;
-        m_is_open = false;
+        size_t start = static_cast<size_t>(first) * manifest.chunk_size;
+        size_t end = std::min<size_t>(static_cast<size_t>(last + 1) * manifest.chunk_size, manifest.size);
+        region.resize(end - start);
+        
+        char chunk_name[16];
+        for (uint32_t i = first; i <= last; ++i)
+        {
+            size_t offset = static_cast<size_t>(i) * manifest.chunk_size;
+            DWORD expected = static_cast<DWORD>(std::min<size_t>(manifest.chunk_size, manifest.size - offset));
+            DWORD chunk_size = expected;
+            DWORD type = REG_NONE;
+            chunk_value_name(i, chunk_name);
+            
+            ++calls;
+            LONG result = reg_query(h_chunks, chunk_name, &type, region.data() + (offset - start), &chunk_size, wide);
+            if (result != ERROR_SUCCESS || type != REG_BINARY || chunk_size != expected)
+            {
+                return false;
+            }
+        }
+        return true;
     }
 }
 
-std::string reg_api::read_string(const std::string& value_name, const std::string& default_value)
+const char* reg_api::read_obj_bytes(std::string_view key, uint32_t type_id, void* out, size_t obj_size)
 {
-    if (!m_is_open || !value_exists(value_name))
+    if (!m_is_open)
     {
-        return default_value;
+        return "Key not found in registry: ";
     }
     
-    DWORD type = REG_SZ;
-    DWORD data_size = 0;
+    // A raw object fits out exactly, so query it straight there; other
+    // encodings do not fit and are decoded from the read buffer. The cache,
+    // when active, answers instead.
+    if (!m_cache_enabled || !m_watch_ok)
+    {
+        DWORD type = REG_NONE;
+        DWORD size = static_cast<DWORD>(obj_size);
+        ++m_syscall_count;
+        LONG result = reg_query(m_h_key, c_name(key).c_str(), &type, static_cast<char*>(out), &size,
+                                m_text_encoding == text_encoding::utf8);
+        
+        const char* bytes = static_cast<const char*>(out);
+        if (result == ERROR_SUCCESS && type == REG_BINARY && size == obj_size &&
+            !is_framed(bytes, size) && !is_chunked(bytes, size))
+        {
+            return nullptr;
+        }
+        if (result == ERROR_FILE_NOT_FOUND)
+        {
+            return "Key not found in registry: ";
+        }
+    }
     
-    // First query to get the required size
-    LONG result = RegQueryValueExA(
-        m_h_key,
-        value_name.c_str(),
-        NULL,
-        &type,
-        NULL,
-        &data_size
-    );
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (query_value(key, type, data_size) != ERROR_SUCCESS)
+    {
+        return "Key not found in registry: ";
+    }
     
-    if (result != ERROR_SUCCESS)
+    const char* data = m_read_buf.data();
+    if (type == REG_BINARY && is_chunked(data, data_size))
     {
-        return default_value;
+        return read_chunked(key, data_size, type_id, out, obj_size);
+    }
+    if (type == REG_BINARY && is_framed(data, data_size))
+    {
+        return decode_framed(data, data_size, type_id, out, obj_size);
+    }
+    if (type == REG_BINARY)
+    {
+        if (data_size != obj_size)
+        {
+            return "Data size mismatch for key: ";
+        }
+        memcpy(out, data, obj_size);
+        return nullptr;
+    }
+    return decode_b64_into(data, data_size, out, obj_size);
+}
+
+bool reg_api::read_obj_range(std::string_view key, uint32_t type_id, size_t obj_size,
+                             size_t offset, void* out, size_t size)
+{
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (!m_is_open || offset + size > obj_size || query_value(key, type, data_size) != ERROR_SUCCESS)
+    {
+        return false;
     }
     
-    // Allocate buffer of appropriate size
-    std::vector<char> buffer(data_size);
+    const char* data = m_read_buf.data();
     
-    // Second query to get the actual data
-    result = RegQueryValueExA(
-        m_h_key,
-        value_name.c_str(),
-        NULL,
-        &type,
-        reinterpret_cast<BYTE*>(buffer.data()),
-        &data_size
-    );
+    if (type == REG_BINARY && is_chunked(data, data_size))
+    {
+        chunk_manifest manifest;
+        if (check_manifest(data, data_size, type_id, obj_size, manifest) != nullptr)
+        {
+            return false;
+        }
+        
+        bool wide = (m_text_encoding == text_encoding::utf8);
+        HKEY h_chunks = NULL;
+        ++m_syscall_count;
+        if (reg_open(m_h_key, chunk_key_path(key).c_str(), KEY_QUERY_VALUE, h_chunks, wide) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+        
+        uint32_t first = static_cast<uint32_t>(offset / manifest.chunk_size);
+        uint32_t last = static_cast<uint32_t>((offset + size - 1) / manifest.chunk_size);
+        std::pmr::vector<char> region(scratch_resource());
+        bool ok = read_chunk_span(h_chunks, manifest, first, last, region, m_syscall_count, wide);
+        ++m_syscall_count;
+        reg_close(h_chunks);
+        
+        if (ok)
+        {
+            memcpy(out, region.data() + (offset - static_cast<size_t>(first) * manifest.chunk_size), size);
+        }
+        return ok;
+    }
     
-    if (result != ERROR_SUCCESS)
+    if (type == REG_BINARY && is_framed(data, data_size))
     {
-        return default_value;
+        // Compressed or not, the frame's CRC covers the whole object
+        std::pmr::vector<char> whole(obj_size, scratch_resource());
+        if (decode_framed(data, data_size, type_id, whole.data(), obj_size) != nullptr)
+        {
+            return false;
+        }
+        memcpy(out, whole.data() + offset, size);
+        return true;
     }
     
-    // Ensure null termination
-    if (data_size > 0 && buffer[data_size-1] != '\0')
+    if (type == REG_BINARY)
     {
-        buffer.push_back('\0');
+        if (data_size != obj_size)
+        {
+            return false;
+        }
+        memcpy(out, data + offset, size);
+        return true;
     }
     
-    return std::string(buffer.data());
-}
-
-
-
-bool reg_api::write_string(const std::string& value_name, const std::string& value)
-{
-    if (!m_is_open)
+    // Decode only the 4-character groups that cover the range
+    if (strnlen(data, data_size) != b64_encoded_size(obj_size))
     {
         return false;
     }
     
-    LONG result = RegSetValueExA(
-        m_h_key,
-        value_name.c_str(),
-        0,
-        REG_SZ,
-        reinterpret_cast<const BYTE*>(value.c_str()),
-        static_cast<DWORD>(value.length() + 1) // Include null terminator
-    );
+    size_t first_group = offset / 3;
+    size_t end_group = (offset + size + 2) / 3;
+    char decoded[3 * 64];
+    std::pmr::vector<char> large(scratch_resource());
+    char* scratch = decoded;
+    if ((end_group - first_group) * 3 > sizeof(decoded))
+    {
+        large.resize((end_group - first_group) * 3);
+        scratch = large.data();
+    }
     
-    return (result == ERROR_SUCCESS);
+    size_t skip = offset - first_group * 3;
+    size_t written = b64_d(data + first_group * 4, (end_group - first_group) * 4, scratch);
+    if (written < skip + size)
+    {
+        return false;
+    }
+    memcpy(out, scratch + skip, size);
+    return true;
 }
 
-bool reg_api::value_exists(const std::string& value_name)
+bool reg_api::write_obj_range(std::string_view key, uint32_t type_id, size_t obj_size,
+                              size_t offset, const void* data, size_t size)
 {
-    if (!m_is_open)
+    if (!m_is_open || offset + size > obj_size)
     {
         return false;
     }
     
-    DWORD type = 0;
+    // Patch what is really stored, not what is still queued
+    if (write_behind_enabled())
+    {
+        flush().wait();
+    }
+    
+    scratch_scope scratch;
+    DWORD type = REG_NONE;
     DWORD data_size = 0;
+    if (query_value(key, type, data_size) != ERROR_SUCCESS)
+    {
+        return false;
+    }
     
-    LONG result = RegQueryValueExA(
-        m_h_key,
-        value_name.c_str(),
-        NULL,
-        &type,
-        NULL,
-        &data_size
-    );
+    const char* stored = m_read_buf.data();
+    const unsigned char* patch = static_cast<const unsigned char*>(data);
     
-    return (result == ERROR_SUCCESS);
-}
-
-bool reg_api::delete_value(const std::string& value_name)
-{
-    if (!m_is_open)
+    if (type == REG_BINARY && is_chunked(stored, data_size))
+    {
+        chunk_manifest manifest;
+        if (check_manifest(stored, data_size, type_id, obj_size, manifest) != nullptr)
+        {
+            return false;
+        }
+        
+        bool wide = (m_text_encoding == text_encoding::utf8);
+        HKEY h_chunks = NULL;
+        ++m_syscall_count;
+        if (reg_open(m_h_key, chunk_key_path(key).c_str(), KEY_READ | KEY_WRITE, h_chunks, wide) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+        
+        uint32_t first = static_cast<uint32_t>(offset / manifest.chunk_size);
+        uint32_t last = static_cast<uint32_t>((offset + size - 1) / manifest.chunk_size);
+        size_t start = static_cast<size_t>(first) * manifest.chunk_size;
+        std::pmr::vector<char> region(scratch_resource());
+        bool ok = read_chunk_span(h_chunks, manifest, first, last, region, m_syscall_count, wide);
+        
+        if (ok)
+        {
+            // CRC-32C is linear: crc(a) ^ crc(b) is the unconditioned CRC of
+            // a ^ b, whose leading zeros contribute nothing. Fold the change in
+            // without reading the other chunks.
+            std::pmr::vector<unsigned char> delta(size, scratch_resource());
+            unsigned char* old_bytes = reinterpret_cast<unsigned char*>(region.data() + (offset - start));
+            for (size_t i = 0; i < size; ++i)
+            {
+                delta[i] = old_bytes[i] ^ patch[i];
+            }
+            manifest.crc ^= crc32c_zeros(crc32c_scalar(0, delta.data(), size), obj_size - offset - size);
+            memcpy(old_bytes, patch, size);
+            
+            char chunk_name[16];
+            for (uint32_t i = first; ok && i <= last; ++i)
+            {
+                size_t chunk_offset = static_cast<size_t>(i) * manifest.chunk_size;
+                size_t length = std::min<size_t>(manifest.chunk_size, obj_size - chunk_offset);
+                chunk_value_name(i, chunk_name);
+                ok = set_registry(h_chunks, chunk_name, REG_BINARY, region.data() + (chunk_offset - start),
+                                  static_cast<DWORD>(length)) == ERROR_SUCCESS;
+            }
+        }
+        
+        // The manifest carries the new CRC, so it goes last again
+        if (ok)
+        {
+            invalidate_cached(key);
+            ok = set_registry(m_h_key, c_name(key).c_str(), REG_BINARY, &manifest, sizeof(manifest)) == ERROR_SUCCESS;
+        }
+        
+        ++m_syscall_count;
+        reg_close(h_chunks);
+        return ok;
+    }
+    
+    // One value holds the whole object: decode, patch and store it again
+    // in the encoding it had
+    std::pmr::vector<char> whole(obj_size, scratch_resource());
+    bool framed = (type == REG_BINARY && is_framed(stored, data_size));
+    const char* error = nullptr;
+    if (framed)
+    {
+        error = decode_framed(stored, data_size, type_id, whole.data(), obj_size);
+    }
+    else if (type == REG_BINARY)
+    {
+        error = (data_size == obj_size) ? nullptr : "Data size mismatch for key: ";
+        if (error == nullptr)
+        {
+            memcpy(whole.data(), stored, obj_size);
+        }
+    }
+    else
+    {
+        error = decode_b64_into(stored, data_size, whole.data(), obj_size);
+    }
+    
+    if (error != nullptr)
     {
         return false;
     }
+    memcpy(whole.data() + offset, patch, size);
     
-    LONG result = RegDeleteValueA(
-        m_h_key,
-        value_name.c_str()
-    );
+    if (framed)
+    {
+        DWORD frame_size = encode_framed(whole.data(), obj_size, type_id);
+        return set_value(key, REG_BINARY, m_frame_buf.data(), frame_size);
+    }
+    if (type == REG_BINARY)
+    {
+        return set_value(key, REG_BINARY, whole.data(), static_cast<DWORD>(obj_size));
+    }
     
-    return (result == ERROR_SUCCESS);
+    std::pmr::vector<char> encoded(b64_encoded_size(obj_size) + 1, scratch_resource());
+    b64(whole.data(), obj_size, encoded.data());
+    encoded.back() = '\0';
+    return set_value(key, REG_SZ, encoded.data(), static_cast<DWORD>(encoded.size()));
+}
+
+
+size_t reg_api::b64_encoded_size(size_t in_size)
+{
+    return (in_size + 2) / 3 * 4;
+}
+
+size_t reg_api::b64_decoded_size(size_t in_size)
+{
+    return in_size / 4 * 3 + ((in_size % 4) * 3) / 4;
+}
+
+size_t reg_api::b64(const char* in, size_t in_size, char* out)
+{
+    op_scope scope(op_kind::b64);
+    size_t written = b64_encoder()(reinterpret_cast<const unsigned char*>(in), in_size, out);
+    scope.bytes_in(in_size);
+    scope.bytes_out(written);
+    return written;
 }
 
+size_t reg_api::b64_d(const char* in, size_t in_size, char* out)
+{
+    op_scope scope(op_kind::b64_d);
+    size_t written = b64_decoder()(reinterpret_cast<const unsigned char*>(in), in_size, out);
+    scope.bytes_in(in_size);
+    scope.bytes_out(written);
+    return written;
+}
 
 // Function to encode a string to Base64
 std::string reg_api::b64(const std::string& in)
 {
-    std::string out;
-    int val = 0, valb = -6;
-    for (unsigned char c : in)
+    std::string out(b64_encoded_size(in.size()), '\0');
+    out.resize(b64(in.data(), in.size(), &out[0]));
+    return out;
+}
+
+// Function to decode a Base64 string
+std::string reg_api::b64_d(const std::string& in)
+{
+    std::string out(b64_decoded_size(in.size()), '\0');
+    out.resize(b64_d(in.data(), in.size(), &out[0]));
+    return out;
+}
+
+
+
+namespace
+{
+    // Metrics of one thread. Only that thread updates it, with plain
+    // relaxed load/store pairs instead of locked read-modify-writes;
+    // get_metrics() reads it concurrently.
+    struct metrics_shard
+    {
+        struct counters
+        {
+            std::atomic<unsigned long long> calls;
+            std::atomic<unsigned long long> syscalls;
+            std::atomic<unsigned long long> bytes_in;
+            std::atomic<unsigned long long> bytes_out;
+            std::atomic<unsigned long long> latency[reg_api::latency_bucket_count];
+        };
+        
+        counters ops[reg_api::op_kind_count];
+    };
+
+    // Shards of live threads plus what exited threads and resets left behind
+    struct metrics_registry
+    {
+        std::mutex mutex;
+        std::vector<metrics_shard*> live;
+        metrics_shard retired;   // Totals of exited threads
+        metrics_shard baseline;  // Totals at the last reset_metrics()
+    };
+
+    // Never destroyed, so threads exiting during shutdown can still retire
+    metrics_registry& registry()
+    {
+        static metrics_registry* instance = new metrics_registry();
+        return *instance;
+    }
+
+    void bump(std::atomic<unsigned long long>& counter, unsigned long long value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Add (or subtract) every counter of from to out
+    void accumulate(reg_api::metrics_snapshot& out, const metrics_shard& from, bool subtract)
     {
-        val = (val << 8) + c;
-        valb += 8;
-        while (valb >= 0)
+        for (size_t k = 0; k < reg_api::op_kind_count; ++k)
         {
-            out.push_back(base64_chars[(val >> valb) & 0x3F]);
-            valb -= 6;
+            const metrics_shard::counters& src = from.ops[k];
+            reg_api::op_metrics& dst = out.ops[k];
+            unsigned long long sign = subtract ? ~0ull : 1ull;   // Wraps to subtraction
+            
+            dst.calls += sign * src.calls.load(std::memory_order_relaxed);
+            dst.syscalls += sign * src.syscalls.load(std::memory_order_relaxed);
+            dst.bytes_in += sign * src.bytes_in.load(std::memory_order_relaxed);
+            dst.bytes_out += sign * src.bytes_out.load(std::memory_order_relaxed);
+            for (size_t b = 0; b < reg_api::latency_bucket_count; ++b)
+            {
+                dst.latency[b] += sign * src.latency[b].load(std::memory_order_relaxed);
+            }
         }
     }
-    if (valb > -6)
+
+    // Fold a shard into a registry shard; caller holds the registry mutex
+    void merge(metrics_shard& to, const metrics_shard& from)
     {
-        out.push_back(base64_chars[((val << 8) >> (valb + 8)) & 0x3F]);
+        for (size_t k = 0; k < reg_api::op_kind_count; ++k)
+        {
+            bump(to.ops[k].calls, from.ops[k].calls.load(std::memory_order_relaxed));
+            bump(to.ops[k].syscalls, from.ops[k].syscalls.load(std::memory_order_relaxed));
+            bump(to.ops[k].bytes_in, from.ops[k].bytes_in.load(std::memory_order_relaxed));
+            bump(to.ops[k].bytes_out, from.ops[k].bytes_out.load(std::memory_order_relaxed));
+            for (size_t b = 0; b < reg_api::latency_bucket_count; ++b)
+            {
+                bump(to.ops[k].latency[b], from.ops[k].latency[b].load(std::memory_order_relaxed));
+            }
+        }
     }
-    while (out.size() % 4)
+
+    // Registers the thread's shard on first use and retires it at thread exit
+    struct shard_owner
+    {
+        metrics_shard* shard = nullptr;
+        
+        ~shard_owner()
+        {
+            if (shard == nullptr)
+            {
+                return;
+            }
+            
+            metrics_registry& metrics = registry();
+            std::lock_guard<std::mutex> lock(metrics.mutex);
+            merge(metrics.retired, *shard);
+            metrics.live.erase(std::find(metrics.live.begin(), metrics.live.end(), shard));
+            delete shard;
+        }
+    };
+
+    metrics_shard& thread_shard()
     {
-        out.push_back('=');
+        thread_local shard_owner owner;
+        if (owner.shard == nullptr)
+        {
+            // Value-initialized, so every counter starts at zero
+            metrics_shard* shard = new metrics_shard();
+            
+            metrics_registry& metrics = registry();
+            std::lock_guard<std::mutex> lock(metrics.mutex);
+            metrics.live.push_back(shard);
+            owner.shard = shard;
+        }
+        return *owner.shard;
     }
-    return out;
+
+    unsigned highest_bit(unsigned long long value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#elif defined(__GNUC__) || defined(__clang__)
+        return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#else
+        unsigned index = 0;
+        while (value >>= 1)
+        {
+            ++index;
+        }
+        return index;
+#endif
+    }
+
+    // Log-linear bucket of a latency, see reg_api::latency_sub_buckets
+    size_t latency_bucket(unsigned long long ns)
+    {
+        const size_t sub_buckets = reg_api::latency_sub_buckets;
+        if (ns < sub_buckets)
+        {
+            return static_cast<size_t>(ns);
+        }
+        
+        unsigned msb = highest_bit(ns);
+        size_t bucket = (msb - 2) * sub_buckets + ((ns >> (msb - 3)) & (sub_buckets - 1));
+        return std::min(bucket, reg_api::latency_bucket_count - 1);
+    }
+
+    const char* const op_names[reg_api::op_kind_count] =
+    {
+        "chroot",
+        "read_string",
+        "write_string",
+        "value_exists",
+        "delete_value",
+        "read_obj",
+        "write_obj",
+        "b64",
+        "b64_d"
+    };
 }
 
-// Function to decode a Base64 string
-std::string reg_api::b64_d(const std::string& in)
+unsigned& reg_api::op_depth()
+{
+    thread_local unsigned depth = 0;
+    return depth;
+}
+
+void reg_api::record_op(op_kind kind, unsigned long long ns, unsigned long long syscalls,
+                        unsigned long long bytes_in, unsigned long long bytes_out)
+{
+    metrics_shard::counters& counters = thread_shard().ops[static_cast<size_t>(kind)];
+    bump(counters.calls, 1);
+    bump(counters.syscalls, syscalls);
+    bump(counters.bytes_in, bytes_in);
+    bump(counters.bytes_out, bytes_out);
+    bump(counters.latency[latency_bucket(ns)], 1);
+}
+
+reg_api::metrics_snapshot reg_api::get_metrics()
 {
-    std::string out;
-    std::vector<int> T(256, -1);
-    for (int i = 0; i < 64; i++)
+    metrics_snapshot result = metrics_snapshot();
+    
+    metrics_registry& metrics = registry();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+    for (const metrics_shard* shard : metrics.live)
     {
-        T[base64_chars[i]] = i;
+        accumulate(result, *shard, false);
     }
+    accumulate(result, metrics.retired, false);
+    accumulate(result, metrics.baseline, true);
+    return result;
+}
 
-    int val = 0, valb = -8;
-    for (unsigned char c : in)
+void reg_api::reset_metrics()
+{
+    // Shards belong to their threads; remember the current totals instead
+    // of clearing them
+    metrics_snapshot current = get_metrics();
+    
+    metrics_registry& metrics = registry();
+    std::lock_guard<std::mutex> lock(metrics.mutex);
+    for (size_t k = 0; k < op_kind_count; ++k)
     {
-        if (T[c] == -1) break;
-        val = (val << 6) + T[c];
-        valb += 6;
-        if (valb >= 0)
+        metrics_shard::counters& base = metrics.baseline.ops[k];
+        bump(base.calls, current.ops[k].calls);
+        bump(base.syscalls, current.ops[k].syscalls);
+        bump(base.bytes_in, current.ops[k].bytes_in);
+        bump(base.bytes_out, current.ops[k].bytes_out);
+        for (size_t b = 0; b < latency_bucket_count; ++b)
         {
-            out.push_back(char((val >> valb) & 0xFF));
-            valb -= 8;
+            bump(base.latency[b], current.ops[k].latency[b]);
         }
     }
-    return out;
 }
 
+const char* reg_api::op_name(op_kind kind)
+{
+    return op_names[static_cast<size_t>(kind)];
+}
+
+unsigned long long reg_api::op_metrics::bucket_floor(size_t bucket)
+{
+    if (bucket < latency_sub_buckets)
+    {
+        return bucket;
+    }
+    
+    unsigned long long sub = bucket % latency_sub_buckets;
+    unsigned shift = static_cast<unsigned>(bucket / latency_sub_buckets + 2 - 3);
+    return (latency_sub_buckets + sub) << shift;
+}
+
+unsigned long long reg_api::op_metrics::latency_quantile(double q) const
+{
+    unsigned long long total = 0;
+    for (unsigned long long count : latency)
+    {
+        total += count;
+    }
+    
+    if (total == 0)
+    {
+        return 0;
+    }
+    
+    // Rank of the call at the quantile, 1-based
+    unsigned long long rank = static_cast<unsigned long long>(q * static_cast<double>(total) + 0.999999);
+    rank = std::min(std::max(rank, 1ull), total);
+    
+    unsigned long long seen = 0;
+    for (size_t b = 0; b < latency_bucket_count; ++b)
+    {
+        seen += latency[b];
+        if (seen >= rank)
+        {
+            return (b + 1 < latency_bucket_count) ? bucket_floor(b + 1) : bucket_floor(b);
+        }
+    }
+    return bucket_floor(latency_bucket_count - 1);
+}
+
+const reg_api::op_metrics& reg_api::metrics_snapshot::operator[](op_kind kind) const
+{
+    return ops[static_cast<size_t>(kind)];
+}
+
+void reg_api::metrics_snapshot::dump(std::ostream& out) const
+{
+    static const char* const counter_names[] =
+    {
+        "reg_api_calls_total",
+        "reg_api_syscalls_total",
+        "reg_api_bytes_in_total",
+        "reg_api_bytes_out_total"
+    };
+    
+    for (size_t c = 0; c < 4; ++c)
+    {
+        out << "# TYPE " << counter_names[c] << " counter\n";
+        for (size_t k = 0; k < op_kind_count; ++k)
+        {
+            const op_metrics& op = ops[k];
+            unsigned long long value = (c == 0) ? op.calls : (c == 1) ? op.syscalls : (c == 2) ? op.bytes_in : op.bytes_out;
+            out << counter_names[c] << "{op=\"" << op_names[k] << "\"} " << value << "\n";
+        }
+    }
+    
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    out << "# TYPE reg_api_latency_ns summary\n";
+    for (size_t k = 0; k < op_kind_count; ++k)
+    {
+        const op_metrics& op = ops[k];
+        for (double q : quantiles)
+        {
+            out << "reg_api_latency_ns{op=\"" << op_names[k] << "\",quantile=\"" << q << "\"} "
+                << op.latency_quantile(q) << "\n";
+        }
+        out << "reg_api_latency_ns_count{op=\"" << op_names[k] << "\"} " << op.calls << "\n";
+    }
+}
 
+#endif // _WIN32
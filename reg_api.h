@@ -1,279 +1,3012 @@
 #ifndef REGISTRY_HANDLER_H
 #define REGISTRY_HANDLER_H
 
-#include <windows.h>
+#include "reg_platform.h"
+#include "reg_backend.h"
+#include "reg_epoch.h"
 #include <string>
 #include <stdexcept>
 #include <vector>
-#include <sstream>
-#include <iomanip>
+#include <iostream>
+#include <charconv>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <string_view>
+#include <tuple>
+#include <array>
+#include <chrono>
+#include <memory_resource>
+
+// reg_api works on the Win32 registry and builds on Windows only; the
+// backends and reg_epoch above build anywhere
+#ifdef _WIN32
+
+// Build with REG_API_INSTRUMENTATION=1 to record per-operation counters
+// and latency histograms (reg_api::get_metrics()); with the default of 0
+// the instrumentation compiles to nothing
+#ifndef REG_API_INSTRUMENTATION
+#define REG_API_INSTRUMENTATION 0
+#endif
+
+// The co_await API (reg_api::async_read_string and friends) needs C++20
+// coroutines; older language modes build without it
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define REG_API_COROUTINES 1
+#include <coroutine>
+#else
+#define REG_API_COROUTINES 0
+#endif
+
+// Layout version of a type stored with reg_api::obj_format::framed.
+// Specialize it and bump value whenever the layout of T changes, so frames
+// written with the old layout are rejected instead of misread.
+template<typename T>
+struct reg_obj_version
+{
+    static constexpr unsigned value = 0;
+};
+
+// Name of a type in the frames it is stored in. Specialize it to tell apart
+// stored types of the same size; unlike the C++ type name it stays the same
+// across compilers, renames and namespaces.
+template<typename T>
+struct reg_obj_tag
+{
+    static constexpr const char* value = "";
+};
+
+// Field list of a stored type, e.g.
+//   template<> struct reg_obj_layout<Config>
+//   { static constexpr auto fields = std::make_tuple(&Config::id, &Config::ratio); };
+// With one, a frame also records each field's offset, size and kind, so
+// reordered or retyped fields of the same size are rejected on read.
+template<typename T>
+struct reg_obj_layout
+{
+};
+
+// Member type of a setting as held in a constexpr descriptor: string
+// settings keep their default as a literal
+template<typename M>
+struct reg_field_value
+{
+    typedef M type;
+};
+
+template<>
+struct reg_field_value<std::string>
+{
+    typedef const char* type;
+};
+
+// Compile-time description of one setting of the struct S: value name,
+// member, registry type, default and, for numbers, the accepted range.
+// Build it with reg_setting<Type>() so the checks below run at compile time.
+template<typename S, typename M, DWORD Type>
+struct reg_field
+{
+    typedef S settings_type;
+    typedef M member_type;
+    typedef typename reg_field_value<M>::type value_type;
+
+    static constexpr DWORD registry_type = Type;
+    static constexpr bool is_string = std::is_same<M, std::string>::value;
+
+    static_assert(Type == REG_DWORD || Type == REG_QWORD || Type == REG_SZ || Type == REG_BINARY,
+                  "reg_field: registry type must be REG_DWORD, REG_QWORD, REG_SZ or REG_BINARY");
+    static_assert(Type != REG_DWORD || (std::is_integral<M>::value && sizeof(M) <= sizeof(uint32_t)),
+                  "reg_field: REG_DWORD holds integers of at most 32 bits");
+    static_assert(Type != REG_QWORD || (std::is_integral<M>::value && sizeof(M) <= sizeof(uint64_t)),
+                  "reg_field: REG_QWORD holds integers of at most 64 bits");
+    static_assert(Type != REG_SZ || is_string || std::is_arithmetic<M>::value,
+                  "reg_field: REG_SZ holds std::string or numbers stored as text");
+    static_assert(Type != REG_BINARY || (!is_string && std::is_trivially_copyable<M>::value),
+                  "reg_field: REG_BINARY holds trivially copyable types");
+
+    const char* name;      // Value name
+    M S::* member;         // Field of the settings struct
+    value_type default_value;
+    bool bounded;          // min_value/max_value apply
+    value_type min_value;
+    value_type max_value;
+};
+
+// Describe a setting with its default; Type is the registry type it is
+// stored as
+template<DWORD Type, typename S, typename M>
+constexpr reg_field<S, M, Type> reg_setting(const char* name, M S::* member,
+                                            typename reg_field_value<M>::type default_value)
+{
+    return reg_field<S, M, Type>{ name, member, default_value, false, default_value, default_value };
+}
+
+// Describe a numeric setting accepted only within [min_value, max_value];
+// stored values outside the range read back as the default
+template<DWORD Type, typename S, typename M>
+constexpr reg_field<S, M, Type> reg_setting(const char* name, M S::* member, M default_value,
+                                            M min_value, M max_value)
+{
+    static_assert(std::is_arithmetic<M>::value, "reg_setting: only numbers have bounds");
+
+    // Reached only for a bad descriptor, which fails constant evaluation
+    if (min_value > max_value || default_value < min_value || default_value > max_value)
+    {
+        throw std::logic_error("reg_setting: default outside of its bounds");
+    }
+
+    return reg_field<S, M, Type>{ name, member, default_value, true, min_value, max_value };
+}
+
+// Every setting of one struct, with its names laid out for a single bulk
+// query; declare it constexpr with make_reg_schema()
+template<typename... Fields>
+struct reg_schema
+{
+    static_assert(sizeof...(Fields) > 0, "reg_schema: no fields");
+
+    typedef typename std::tuple_element<0, std::tuple<Fields...>>::type::settings_type settings_type;
+
+    static_assert((std::is_same<typename Fields::settings_type, settings_type>::value && ...),
+                  "reg_schema: all fields must belong to the same struct");
+
+    std::tuple<Fields...> fields;
+    std::array<const char*, sizeof...(Fields)> names;
+};
+
+template<typename... Fields>
+constexpr reg_schema<Fields...> make_reg_schema(const Fields&... fields)
+{
+    return reg_schema<Fields...>{ std::tuple<Fields...>(fields...), {{ fields.name... }} };
+}
 
 class reg_api
 {
     public:
+        // How write_number/write_obj store their values
+        enum class storage_mode
+        {
+            string, // REG_SZ text and Base64 (default, legacy format)
+            native  // REG_DWORD/REG_QWORD for integers, REG_BINARY otherwise
+        };
+
+        // Encoding of the key paths, value names and string data passed to
+        // and returned by reg_api
+        enum class text_encoding
+        {
+            ansi, // Active code page, through the A registry API (default)
+            utf8  // UTF-8, through the W registry API
+        };
+
+        // Whether a key created by chroot() is written to the hive
+        enum class key_lifetime
+        {
+            persistent,  // REG_OPTION_NON_VOLATILE (default)
+            volatile_key // REG_OPTION_VOLATILE: kept in memory, gone after a reboot
+        };
+
+        // How write_obj stores objects
+        enum class obj_format
+        {
+            legacy, // Base64 text or raw bytes, per the storage mode (default)
+            framed  // REG_BINARY frame with type hash, length and CRC-32C
+        };
+
+        // Value cache counters
+        struct cache_stats
+        {
+            unsigned long long hits;          // Lookups served from memory
+            unsigned long long misses;        // Lookups that queried the registry
+            unsigned long long invalidations; // Cache drops caused by key changes
+            size_t entries;                   // Values currently cached
+        };
+
+        // Value index counters
+        struct index_stats
+        {
+            unsigned long long queries;  // find_prefix/find_range calls
+            unsigned long long rebuilds; // Full enumerations after the key changed
+            unsigned long long patches;  // Names re-queried after this instance changed them
+            size_t entries;              // Values currently indexed
+        };
+
+        // One value of the index; name points into the index
+        struct index_entry
+        {
+            std::string_view name;
+            DWORD type;
+        };
+
+        // Index entries matched by a query, in name order; valid until the
+        // next index query or change of the open key
+        struct index_range
+        {
+            const index_entry* first;
+            const index_entry* last;
+
+            const index_entry* begin() const { return first; }
+            const index_entry* end() const { return last; }
+            size_t size() const { return static_cast<size_t>(last - first); }
+            bool empty() const { return first == last; }
+        };
+
+        // Queued writes and deletes applied to the open key in one pass
+        class batch
+        {
+            public:
+                // Queue a string write
+                bool write_string(std::string_view value_name, const std::string& value);
+
+                // Queue a numeric write, encoded with the owner's storage mode
+                template<typename T>
+                    bool write_number(std::string_view value_name, const T& value);
+
+                // Queue an object write, encoded with the owner's storage mode.
+                // Objects the owner would chunk cannot be part of a batch: false,
+                // nothing queued; write them with reg_api::write_obj
+                template <typename T>
+                    bool write_obj(std::string_view key, const T& t_obj);
+
+                // Queue a value deletion
+                bool delete_value(std::string_view value_name);
+
+                // Apply the queued operations to the key open at commit time;
+                // unchanged values are skipped. Returns false if any failed.
+                bool commit();
+
+                // Discard the queued operations
+                void clear();
+
+                // Number of queued operations
+                size_t size() const;
+
+                // Operations written / skipped as unchanged by the last commit
+                size_t applied() const;
+                size_t skipped() const;
+
+            private:
+                friend class reg_api;
+
+                batch(reg_api& owner, bool transacted);
+
+                // One queued operation; name and data live in m_arena
+                struct op
+                {
+                    bool is_delete;
+                    DWORD type;
+                    size_t name_offset;
+                    size_t data_offset;
+                    DWORD data_size;
+                };
+
+                // Copy a name (null-terminated) and its data into the arena
+                void add(std::string_view value_name, bool is_delete, DWORD type, const void* data, DWORD data_size);
+
+                // Apply the queued operations to h_key
+                bool apply(HKEY h_key, bool use_cache);
+
+                reg_api* m_owner;        // Instance whose key is written
+                bool m_transacted;       // Commit through the kernel transaction manager
+                std::vector<char> m_arena; // Names and payloads, back to back
+                std::vector<op> m_ops;   // Queued operations in order
+                size_t m_applied;        // Written by the last commit
+                size_t m_skipped;        // Skipped by the last commit
+                bool m_compare;          // Skip unchanged values; off once sync() diffed them
+        };
+
+        // Immutable copy of a key's values: one byte blob plus a sorted index
+        class snapshot
+        {
+            public:
+                snapshot();
+
+                // Number of values in the snapshot
+                size_t size() const;
+
+                // Whether the snapshot holds no values
+                bool empty() const;
+
+                // Name of the i-th value in sorted order
+                std::string name_at(size_t index) const;
+
+                // Check if a value is present
+                bool contains(std::string_view value_name) const;
+
+                // Raw access to a value; data stays valid while the snapshot lives
+                bool find(std::string_view value_name, DWORD& type, const char*& data, DWORD& data_size) const;
+
+                // Typed readers matching the reg_api ones, served from memory
+                std::string read_string(std::string_view value_name, const std::string& default_value = "") const;
+
+                template<typename T>
+                    T read_number(std::string_view value_name, const T& default_value = T()) const;
+
+                template <typename T>
+                    T read_obj(std::string_view key) const;
+
+                // Names of the values added, removed or modified between
+                // other and this snapshot, in sorted order
+                std::vector<std::string> changed_names(const snapshot& other) const;
+
+            private:
+                friend class reg_api;
+
+                // Index entry; offsets point into m_blob
+                struct entry
+                {
+                    DWORD name_offset;
+                    DWORD name_size;
+                    DWORD type;
+                    DWORD data_offset;
+                    DWORD data_size;
+                };
+
+                // Append a name to the blob for an entry whose data is already there
+                void add_name(entry& item, const char* name, size_t name_size);
+
+                // Sort the index once all values are in
+                void seal();
+
+                // Binary search for a value name
+                const entry* lookup(std::string_view value_name) const;
+
+                std::vector<char> m_blob;   // Value data and names
+                std::vector<entry> m_index; // Sorted by name, case-insensitive
+        };
+
+        // Read-only view of a subtree file written by export_tree(). The file
+        // is memory-mapped and parsed in place: lookups binary-search the
+        // mapped key and value tables and never touch the registry
+        class tree_file
+        {
+            public:
+                tree_file();
+                ~tree_file();
+
+                tree_file(tree_file&& other) noexcept;
+                tree_file& operator=(tree_file&& other) noexcept;
+
+                tree_file(const tree_file&) = delete;
+                tree_file& operator=(const tree_file&) = delete;
+
+                // Map and validate a file; false if it is missing or malformed
+                bool open(const std::string& file_path);
+
+                // Unmap the file
+                void close();
+
+                bool is_open() const;
+
+                // Keys in sorted order, by path relative to the exported key
+                // ("" is the exported key itself)
+                size_t key_count() const;
+                std::string key_at(size_t index) const;
+                bool contains_key(std::string_view key_path) const;
+
+                // Raw access to a value; data points into the mapping
+                bool find(std::string_view key_path, std::string_view value_name,
+                          DWORD& type, const char*& data, DWORD& data_size) const;
+
+                // Typed readers matching the reg_api ones
+                std::string read_string(std::string_view key_path, std::string_view value_name,
+                                        const std::string& default_value = "") const;
+
+                template<typename T>
+                    T read_number(std::string_view key_path, std::string_view value_name,
+                                  const T& default_value = T()) const;
+
+                // Copy the values of one key out, e.g. to diff it against
+                // reg_api::load_all() with snapshot::changed_names()
+                snapshot load(std::string_view key_path) const;
+
+            private:
+                friend class reg_api;
+
+                struct key_record;
+                struct value_record;
+
+                const key_record* find_key(std::string_view key_path) const;
+                const value_record* find_value(const key_record& key, std::string_view value_name) const;
+
+                const key_record* keys() const;
+                const value_record* values() const;
+
+                HANDLE m_file;      // Open file
+                HANDLE m_mapping;   // File mapping object
+                const char* m_base; // Mapped view
+                size_t m_size;      // Bytes mapped
+        };
+
+        // Fixed table of small named values in a named, page-file backed file
+        // mapping, for values updated too often to go through the registry.
+        // Every process that opens the mapping name sees the same slots. Each
+        // slot is a seqlock: writers never block readers, and a read retries
+        // until it sees one whole write. Slot names are case-sensitive and
+        // are never removed.
+        class slot_table
+        {
+            public:
+                static constexpr size_t max_name_size = 55; // Bytes of a slot name
+                static constexpr size_t max_data_size = 64; // Bytes of a slot value
+                static constexpr size_t npos = static_cast<size_t>(-1);
+
+                slot_table();
+                ~slot_table();
+
+                slot_table(slot_table&& other) noexcept;
+                slot_table& operator=(slot_table&& other) noexcept;
+
+                slot_table(const slot_table&) = delete;
+                slot_table& operator=(const slot_table&) = delete;
+
+                // Create the mapping with room for slot_count slots, or open
+                // it with its existing size if another process created it
+                bool create(const std::string& mapping_name, size_t slot_count);
+
+                // Open a mapping created by create()
+                bool open(const std::string& mapping_name);
+
+                // Unmap the table
+                void close();
+
+                // Whether a table is mapped
+                bool is_open() const;
+
+                // Mapping name given to create() or open()
+                const std::string& name() const;
+
+                // Slots in the table / slots with a name
+                size_t capacity() const;
+                size_t size() const;
+
+                // Index of the slot named name, claiming a free slot for it;
+                // npos when the table is full or the name is too long
+                size_t slot(std::string_view name);
+
+                // Index of an existing slot, or npos
+                size_t find(std::string_view name) const;
+
+                // Replace the value of a slot with size bytes (at most
+                // max_data_size). store(), load() and add() fail on a slot
+                // whose writer died mid-write, after waiting about 100 ms
+                bool store(size_t index, const void* data, size_t size);
+
+                // Copy the value of a slot into data; false if it was never
+                // stored or does not fit in capacity bytes
+                bool load(size_t index, void* data, size_t capacity, size_t* size = nullptr) const;
+
+                // Add delta to the 64-bit counter in the named slot (0 if it
+                // held no counter) and optionally return the new value
+                bool add(std::string_view name, long long delta, long long* result = nullptr);
+
+                // Trivially copyable value of at most max_data_size bytes
+                template<typename T>
+                    bool write(std::string_view name, const T& value);
+
+                template<typename T>
+                    T read(std::string_view name, const T& default_value = T()) const;
+
+            private:
+                struct header;
+                struct record;
+
+                header* table() const;
+                record* records() const;
+
+                // Begin a write: wait for an even sequence, return it in
+                // sequence and make it odd; false if its writer died mid-write
+                static bool lock_record(record& slot, uint32_t& sequence);
+
+                // Create or open the named mutex that serializes slot claims
+                bool open_naming(const std::string& mapping_name);
+
+                HANDLE m_mapping;   // File mapping object
+                void* m_base;       // Mapped view
+                HANDLE m_naming;    // Mutex "<mapping name>.naming"
+                std::string m_name; // Mapping name
+        };
+
+        // Scratch arena counters of the calling thread
+        struct scratch_stats
+        {
+            unsigned long long heap_blocks; // Blocks the arena took from the heap
+            size_t retained_bytes;          // Block kept for the next scope
+            size_t peak_bytes;              // Most bytes in use within one scope
+        };
+
+        // Marks a span of reg_api calls on this thread, such as one request.
+        // The temporaries of those calls come from the thread's scratch
+        // arena by bumping a pointer, and are reclaimed at once when the
+        // outermost scope ends. The arena then keeps one block as large as the
+        // span needed (up to 1 MB), so repeated spans stop allocating.
+        // Every call opens its own scope; an outer one lets several calls
+        // share the arena.
+        class scratch_scope
+        {
+            public:
+                scratch_scope();
+                ~scratch_scope();
+
+                scratch_scope(const scratch_scope&) = delete;
+                scratch_scope& operator=(const scratch_scope&) = delete;
+
+                // Arena of the calling thread; memory from it is valid until
+                // the outermost scope ends
+                static std::pmr::memory_resource* resource();
+
+                // Counters of the calling thread's arena
+                static scratch_stats get_stats();
+        };
+
+        // Copy of an object read once by view_obj(), with typed access to its
+        // fields. It must not outlive the reg_api that created it. Fields are
+        // zero while the view is not valid.
+        template<typename T>
+            class obj_view
+            {
+                public:
+                    obj_view();
+
+                    // Whether the last read succeeded
+                    bool is_valid() const;
+
+                    const T& get() const;
+                    const T* operator->() const;
+
+                    // Reference to one field inside the view
+                    template<typename M>
+                        const M& get(M T::* member) const;
+
+                    // Read the object again into the same storage
+                    bool reload();
+
+                    // Patch one field with reg_api::write_field() and in the view
+                    template<typename M>
+                        bool set(M T::* member, const M& value);
+
+                private:
+                    friend class reg_api;
+
+                    struct alignas(T) storage
+                    {
+                        unsigned char bytes[sizeof(T)];
+                    };
+
+                    reg_api* m_owner;                 // Instance that reads and patches
+                    std::string m_key;                // Value name
+                    std::unique_ptr<storage> m_object; // Decoded object
+                    bool m_valid;
+            };
+
+        // How floating point values are written in string storage mode
+        enum class float_format
+        {
+            fixed5,  // At most 5 decimal places, trailing zeros trimmed (default)
+            shortest // Shortest text that reads back to the same value
+        };
+
+        // Buffer size that fits any number formatted by format_number
+        static constexpr size_t number_buffer_size = 384;
+
+        // Write-behind queue counters
+        struct write_behind_stats
+        {
+            unsigned long long queued;    // Writes and deletes accepted
+            unsigned long long applied;   // Registry calls made for them
+            unsigned long long coalesced; // Superseded by a later write before being applied
+            unsigned long long failed;    // Registry calls that failed
+            size_t depth;                 // Operations waiting to be applied
+            size_t max_depth;             // Highest depth seen
+        };
+
+        // Counters of the co_await API
+        struct async_stats
+        {
+            unsigned long long operations; // Awaited operations completed
+            unsigned long long drains;     // Executor passes; each serves every operation queued by then
+            unsigned long long reads;      // Registry reads issued for the awaited reads
+            size_t largest_drain;          // Most operations served by one pass
+        };
+
+        // Public operations covered by the instrumentation
+        enum class op_kind
+        {
+            chroot,
+            read_string,
+            write_string,
+            value_exists,
+            delete_value,
+            read_obj,
+            write_obj,
+            b64,
+            b64_d
+        };
+
+        static constexpr size_t op_kind_count = 9;
+
+        // Whether this build records metrics
+        static constexpr bool metrics_enabled = (REG_API_INSTRUMENTATION != 0);
+
+        // Latency histogram resolution: values below 8 ns are exact, larger
+        // ones fall in one of 8 linear sub-buckets per power of two (at most
+        // 12.5% error), up to 2^41 ns
+        static constexpr size_t latency_sub_buckets = 8;
+        static constexpr size_t latency_bucket_count = 312;
+
+        // Totals of one operation across all threads
+        struct op_metrics
+        {
+            unsigned long long calls;
+            unsigned long long syscalls;  // Registry API calls made on the caller's thread
+            unsigned long long bytes_in;  // Bytes handed to reg_api
+            unsigned long long bytes_out; // Bytes handed back
+            std::array<unsigned long long, latency_bucket_count> latency; // Call counts per bucket
+
+            // Latency in ns below which the fraction q (0..1) of calls fell
+            unsigned long long latency_quantile(double q) const;
+
+            // Lowest latency in ns counted in a bucket
+            static unsigned long long bucket_floor(size_t bucket);
+        };
+
+        // Point-in-time copy of all operation metrics
+        struct metrics_snapshot
+        {
+            std::array<op_metrics, op_kind_count> ops;
+
+            const op_metrics& operator[](op_kind kind) const;
+
+            // Prometheus text exposition: counters plus p50/p90/p99/p99.9
+            void dump(std::ostream& out) const;
+        };
+
+        // Handle pool counters
+        struct pool_stats
+        {
+            unsigned long long hits;      // Opens served by a pooled handle
+            unsigned long long misses;    // Opens that went to the registry
+            unsigned long long evictions; // Idle handles closed to make room
+            size_t open_handles;          // Handles currently held by the pool
+        };
+
+        // Remote connection pool counters
+        struct remote_pool_stats
+        {
+            unsigned long long connects;  // RegConnectRegistryA calls
+            unsigned long long reuses;    // Connections served from the pool
+            unsigned long long failures;  // Connections that could not be made
+            size_t open_connections;      // Connections currently held (idle or in use)
+        };
+
+        // Outcome of one host of read_remote()
+        struct remote_result
+        {
+            std::string machine_name;
+            LONG status;                       // ERROR_SUCCESS, a registry error or ERROR_TIMEOUT
+            snapshot values;                   // Values read when status is ERROR_SUCCESS
+            std::chrono::milliseconds elapsed; // From the start of the host's read
+        };
+
+        // Receives each host's result on the thread that called read_remote()
+        typedef std::function<void(const remote_result& result)> remote_callback;
+
+        // Lightweight view of an additional open key, see open_key(); it must
+        // not outlive the reg_api that opened it
+        class key
+        {
+            public:
+                key();
+                ~key();
+
+                key(key&& other) noexcept;
+                key& operator=(key&& other) noexcept;
+
+                key(const key&) = delete;
+                key& operator=(const key&) = delete;
+
+                // Whether the view refers to an open key
+                bool is_open() const;
+
+                // Give the handle back (to the pool when pooling is enabled)
+                void close();
+
+                // Accessors matching the reg_api ones, applied to this key
+                std::string read_string(std::string_view value_name, const std::string& default_value = "");
+
+                bool write_string(std::string_view value_name, const std::string& value);
+
+                template<typename T>
+                    T read_number(std::string_view value_name, const T& default_value = T());
+
+                template<typename T>
+                    bool write_number(std::string_view value_name, const T& value);
+
+                bool value_exists(std::string_view value_name);
+
+                bool delete_value(std::string_view value_name);
+
+            private:
+                friend class reg_api;
+
+                key(reg_api* owner, HKEY h_key, bool pooled);
+
+                reg_api* m_owner; // Instance that opened the key
+                HKEY m_h_key;     // Open key handle
+                bool m_pooled;    // Handle belongs to the owner's pool
+        };
+
+        // Thread-safe counterpart of reg_api for one key shared by many
+        // threads. The open key is an immutable reference-counted object:
+        // readers take a reference and query it without locking, while
+        // chroot/close/writes are serialized and publish a replacement. A
+        // replaced handle is closed when its last reader lets go of it.
+        class shared
+        {
+            public:
+                explicit shared(HKEY h_root_key = HKEY_CURRENT_USER);
+                ~shared();
+
+                shared(const shared&) = delete;
+                shared& operator=(const shared&) = delete;
+
+                // Open or create a key and publish it to all threads
+                bool chroot(const std::string& key_path);
+
+                // Unpublish the current key
+                void close();
+
+                bool is_open() const;
+
+                // Readers take no lock: the key and its cache are immutable
+                // once published and reclaimed by epochs. Each thread queries
+                // into its own buffer; only a cache miss serializes its fill
+                std::string read_string(std::string_view value_name, const std::string& default_value = "") const;
+
+                bool read_into(std::string_view value_name, std::string& out) const;
+
+                template<typename T>
+                    T read_number(std::string_view value_name, const T& default_value = T()) const;
+
+                bool value_exists(std::string_view value_name) const;
+
+                // Serialized writers
+                bool write_string(std::string_view value_name, const std::string& value);
+
+                template<typename T>
+                    bool write_number(std::string_view value_name, const T& value);
+
+                bool delete_value(std::string_view value_name);
+
+                void set_storage_mode(storage_mode mode);
+                void set_float_format(float_format format);
+
+                // One cache for all threads, kept coherent by a change
+                // notification like the reg_api cache; reopens the key
+                void enable_cache(bool enable);
+
+                cache_stats get_cache_stats() const;
+
+                unsigned long long syscall_count() const;
+
+            private:
+                struct opened_key;
+                struct cache_table;
+
+                // Cache hit/miss counters of a few threads, one cache line each
+                struct alignas(64) counter_shard
+                {
+                    std::atomic<unsigned long long> hits{0};
+                    std::atomic<unsigned long long> misses{0};
+                };
+                static constexpr size_t counter_shards = 64;
+
+                HKEY m_h_root_key;                           // Root key handle
+                std::atomic<const opened_key*> m_key;        // Published key, retired through epochs
+                std::mutex m_write_mutex;                    // Serializes chroot/close/writes
+                storage_mode m_storage_mode;                 // Guarded by m_write_mutex
+                float_format m_float_format;                 // Guarded by m_write_mutex
+                std::atomic<bool> m_cache_enabled;           // Cache new keys
+                mutable std::atomic<unsigned long long> m_syscall_count;
+                mutable counter_shard m_counters[counter_shards];
+                mutable std::atomic<unsigned long long> m_cache_invalidations;
+
+                // Current key, or null when closed; the caller holds an
+                // epoch_guard or m_write_mutex
+                const opened_key* current() const;
+
+                // Counters of the calling thread
+                counter_shard& counters() const;
+
+                // Replace the published key, retiring the old one
+                void publish(const opened_key* key);
+
+                // Query a value of key into the calling thread's buffer
+                LONG query_value(const opened_key& key, std::string_view value_name, DWORD& type, DWORD& data_size) const;
+
+                // Reused per-thread read buffer
+                static std::vector<char>& thread_buffer();
+
+                // Open key_path and publish it; caller holds m_write_mutex
+                bool open_locked(const std::string& key_path);
+
+                // Write raw bytes; caller holds m_write_mutex
+                bool set_value(std::string_view value_name, DWORD type, const void* data, DWORD data_size);
+
+                // Forget a cached value after this instance changed it
+                void invalidate_cached(const opened_key& key, std::string_view value_name);
+        };
+
+        // Access policies for basic_reader: the rights its keys are opened
+        // with. KEY_WOW64_64KEY/KEY_WOW64_32KEY pick a registry view
+        struct read_only_access
+        {
+            static constexpr REGSAM sam = KEY_READ;
+        };
+
+        struct read_only_access_64
+        {
+            static constexpr REGSAM sam = KEY_READ | KEY_WOW64_64KEY;
+        };
+
+        struct read_only_access_32
+        {
+            static constexpr REGSAM sam = KEY_READ | KEY_WOW64_32KEY;
+        };
+
+        // Read-only counterpart of reg_api. chroot() opens an existing key
+        // with Access::sam and never creates one, and the interface has no
+        // writers, so probing a key has no side effects and works on keys the
+        // caller may only read
+        template<typename Access>
+            class basic_reader;
+
+        // Key stores that serve reg_api in place of the Win32 registry, see
+        // reg_backend.h. A reg_api constructed with root() works on the
+        // backend and every key it opens below is served by the same one
+        typedef reg_backend backend;
+        typedef reg_memory_backend memory_backend;
+        typedef reg_file_backend file_backend;
+
         // Constructor
         reg_api(HKEY h_root_key = HKEY_CURRENT_USER);
 
+        // Read the registry of another machine ("host" or "\\\\host"),
+        // through a pooled RegConnectRegistryA connection. Keys are opened
+        // with KEY_READ and never created, so writes fail; if the host cannot
+        // be reached, or the key does not exist, chroot() fails
+        explicit reg_api(const std::string& machine_name, HKEY h_root_key = HKEY_LOCAL_MACHINE);
+
         // Destructor
         ~reg_api();
 
-        // Change root key
-        bool chroot(const std::string& key_path);
+        // Change root key. A key that does not exist yet is created with
+        // the given lifetime; an existing key keeps its own. A remote
+        // instance opens an existing key read-only instead
+        bool chroot(const std::string& key_path, key_lifetime lifetime = key_lifetime::persistent);
 
         // Close the opened key
         void close();
 
-        // Read numeric value (template function) with default value
-        template<typename T>
-            T read_number(const std::string& value_name, const T& default_value = T());
+        // Read numeric value (template function) with default value
+        template<typename T>
+            T read_number(std::string_view value_name, const T& default_value = T());
+
+        // Write numeric value (template function)
+        template<typename T>
+            bool write_number(std::string_view value_name, const T& value);
+
+        template<typename T>
+            bool write_pointer(std::string_view value_name, T* ptr);
+
+        template<typename T>
+            T* read_pointer(std::string_view value_name, T* default_value = nullptr);
+
+        // Store the mapping name of a slot table as a string value, so other
+        // processes can find the table with open_slots()
+        bool publish_slots(std::string_view value_name, const slot_table& table);
+
+        // Open the slot table whose mapping name the value holds
+        bool open_slots(std::string_view value_name, slot_table& table);
+
+        // Read string value with default value
+        std::string read_string(std::string_view value_name, const std::string& default_value = "");
+
+        // Write string value
+        bool write_string(std::string_view value_name, const std::string& value);
+
+        // Read a string value into out, reusing its capacity
+        bool read_into(std::string_view value_name, std::string& out);
+
+        // Read a string value into a caller buffer with its terminator; fails
+        // without touching the buffer if it does not fit. length receives the
+        // string size either way.
+        bool read_into(std::string_view value_name, char* buffer, size_t capacity, size_t* length = nullptr);
+
+        // Check if a value exists
+        bool value_exists(std::string_view value_name);
+
+        // Delete a value
+        bool delete_value(std::string_view value_name);
+
+        // Open (or create) another key relative to the root, through the
+        // pool; a remote instance opens an existing key read-only
+        key open_key(const std::string& key_path);
+
+        // Whether this instance works on a remote machine
+        bool is_remote() const;
+
+        // Machine given to the remote constructor, empty for the local registry
+        const std::string& machine_name() const;
+
+        // Idle remote connections kept for reuse across instances (default
+        // 64); connections in use are never closed
+        static void set_remote_pool_capacity(size_t idle_capacity);
+
+        // Process-wide remote connection counters
+        static remote_pool_stats get_remote_pool_stats();
+
+        // Read value_names (every value when empty) of key_path on each
+        // machine, with at most max_in_flight hosts being read at a time.
+        // on_result runs once per machine as results arrive; a host still
+        // busy after timeout_ms reports ERROR_TIMEOUT and its late result is
+        // dropped, though its reader stays busy until the host answers. Keys
+        // are opened read-only. Returns the number of hosts read successfully.
+        static size_t read_remote(const std::vector<std::string>& machine_names, HKEY h_root_key,
+                                  const std::string& key_path, const std::vector<std::string>& value_names,
+                                  const remote_callback& on_result, size_t max_in_flight = 32,
+                                  DWORD timeout_ms = 30000);
+
+        // Keep up to capacity idle key handles open for reuse by chroot() and
+        // open_key(); 0 (the default) closes handles as soon as they are released
+        void enable_handle_pool(size_t capacity);
+
+        // Close every idle pooled handle
+        void clear_handle_pool();
+
+        // Handle pool counters
+        pool_stats get_pool_stats() const;
+
+        // Receives the watched key path and the names of the values that
+        // changed; runs on a thread-pool thread
+        typedef std::function<void(const std::string& key_path, const std::vector<std::string>& changed)> watch_callback;
+
+        // Call callback whenever the key at key_path (relative to the root)
+        // changes, per the RegNotifyChangeKeyValue filter. All watches share
+        // the system thread pool's wait threads. Returns an id for unwatch(),
+        // or 0 when the key cannot be opened or watched
+        unsigned long long watch(const std::string& key_path, watch_callback callback,
+                                 DWORD filter = REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET);
+
+        // Stop a watch; waits for a running callback, so do not call it from one
+        bool unwatch(unsigned long long id);
+
+        // Number of active watches
+        size_t watch_count() const;
+
+        // Write key_path (relative to the root), its subkeys and all their
+        // values to a versioned binary file that tree_file can map
+        bool export_tree(const std::string& key_path, const std::string& file_path);
+
+        // Recreate the keys and values of an export_tree() file under
+        // key_path, reading it through a memory map; false on a remote instance
+        bool import_tree(const std::string& file_path, const std::string& key_path);
+
+        // One key visited by walk(); the views are only valid during the
+        // callback
+        struct tree_node
+        {
+            std::string_view path;  // Relative to the walked key, "" for the key itself
+            std::string_view name;  // Last component of path
+            size_t depth;           // 0 for the walked key
+            DWORD subkey_count;
+            DWORD value_count;
+            const snapshot* values; // Every value of the key, or nullptr without walk_options::values
+        };
+
+        // Return false to skip the subkeys of node
+        typedef std::function<bool(const tree_node& node)> walk_callback;
+
+        struct walk_options
+        {
+            bool values;      // Load each key's values into tree_node::values (default true)
+            size_t max_depth; // Deepest level visited, 0 being the walked key (default unlimited)
+            size_t threads;   // Walker threads; 0 (default) for one per core, 1 walks inline
+
+            walk_options() : values(true), max_depth(static_cast<size_t>(-1)), threads(0) {}
+        };
+
+        // Names of the direct subkeys of key_path (relative to the open key,
+        // "" for the open key itself), in registry order
+        std::vector<std::string> subkey_names(const std::string& key_path = "");
+
+        // Visit key_path (relative to the root) and every key below it. Each
+        // key is opened once, relative to its parent; with more than one
+        // thread, subtrees are spread over work-stealing walkers and on_node
+        // is called concurrently from them, in no particular order. Returns
+        // false if a key could not be opened or enumerated; the rest of the
+        // tree is still visited. on_node must not throw
+        bool walk(const std::string& key_path, const walk_callback& on_node,
+                  const walk_options& options = walk_options());
+
+        // Read every value of the open key (RegEnumValueA) into a snapshot
+        snapshot load_all();
+
+        // Read the named values in one RegQueryMultipleValuesA call; missing
+        // values are left out of the snapshot
+        snapshot load(const std::vector<std::string>& value_names);
+
+        // Fill settings from the values a schema describes in one bulk query;
+        // missing, mistyped or out-of-range values get their defaults.
+        // Returns true if every field was read from the registry.
+        template<typename... Fields>
+            bool load(const reg_schema<Fields...>& schema, typename reg_schema<Fields...>::settings_type& settings);
+
+        // Write every field of settings in one batch, each with the registry
+        // type its descriptor declares; unchanged values are skipped
+        template<typename... Fields>
+            bool store(const reg_schema<Fields...>& schema, const typename reg_schema<Fields...>::settings_type& settings);
+
+        struct sync_options
+        {
+            bool delete_extra; // Delete values of the key that desired lacks (default false)
+            bool transacted;   // Apply the operations as a transacted batch (default false)
+            bool dry_run;      // Only count the operations (default false)
+
+            sync_options() : delete_extra(false), transacted(false), dry_run(false) {}
+        };
+
+        // Operations sync() made, or would make on a dry run
+        struct sync_result
+        {
+            size_t sets;    // Values written
+            size_t deletes; // Values deleted
+            size_t skipped; // Desired values that were already byte-identical
+            bool ok;        // The key was read and every operation succeeded
+        };
+
+        // Bring the open key to the desired values: read its current values
+        // in one pass, compare type and bytes in memory, and write or delete
+        // only those that differ, as one batch. A desired state can come from
+        // load_all(), tree_file::load() or another instance
+        sync_result sync(const snapshot& desired, const sync_options& options = sync_options());
+
+        // sync() to the values store() would write for settings
+        template<typename... Fields>
+            sync_result sync(const reg_schema<Fields...>& schema, const typename reg_schema<Fields...>::settings_type& settings,
+                             const sync_options& options = sync_options());
+
+        // Start collecting writes; transacted batches commit atomically
+        batch begin_batch(bool transacted = false);
+
+        // Select the storage format for subsequent writes; reads accept both
+        void set_storage_mode(storage_mode mode);
+
+        // Current storage format for writes
+        storage_mode get_storage_mode() const;
+
+        // Select the object format for subsequent write_obj calls; read_obj
+        // accepts every format
+        void set_obj_format(obj_format format);
+
+        // Current object format for writes
+        obj_format get_obj_format() const;
+
+        // Compress framed objects of at least threshold bytes (XPRESS);
+        // 0 disables compression (the default)
+        void set_obj_compression(size_t threshold);
+
+        // Current compression threshold
+        size_t get_obj_compression() const;
+
+        // Chunk size used unless set_obj_chunking() is given another
+        static constexpr size_t default_chunk_size = 16 * 1024;
+
+        // Store objects of at least threshold bytes as REG_BINARY chunks of
+        // chunk_size bytes in a subkey, with a manifest under the value name;
+        // 0 disables chunking (the default)
+        void set_obj_chunking(size_t threshold, size_t chunk_size = default_chunk_size);
+
+        // Current chunking threshold
+        size_t get_obj_chunking() const;
+
+        // Select the encoding of names and strings; utf8 calls the W registry
+        // API and converts in per-thread buffers, so text outside the code
+        // page survives. Affects keys opened afterwards and drops the cache.
+        void set_text_encoding(text_encoding encoding);
+
+        // Current encoding of names and strings
+        text_encoding get_text_encoding() const;
+
+        // Select the text format for floating point values; reads accept both
+        void set_float_format(float_format format);
+
+        // Current text format for floating point values
+        float_format get_float_format() const;
+
+        // Format a number the way write_number stores it as text; returns the
+        // length written (no terminator), or 0 if the buffer is too small
+        template<typename T>
+            static size_t format_number(const T& value, float_format format, char* buffer, size_t size);
+
+        // Parse text the way read_number does; out is untouched on failure
+        template<typename T>
+            static bool parse_number(const char* first, const char* last, T& out);
+
+        // Enable the read-through value cache for keys opened by chroot()
+        void enable_cache(bool enable);
+
+        // Whether the value cache is enabled
+        bool cache_enabled() const;
+
+        // Value cache counters since the cache was enabled
+        cache_stats get_cache_stats() const;
+
+        // One key of a prefetch() plan
+        struct prefetch_key
+        {
+            std::string key_path;                 // Relative to the root key
+            std::vector<std::string> value_names; // Values to read; empty for every value
+        };
+
+        // Open and read the keys of plan on up to threads background threads
+        // and keep them for chroot(). Chrooting to a prefetched key takes its
+        // open handle, and with the cache enabled seeds the cache with its
+        // values, so the first reads after it stay in memory. Each key is
+        // watched from before it is read; one that changed before chroot()
+        // is read from the registry as usual. chroot() to a key still in
+        // flight waits for it. Replaces any earlier plan. The future is ready
+        // once every key was read; true if all could be opened
+        std::future<bool> prefetch(const std::vector<prefetch_key>& plan, size_t threads = 4);
+
+        // Keep a sorted index of the open key's value names and types for
+        // find_prefix/find_range. Built on the first query; a change
+        // notification makes the next query re-enumerate the key, and values
+        // this instance writes or deletes are re-queried one by one
+        void enable_value_index(bool enable);
+
+        // Whether the value index is enabled
+        bool value_index_enabled() const;
+
+        // Values whose name starts with prefix (case-insensitive), O(log n)
+        // once the index is current; empty while the index is disabled
+        index_range find_prefix(std::string_view prefix);
+
+        // Values whose name is in [first, last), case-insensitive
+        index_range find_range(std::string_view first, std::string_view last);
+
+        // Value index counters since the index was enabled
+        index_stats get_index_stats() const;
+
+        // Take the temporaries of calls on this instance from resource
+        // instead of the calling thread's scratch arena; nullptr (the
+        // default) restores the arena. The resource must outlive the instance.
+        void set_memory_resource(std::pmr::memory_resource* resource);
+
+        // Resource set by set_memory_resource(), or nullptr
+        std::pmr::memory_resource* get_memory_resource() const;
+
+        // Queue write_string/write_number/write_obj/delete_value and apply
+        // them from a background thread, last write per name winning;
+        // disabling applies what is queued first
+        void enable_write_behind(bool enable);
+
+        // Whether writes are queued
+        bool write_behind_enabled() const;
+
+        // Durability point: the future becomes ready once every write queued
+        // before the call is applied, true if all of them succeeded
+        std::future<bool> flush();
+
+        // Write-behind counters since write-behind was first enabled
+        write_behind_stats get_write_behind_stats() const;
+
+        // Resumes an awaiting coroutine: called from an executor thread with
+        // the continuation, it should run it on the caller's event loop
+        typedef std::function<void(std::function<void()> continuation)> async_scheduler;
+
+        // Resume coroutines awaiting this instance through scheduler; empty
+        // (the default) resumes them on the executor thread
+        void set_async_scheduler(async_scheduler scheduler);
+
+        // co_await API counters of this instance
+        async_stats get_async_stats() const;
+
+#if REG_API_COROUTINES
+        // Awaitables of the co_await API below, see the end of this file
+        template<typename T>
+            class async_read;
+        class async_status;
+
+        // co_await-able counterparts of the blocking calls. They run on a
+        // small process-wide executor, one instance at a time: operations
+        // awaited together are served by one pass, reads through one
+        // RegQueryMultipleValues (through the cache when it is enabled) and
+        // writes as one batch. Do not call the blocking API while an
+        // operation is pending, and keep the instance alive until all are done.
+        async_read<std::string> async_read_string(std::string_view value_name, std::string default_value = "");
+
+        template<typename T>
+            async_read<T> async_read_number(std::string_view value_name, const T& default_value = T());
+
+        // Writes awaited together share the result of their batch
+        async_status async_write_string(std::string_view value_name, const std::string& value);
+
+        template<typename T>
+            async_status async_write_number(std::string_view value_name, const T& value);
+
+        async_status async_delete_value(std::string_view value_name);
+
+        // read_obj(key, out); out must stay valid until the await completes
+        template<typename T>
+            async_status async_read_obj(std::string_view key, T& out);
+
+        // write_obj() of a copy of t_obj, completing with its result
+        template<typename T>
+            async_status async_write_obj(std::string_view key, const T& t_obj);
+#endif
+
+        // Process-wide operation metrics since the last reset_metrics();
+        // all zero unless built with REG_API_INSTRUMENTATION=1
+        static metrics_snapshot get_metrics();
+
+        // Restart the metrics from zero
+        static void reset_metrics();
+
+        // Name of an operation as used by metrics_snapshot::dump()
+        static const char* op_name(op_kind kind);
+
+        // Number of registry API calls issued by this instance
+        unsigned long long syscall_count() const;
+
+        // Reset the registry API call counter
+        void reset_syscall_count();
+
+        // Function to encode a string to Base64
+        static std::string b64(const std::string& in);
+
+        // Function to decode a Base64 string
+        static std::string b64_d(const std::string& in);
+
+        // Base64 size of in_size bytes, padding included
+        static size_t b64_encoded_size(size_t in_size);
+
+        // Largest number of bytes in_size Base64 characters can decode to
+        static size_t b64_decoded_size(size_t in_size);
+
+        // Encode into out (b64_encoded_size(in_size) bytes); returns bytes written
+        static size_t b64(const char* in, size_t in_size, char* out);
+
+        // Decode into out (b64_decoded_size(in_size) bytes), stopping at the
+        // first character outside the alphabet; returns bytes written
+        static size_t b64_d(const char* in, size_t in_size, char* out);
+
+        // false if the object was not written. An object of at least the
+        // chunking threshold is written as chunks only; a failed chunked
+        // write is not retried as one value
+        template <typename T>
+            bool write_obj(std::string_view key, const T& t_obj);
+
+        template <typename T>
+            T read_obj(std::string_view key);
+
+        // Decode straight into out; false (out unspecified) when the value is
+        // missing, corrupt or was written for another type
+        template <typename T>
+            bool read_obj(std::string_view key, T& out);
+
+        // Read an object once into a view for field access; a raw
+        // REG_BINARY object is queried straight into the view's storage
+        template <typename T>
+            obj_view<T> view_obj(std::string_view key);
+
+        // Read one field of a stored object. Chunked objects fetch only the
+        // chunks holding the field and Base64 text decodes only its groups;
+        // a partial read cannot check the object's CRC, only its type
+        template <typename T, typename M>
+            bool read_field(std::string_view key, M T::* member, M& out);
+
+        // Replace one field of a stored object. Chunked objects rewrite only
+        // the chunks holding the field and fold the change into the manifest
+        // CRC; other formats are rewritten whole, in the format they had
+        template <typename T, typename M>
+            bool write_field(std::string_view key, M T::* member, const M& value);
+ 
+        
+
+    private:
+        HKEY m_h_root_key; // Root key handle
+        HKEY m_h_key;      // Current open key handle
+        std::string m_key_path; // Path of the open key, relative to the root
+        bool m_is_open;    // Flag to indicate if a key is open
+        bool m_key_pooled; // The open key handle belongs to the pool
+        storage_mode m_storage_mode; // Format used by write_number/write_obj
+        float_format m_float_format; // Text format of floating point values
+        obj_format m_obj_format;     // Format used by write_obj
+        size_t m_obj_compression;    // Compress frames from this size; 0 = never
+        std::vector<char> m_frame_buf; // Reused buffer for framed writes
+        size_t m_chunk_threshold;    // Chunk objects from this size; 0 = never
+        size_t m_chunk_size;         // Bytes per chunk
+        enum class chunk_key_state { unknown, absent, present };
+        chunk_key_state m_chunk_key; // Whether the open key has a chunk subkey
+        text_encoding m_text_encoding; // Encoding of names and strings
+
+        // Initial size of the reusable read buffer; most values fit in one query
+        static constexpr DWORD initial_read_buffer_size = 512;
+
+        std::vector<char> m_read_buf;         // Reused buffer for value queries
+        unsigned long long m_syscall_count;   // Registry API calls issued
+
+        // Cached copy of a value, or of its absence
+        struct cached_value
+        {
+            LONG result;
+            DWORD type;
+            std::vector<char> data;
+        };
+
+        bool m_cache_enabled;                                  // Read-through cache switch
+        std::unordered_map<std::string, cached_value> m_cache; // Lower-cased name -> value
+        std::string m_cache_key;                               // Reused lookup key
+        cache_stats m_cache_stats;                             // Cache counters
+        unsigned long m_cache_generation;                      // Generation the cache holds
+        std::atomic<unsigned long> m_change_generation;        // Bumped on every key change
+        std::atomic<bool> m_watch_ok;                          // Notifications are armed
+        HANDLE m_watch_stop;                                   // Signals the watcher to exit
+        std::thread m_watch_thread;                            // Waits for key changes
+
+        std::pmr::memory_resource* m_memory_resource; // Temporaries, or nullptr for the thread arena
+
+        // Resource for the temporaries of one call
+        std::pmr::memory_resource* scratch_resource() const;
+
+        bool m_index_enabled;                       // Value index switch
+        bool m_index_built;                         // m_index describes the open key
+        unsigned long m_index_generation;           // Generation the index was built at
+        std::vector<index_entry> m_index;           // Sorted by compare_names()
+        std::vector<char> m_index_names;            // Storage for the entry names
+        std::vector<std::string> m_index_dirty;     // Names this instance changed since the last refresh
+        index_stats m_index_stats;                  // Index counters
+
+        // Times one public operation and adds it to the calling thread's
+        // metrics shard. Only the outermost operation of a thread counts, so
+        // write_obj is not also counted as write_string or b64. The
+        // disabled specialization is empty and compiles away.
+        template<bool Enabled>
+            class basic_op_scope;
+
+        typedef basic_op_scope<metrics_enabled> op_scope;
+
+        // Add one finished operation to the calling thread's shard
+        static void record_op(op_kind kind, unsigned long long ns, unsigned long long syscalls,
+                              unsigned long long bytes_in, unsigned long long bytes_out);
+
+        // Nesting depth of timed operations on the calling thread
+        static unsigned& op_depth();
+
+        // load() of count null-terminated names
+        snapshot load_names(const char* const* value_names, size_t count);
+
+        // load_names() through RegQueryMultipleValuesW; false if any is missing
+        bool load_names_wide(const char* const* value_names, size_t count, snapshot& result);
+
+        // load_names() with one query per name, leaving out missing values
+        snapshot load_each(const char* const* value_names, size_t count);
+
+        // Copy one schema field out of a snapshot; false if it was
+        // missing or unusable and the default was used
+        template<typename Field>
+            static bool load_field(const snapshot& values, const Field& field, typename Field::settings_type& settings);
+
+        // Queue one schema field in a batch with its declared registry type
+        template<typename Field>
+            bool store_field(batch& pending, const Field& field, const typename Field::settings_type& settings) const;
+
+        // The writes queued in pending as a snapshot, for sync()
+        static snapshot queued_values(const batch& pending);
+
+        // load_all() for an explicit handle, buffer and counter
+        static snapshot load_key(HKEY h_key, std::vector<char>& buffer, unsigned long long& calls,
+                                 text_encoding encoding = text_encoding::ansi);
+
+        // Append the values of h_key and, recursively, its subkeys to an
+        // export; relative_path is the path of h_key inside the export
+        struct tree_export;
+        bool collect_tree(HKEY h_key, const std::string& relative_path, tree_export& out);
+
+        // Walker state for walk(), see reg_api.cpp
+        struct tree_walk;
+
+        // Keys read by prefetch() and not yet taken by chroot(), see reg_api.cpp
+        struct prefetch_state;
+        std::shared_ptr<prefetch_state> m_prefetch;
+
+        // Make a prefetched key the open key; false if key_path was not
+        // prefetched or could not be opened
+        bool adopt_prefetched(const std::string& key_path);
+
+        // Lock-free write-behind queue and its thread, see reg_api.cpp
+        struct write_behind_queue;
+        std::unique_ptr<write_behind_queue> m_write_behind; // Created on first enable
+
+        // Queue a write (or delete when data is null) of the open key
+        void queue_write(std::string_view value_name, DWORD type, const void* data, DWORD data_size);
+
+        // One awaited operation, queued by an awaitable that lives in the
+        // suspended coroutine; the executor fills in the result and resumes it
+        struct async_request
+        {
+            enum class kind
+            {
+                read,   // name; result in values
+                write,  // name, is_delete, type and data; result in ok
+                call    // invoke; result in ok
+            };
+
+            kind op = kind::read;
+            std::string name;
+            bool is_delete = false;
+            DWORD type = REG_NONE;
+            std::vector<char> data;
+            std::function<bool()> invoke;
+            bool ok = false;
+            std::shared_ptr<const snapshot> values; // Shared by the reads of one pass
+            void (*resume)(void* address) = nullptr;
+            void* address = nullptr;                // Of the coroutine handle
+        };
+
+        // Pins the calling thread's reclamation epoch, see reg_epoch.h
+        typedef reg_epoch::guard epoch_guard;
+
+        // Operations waiting for the executor, see reg_api.cpp
+        struct async_strand;
+        std::shared_ptr<async_strand> m_async; // Created on first await
+
+        // Queue request; it is resumed from the executor once done
+        void submit_async(async_request& request);
+
+        // Serve the queued operations until none is left
+        void drain_async();
+
+        // Serve one pass of operations, in order
+        void run_async(const std::vector<async_request*>& requests);
+
+        // Pooled key handle, keyed by (root, lower-cased path, access mask)
+        struct pool_entry
+        {
+            HKEY h_root_key;
+            std::string key_path;
+            REGSAM sam;
+            HKEY h_key;
+            size_t refs;                  // Users of the handle (chroot, key views)
+            unsigned long long last_used; // LRU tick
+        };
+
+        size_t m_pool_capacity;           // Idle handles kept open; 0 disables pooling
+        std::vector<pool_entry> m_pool;   // Flat LRU pool; it stays small
+        unsigned long long m_pool_tick;   // LRU clock
+        pool_stats m_pool_stats;          // Pool counters
+
+        // Registered watch, see reg_api.cpp
+        struct watch_entry;
+        std::unordered_map<unsigned long long, std::unique_ptr<watch_entry>> m_watches;
+        unsigned long long m_next_watch_id;
+
+        std::string m_machine_name; // Remote machine; m_h_root_key is its pooled connection
+
+        // Open an existing key with sam (KEY_READ by default) as the current
+        // key; never creates it
+        bool open_read_only(const std::string& key_path, REGSAM sam = KEY_READ);
+
+        // Open or create a key, through the pool when it is enabled
+        LONG acquire_key(const std::string& key_path, HKEY& h_key, bool& pooled,
+                         DWORD options = REG_OPTION_NON_VOLATILE);
+
+        // Release a handle from acquire_key()
+        void release_key(HKEY h_key, bool pooled);
+
+        // Open a key, creating it when it does not exist
+        LONG open_registry(HKEY h_root_key, const char* key_path, REGSAM sam, HKEY& h_key,
+                           DWORD options = REG_OPTION_NON_VOLATILE);
+
+        // open_registry() counting into an explicit counter
+        static LONG open_or_create(HKEY h_root_key, const char* key_path, REGSAM sam, HKEY& h_key,
+                                   unsigned long long& calls, text_encoding encoding = text_encoding::ansi,
+                                   DWORD options = REG_OPTION_NON_VOLATILE);
+
+        // Counted RegSetValueExA / RegDeleteValueA on an explicit handle
+        LONG set_registry(HKEY h_key, const char* value_name, DWORD type, const void* data, DWORD data_size);
+        LONG delete_registry(HKEY h_key, const char* value_name);
+
+        // Null-terminated copy of a name for the ANSI API; stays on the stack
+        // unless the name is unusually long
+        class c_name
+        {
+            public:
+                explicit c_name(std::string_view name);
+
+                const char* c_str() const
+                {
+                    return m_ptr;
+                }
+
+            private:
+                char m_small[256];
+                std::string m_large;
+                const char* m_ptr;
+        };
+
+        // Query a value through the cache when it is enabled
+        LONG query_value(std::string_view value_name, DWORD& type, DWORD& data_size);
+
+        // Query a value into m_read_buf, growing it only on ERROR_MORE_DATA
+        LONG query_registry(HKEY h_key, const char* value_name, DWORD& type, DWORD& data_size);
+
+        // query_registry() into an explicit buffer and counter
+        static LONG query_buffer(HKEY h_key, const char* value_name, std::vector<char>& buffer,
+                                 DWORD& type, DWORD& data_size, unsigned long long& calls,
+                                 text_encoding encoding = text_encoding::ansi);
+
+        // Drop the cached entry of a value this instance modified
+        void invalidate_cached(std::string_view value_name);
+
+        // Bring the value index up to date before a query
+        void refresh_index();
+        void rebuild_index();
+        void patch_index(const std::string& value_name);
+
+        // First index entry not ordered before name
+        std::vector<index_entry>::iterator index_lower_bound(std::string_view name);
+
+        // Start/stop the background RegNotifyChangeKeyValue wait on m_h_key
+        void start_watcher();
+        void stop_watcher();
+
+        // Write raw bytes with an explicit registry type
+        bool set_value(std::string_view value_name, DWORD type, const void* data, DWORD data_size);
+
+        // Encode a number per the storage mode and float format into out
+        // (number_buffer_size bytes); returns the type, REG_NONE on failure
+        template<typename T>
+            DWORD encode_number(const T& value, char* out, DWORD& data_size) const;
+
+        // encode_number() for an explicit storage mode and float format
+        template<typename T>
+            static DWORD encode_number(const T& value, storage_mode mode, float_format format, char* out, DWORD& data_size);
+
+        // Native encoding of a number into out (at least 8 bytes); returns the type
+        template<typename T>
+            static DWORD encode_native(const T& value, unsigned char* out, DWORD& data_size);
+
+        // Decode a stored object of any supported encoding; throws on mismatch
+        template <typename T>
+            static T decode_obj(std::string_view key, DWORD type, const char* data, DWORD data_size);
+
+        // Decode into out; returns null, or the error message prefix
+        template <typename T>
+            static const char* decode_obj_into(DWORD type, const char* data, DWORD data_size, T& out);
+
+        // Byte offset of a data member inside T
+        template <typename T, typename M>
+            static size_t member_offset(M T::* member);
+
+        // Read a whole object of obj_size bytes into out; error prefix or null
+        const char* read_obj_bytes(std::string_view key, uint32_t type_id, void* out, size_t obj_size);
+
+        // Bytes [offset, offset + size) of a stored object
+        bool read_obj_range(std::string_view key, uint32_t type_id, size_t obj_size,
+                            size_t offset, void* out, size_t size);
+        bool write_obj_range(std::string_view key, uint32_t type_id, size_t obj_size,
+                             size_t offset, const void* data, size_t size);
+
+        // Hash identifying T in frames, from inputs that are the same in
+        // every build: reg_obj_tag, size, alignment, reg_obj_version and the
+        // fields of reg_obj_layout when T has one
+        template <typename T>
+            static uint32_t obj_type_id();
+
+        static uint32_t obj_type_hash(const char* tag, size_t size, size_t align, unsigned version);
+
+        // Fold offset, size and kind of one field into hash
+        template <typename T, typename M>
+            static uint32_t obj_field_hash(uint32_t hash, M T::* member);
+
+        // Kind of a field type: bool, floating, signed, unsigned, enum,
+        // pointer, array or class
+        template <typename M>
+            static constexpr unsigned obj_field_kind();
+
+        // FNV-1a of size bytes, continuing from hash
+        static uint32_t hash_bytes(uint32_t hash, const void* data, size_t size);
+
+        // Whether reg_obj_layout<T> lists fields
+        template <typename T, typename = void>
+            struct has_obj_layout : std::false_type {};
+        template <typename T>
+            struct has_obj_layout<T, std::void_t<decltype(reg_obj_layout<T>::fields)>> : std::true_type {};
+
+        // Build the frame of an object in m_frame_buf; returns its size
+        DWORD encode_framed(const void* obj, size_t obj_size, uint32_t type_id);
+
+        // Whether REG_BINARY data holds a frame
+        static bool is_framed(const char* data, DWORD data_size);
+
+        // Check and unpack a frame into out (out_size bytes)
+        static const char* decode_framed(const char* data, DWORD data_size, uint32_t type_id, void* out, size_t out_size);
+
+        // Decode Base64 text of exactly out_size bytes into out
+        static const char* decode_b64_into(const char* data, DWORD data_size, void* out, size_t out_size);
+
+        // Subkey of the open key holding the chunks of a value
+        static std::string chunk_key_path(std::string_view value_name);
+
+        // Whether write_obj chunks an object of obj_size bytes under
+        // value_name; chunk subkeys are named after the value
+        bool chunks_obj(std::string_view value_name, size_t obj_size) const;
+
+        // Write an object as chunks and a manifest; false if a write failed
+        bool write_chunked(std::string_view value_name, const void* obj, size_t obj_size, uint32_t type_id);
+
+        // Whether value_name may hold a chunk manifest: the open key has a
+        // chunk subkey. Probed once per open key
+        bool may_be_chunked(std::string_view value_name);
+
+        // Whether REG_BINARY data holds a chunk manifest
+        static bool is_chunked(const char* data, DWORD data_size);
+
+        // Read the chunks of the manifest in m_read_buf (data_size bytes) in
+        // parallel straight into out; returns null or the error prefix
+        const char* read_chunked(std::string_view value_name, DWORD data_size, uint32_t type_id, void* out, size_t out_size);
+
+        // CRC-32C, with SSE4.2 when the CPU has it
+        static uint32_t crc32c(const void* data, size_t size);
+
+        // Decode string data up to its first terminator
+        static std::string decode_string(const char* data, DWORD data_size);
+
+        // Case-insensitive ordering of value names, as the registry compares them
+        static int compare_names(const char* a, size_t a_size, const char* b, size_t b_size);
+
+        // Decode a queried value of any supported encoding into a number
+        template<typename T>
+            static bool decode_number(DWORD type, const char* data, DWORD data_size, T& out);
+
+
+};
+
+template<>
+class reg_api::basic_op_scope<true>
+{
+    public:
+        explicit basic_op_scope(op_kind kind, const unsigned long long* syscalls = nullptr)
+            : m_kind(kind)
+            , m_syscalls(syscalls)
+            , m_syscalls_start(syscalls != nullptr ? *syscalls : 0)
+            , m_bytes_in(0)
+            , m_bytes_out(0)
+            , m_outermost(op_depth()++ == 0)
+            , m_start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~basic_op_scope()
+        {
+            --op_depth();
+            if (!m_outermost)
+            {
+                return;
+            }
+            
+            std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - m_start;
+            record_op(m_kind,
+                      static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+                      m_syscalls != nullptr ? *m_syscalls - m_syscalls_start : 0,
+                      m_bytes_in, m_bytes_out);
+        }
+
+        basic_op_scope(const basic_op_scope&) = delete;
+        basic_op_scope& operator=(const basic_op_scope&) = delete;
+
+        void bytes_in(size_t size)
+        {
+            m_bytes_in += size;
+        }
+
+        void bytes_out(size_t size)
+        {
+            m_bytes_out += size;
+        }
+
+    private:
+        op_kind m_kind;
+        const unsigned long long* m_syscalls; // Counter of the instance, if any
+        unsigned long long m_syscalls_start;
+        unsigned long long m_bytes_in;
+        unsigned long long m_bytes_out;
+        bool m_outermost;
+        std::chrono::steady_clock::time_point m_start;
+};
+
+template<typename Access>
+class reg_api::basic_reader
+{
+    public:
+        explicit basic_reader(HKEY h_root_key = HKEY_CURRENT_USER)
+            : m_api(h_root_key)
+        {
+        }
+
+        // Read the registry of another machine, see reg_api
+        explicit basic_reader(const std::string& machine_name, HKEY h_root_key = HKEY_LOCAL_MACHINE)
+            : m_api(machine_name, h_root_key)
+        {
+        }
+
+        // Open an existing key; false if it is missing or cannot be read
+        bool chroot(const std::string& key_path)
+        {
+            return m_api.open_read_only(key_path, Access::sam);
+        }
+
+        void close()
+        {
+            m_api.close();
+        }
+
+        bool is_open() const
+        {
+            return m_api.m_is_open;
+        }
+
+        std::string read_string(std::string_view value_name, const std::string& default_value = "")
+        {
+            return m_api.read_string(value_name, default_value);
+        }
+
+        bool read_into(std::string_view value_name, std::string& out)
+        {
+            return m_api.read_into(value_name, out);
+        }
+
+        bool read_into(std::string_view value_name, char* buffer, size_t capacity, size_t* length = nullptr)
+        {
+            return m_api.read_into(value_name, buffer, capacity, length);
+        }
+
+        template<typename T>
+            T read_number(std::string_view value_name, const T& default_value = T())
+        {
+            return m_api.read_number(value_name, default_value);
+        }
+
+        template<typename T>
+            bool read_obj(std::string_view key, T& out)
+        {
+            return m_api.read_obj(key, out);
+        }
+
+        template<typename T, typename M>
+            bool read_field(std::string_view key, M T::* member, M& out)
+        {
+            return m_api.read_field(key, member, out);
+        }
+
+        bool value_exists(std::string_view value_name)
+        {
+            return m_api.value_exists(value_name);
+        }
+
+        snapshot load_all()
+        {
+            return m_api.load_all();
+        }
+
+        snapshot load(const std::vector<std::string>& value_names)
+        {
+            return m_api.load(value_names);
+        }
+
+        template<typename... Fields>
+            bool load(const reg_schema<Fields...>& schema, typename reg_schema<Fields...>::settings_type& settings)
+        {
+            return m_api.load(schema, settings);
+        }
+
+        std::vector<std::string> subkey_names(const std::string& key_path = "")
+        {
+            return m_api.subkey_names(key_path);
+        }
+
+        void enable_cache(bool enable)
+        {
+            m_api.enable_cache(enable);
+        }
+
+        cache_stats get_cache_stats() const
+        {
+            return m_api.get_cache_stats();
+        }
+
+        void set_text_encoding(text_encoding encoding)
+        {
+            m_api.set_text_encoding(encoding);
+        }
+
+        unsigned long long syscall_count() const
+        {
+            return m_api.syscall_count();
+        }
+
+    private:
+        reg_api m_api; // Only ever opened through open_read_only()
+};
+
+#if REG_API_COROUTINES
+// Awaitable of writes and object calls, and the base of async_read: queues
+// the request once the coroutine is suspended. The executor may resume the coroutine before await_suspend()
+// returns, so nothing is touched after submitting.
+class reg_api::async_status
+{
+    public:
+        async_status(reg_api& owner)
+            : m_owner(&owner)
+        {
+        }
+
+        async_status(async_status&&) = default;
+        async_status& operator=(const async_status&) = delete;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> continuation)
+        {
+            m_request.resume = &resume_handle;
+            m_request.address = continuation.address();
+            m_owner->submit_async(m_request);
+        }
+
+        bool await_resume()
+        {
+            return m_request.ok;
+        }
+
+    protected:
+        friend class reg_api;
+
+        static void resume_handle(void* address)
+        {
+            std::coroutine_handle<>::from_address(address).resume();
+        }
+
+        reg_api* m_owner;
+        async_request m_request;
+};
+
+// Awaitable of a value read, decoded like the blocking readers
+template<typename T>
+class reg_api::async_read : public reg_api::async_status
+{
+    public:
+        async_read(reg_api& owner, std::string_view value_name, T default_value)
+            : async_status(owner)
+            , m_default(std::move(default_value))
+        {
+            m_request.op = async_request::kind::read;
+            m_request.name.assign(value_name);
+        }
+
+        T await_resume()
+        {
+            if (!m_request.values)
+            {
+                return std::move(m_default);
+            }
+            if constexpr (std::is_same<T, std::string>::value)
+            {
+                return m_request.values->read_string(m_request.name, m_default);
+            }
+            else
+            {
+                return m_request.values->read_number<T>(m_request.name, m_default);
+            }
+        }
+
+    private:
+        T m_default;
+};
+#endif
+
+template<>
+class reg_api::basic_op_scope<false>
+{
+    public:
+        explicit basic_op_scope(op_kind, const unsigned long long* = nullptr)
+        {
+        }
+
+        void bytes_in(size_t)
+        {
+        }
+
+        void bytes_out(size_t)
+        {
+        }
+};
+
+// Template implementation for number formatting
+template<typename T>
+size_t reg_api::format_number(const T& value, float_format format, char* buffer, size_t size)
+{
+    if constexpr (std::is_same<T, bool>::value)
+    {
+        if (size == 0)
+        {
+            return 0;
+        }
+        buffer[0] = value ? '1' : '0';
+        return 1;
+    }
+    else if constexpr (std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+                       std::is_same<T, unsigned char>::value)
+    {
+        // Character types have always been stored as the character itself
+        if (size == 0)
+        {
+            return 0;
+        }
+        buffer[0] = static_cast<char>(value);
+        return 1;
+    }
+    else if constexpr (std::is_integral<T>::value)
+    {
+        std::to_chars_result result = std::to_chars(buffer, buffer + size, value);
+        return (result.ec == std::errc()) ? static_cast<size_t>(result.ptr - buffer) : 0;
+    }
+    else
+    {
+        if (format == float_format::fixed5)
+        {
+            std::to_chars_result result = std::to_chars(buffer, buffer + size, value, std::chars_format::fixed, 5);
+            if (result.ec == std::errc())
+            {
+                size_t length = static_cast<size_t>(result.ptr - buffer);
+                
+                // Trim trailing zeros after decimal point
+                if (memchr(buffer, '.', length) != nullptr)
+                {
+                    while (buffer[length - 1] == '0')
+                    {
+                        --length;
+                    }
+                    if (buffer[length - 1] == '.')
+                    {
+                        --length;
+                    }
+                }
+                return length;
+            }
+        }
+        
+        // Shortest round-trip form; also used when fixed notation does not fit
+        std::to_chars_result result = std::to_chars(buffer, buffer + size, value);
+        return (result.ec == std::errc()) ? static_cast<size_t>(result.ptr - buffer) : 0;
+    }
+}
+
+// Template implementation for number parsing
+template<typename T>
+bool reg_api::parse_number(const char* first, const char* last, T& out)
+{
+    // Skip leading whitespace as stream extraction used to
+    while (first != last && isspace(static_cast<unsigned char>(*first)))
+    {
+        ++first;
+    }
+    
+    if (first == last)
+    {
+        return false;
+    }
+    
+    if constexpr (std::is_same<T, bool>::value)
+    {
+        unsigned int flag = 0;
+        std::from_chars_result result = std::from_chars(first, last, flag);
+        if (result.ec != std::errc() || flag > 1)
+        {
+            return false;
+        }
+        out = (flag == 1);
+        return true;
+    }
+    else if constexpr (std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+                       std::is_same<T, unsigned char>::value)
+    {
+        out = static_cast<T>(*first);
+        return true;
+    }
+    else
+    {
+        if (*first == '+')
+        {
+            ++first;
+        }
+        
+        T parsed = T();
+        std::from_chars_result result = std::from_chars(first, last, parsed);
+        if (result.ec != std::errc())
+        {
+            return false;
+        }
+        out = parsed;
+        return true;
+    }
+}
+
+// Template implementation for native number encoding
+template<typename T>
+DWORD reg_api::encode_native(const T& value, unsigned char* out, DWORD& data_size)
+{
+    if constexpr (std::is_integral<T>::value && sizeof(T) <= sizeof(uint32_t))
+    {
+        uint32_t raw = static_cast<uint32_t>(value);
+        memcpy(out, &raw, sizeof(raw));
+        data_size = sizeof(raw);
+        return REG_DWORD;
+    }
+    else if constexpr (std::is_integral<T>::value)
+    {
+        uint64_t raw = static_cast<uint64_t>(value);
+        memcpy(out, &raw, sizeof(raw));
+        data_size = sizeof(raw);
+        return REG_QWORD;
+    }
+    else
+    {
+        // Floating point keeps its exact bit pattern
+        memcpy(out, &value, sizeof(T));
+        data_size = static_cast<DWORD>(sizeof(T));
+        return REG_BINARY;
+    }
+}
+
+// Template implementation for decoding a queried numeric value
+template<typename T>
+bool reg_api::decode_number(DWORD type, const char* data, DWORD data_size, T& out)
+{
+    if (type == REG_DWORD && data_size == sizeof(uint32_t))
+    {
+        uint32_t raw;
+        memcpy(&raw, data, sizeof(raw));
+        
+        // Sign-extend when the target is signed so negative values round-trip
+        if constexpr (std::is_signed<T>::value)
+        {
+            out = static_cast<T>(static_cast<int32_t>(raw));
+        }
+        else
+        {
+            out = static_cast<T>(raw);
+        }
+        return true;
+    }
+    
+    if (type == REG_QWORD && data_size == sizeof(uint64_t))
+    {
+        uint64_t raw;
+        memcpy(&raw, data, sizeof(raw));
+        
+        if constexpr (std::is_signed<T>::value)
+        {
+            out = static_cast<T>(static_cast<int64_t>(raw));
+        }
+        else
+        {
+            out = static_cast<T>(raw);
+        }
+        return true;
+    }
+    
+    if (type == REG_BINARY && data_size == sizeof(T))
+    {
+        memcpy(&out, data, sizeof(T));
+        return true;
+    }
+    
+    if (type == REG_SZ || type == REG_EXPAND_SZ)
+    {
+        // Legacy text encoding; stop at the first terminator
+        return parse_number<T>(data, data + strnlen(data, data_size), out);
+    }
+    
+    return false;
+}
+
+// Template implementation for reading numeric value
+template<typename T>
+T reg_api::read_number(std::string_view value_name, const T& default_value)
+{
+    if (!m_is_open)
+    {
+        return default_value;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    
+    if (query_value(value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return default_value;
+    }
+    
+    // Accept both native and string encodings regardless of storage mode
+    T result = default_value;
+    if (!decode_number<T>(type, m_read_buf.data(), data_size, result))
+    {
+        return default_value;
+    }
+    
+    return result;
+}
+
+// Template implementation for writing numeric value
+template<typename T>
+bool reg_api::write_number(std::string_view value_name, const T& value)
+{
+    char data[number_buffer_size];
+    DWORD data_size = 0;
+    DWORD type = encode_number<T>(value, data, data_size);
+    if (type == REG_NONE)
+    {
+        return false;
+    }
+    
+    return set_value(value_name, type, data, data_size);
+}
+
+// Template implementation for encoding a number as write_number stores it
+template<typename T>
+DWORD reg_api::encode_number(const T& value, char* out, DWORD& data_size) const
+{
+    return encode_number<T>(value, m_storage_mode, m_float_format, out, data_size);
+}
+
+template<typename T>
+DWORD reg_api::encode_number(const T& value, storage_mode mode, float_format format, char* out, DWORD& data_size)
+{
+    if (mode == storage_mode::native)
+    {
+        static_assert(sizeof(T) <= number_buffer_size, "number type too large");
+        return encode_native<T>(value, reinterpret_cast<unsigned char*>(out), data_size);
+    }
+    
+    // Convert number to text with its terminator
+    size_t length = format_number<T>(value, format, out, number_buffer_size - 1);
+    if (length == 0)
+    {
+        return REG_NONE;
+    }
+    out[length] = '\0';
+    
+    data_size = static_cast<DWORD>(length + 1);
+    return REG_SZ;
+}
+
+// Write pointer value to registry
+template<typename T>
+bool reg_api::write_pointer(std::string_view value_name, T* ptr)
+{
+    if (!m_is_open || ptr == nullptr)
+    {
+        return false;
+    }
+
+    // Get current process ID
+    DWORD current_pid = GetCurrentProcessId();
+
+    // Convert pointer address to "<hex address>_<pid>"
+    char text[64];
+    char* end = std::to_chars(text, text + sizeof(text), reinterpret_cast<uintptr_t>(ptr), 16).ptr;
+    *end++ = '_';
+    end = std::to_chars(end, text + sizeof(text) - 1, current_pid).ptr;
+    *end++ = '\0';
+
+    // Write as string
+    return set_value(value_name, REG_SZ, text, static_cast<DWORD>(end - text));
+}
+
+// Read pointer value from registry with default value
+template<typename T>
+T* reg_api::read_pointer(std::string_view value_name, T* default_value)
+{
+    if (!m_is_open)
+    {
+        return default_value;
+    }
+    
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (query_value(value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return default_value;
+    }
+    
+    const char* first = m_read_buf.data();
+    const char* last = first + strnlen(first, data_size);
+    
+    // Parse the pointer value and process ID
+    const char* separator = static_cast<const char*>(memchr(first, '_', static_cast<size_t>(last - first)));
+    if (separator == nullptr)
+    {
+        return default_value;
+    }
+    
+    // Convert string to pointer and process ID
+    uintptr_t ptr_val = 0;
+    DWORD stored_pid = 0;
+    
+    std::from_chars_result ptr_result = std::from_chars(first, separator, ptr_val, 16);
+    std::from_chars_result pid_result = std::from_chars(separator + 1, last, stored_pid);
+    
+    if (ptr_result.ec != std::errc() || pid_result.ec != std::errc())
+    {
+        return default_value;
+    }
+    
+    // Get current process ID for validation
+    DWORD current_pid = GetCurrentProcessId();
+    
+    // Validate process ID
+    if (current_pid != stored_pid)
+    {
+        // Process ID mismatch - pointer is from a different process
+        std::cerr << "error, not the same PID, stored PID: " << stored_pid 
+                  << ", current PID: " << current_pid << std::endl;
+        return default_value;
+    }
+    
+    return reinterpret_cast<T*>(ptr_val);
+}
+
+ template <typename T>
+    bool reg_api::write_obj(std::string_view key, const T& t_obj)
+    {
+        op_scope scope(op_kind::write_obj, &m_syscall_count);
+        scope.bytes_in(sizeof(T));
+
+        // Large objects are streamed to the registry chunk by chunk
+        if (chunks_obj(key, sizeof(T)))
+        {
+            return write_chunked(key, &t_obj, sizeof(T), obj_type_id<T>());
+        }
+
+        if (m_obj_format == obj_format::framed)
+        {
+            DWORD frame_size = encode_framed(&t_obj, sizeof(T), obj_type_id<T>());
+            return set_value(key, REG_BINARY, m_frame_buf.data(), frame_size);
+        }
+
+        if (m_storage_mode == storage_mode::native)
+        {
+            // Store the raw object bytes directly
+            return set_value(key, REG_BINARY, &t_obj, static_cast<DWORD>(sizeof(T)));
+        }
+
+        // 1. Encode the object bytes to Base64 in scratch memory.
+        scratch_scope scratch;
+        const char* p = reinterpret_cast<const char*>(&t_obj);
+        std::pmr::vector<char> encoded(b64_encoded_size(sizeof(T)) + 1, scratch_resource());
+        size_t written = b64(p, sizeof(T), encoded.data());
+        encoded[written] = '\0';
+
+        // 2. Write the encoded string, with its terminator, to the registry.
+        return set_value(key, REG_SZ, encoded.data(), static_cast<DWORD>(written + 1));
+    }
+
+    /**
+     * @brief Reads data from the registry, decodes it, and returns a new POD object.
+     * @tparam T The type of the object to read.
+     * @param key The registry key to read from.
+     * @return The deserialized object of type T.
+     * @throws std::runtime_error if the key is not found or data is corrupted.
+     */
+    template <typename T>
+    T reg_api::read_obj(std::string_view key)
+    {
+        op_scope scope(op_kind::read_obj, &m_syscall_count);
+
+        // 1. Read the stored value from the registry.
+        DWORD type = REG_NONE;
+        DWORD data_size = 0;
+        if (!m_is_open || query_value(key, type, data_size) != ERROR_SUCCESS)
+        {
+            throw std::runtime_error("Key not found in registry: " + std::string(key));
+        }
+
+        // 2. Reassemble a chunked object in place.
+        if (type == REG_BINARY && is_chunked(m_read_buf.data(), data_size))
+        {
+            T t_obj;
+            const char* error = read_chunked(key, data_size, obj_type_id<T>(), &t_obj, sizeof(T));
+            if (error != nullptr)
+            {
+                throw std::runtime_error(error + std::string(key));
+            }
+            scope.bytes_out(sizeof(T));
+            return t_obj;
+        }
+
+        // 3. Decode whichever other encoding was stored.
+        T t_obj = decode_obj<T>(key, type, m_read_buf.data(), data_size);
+        scope.bytes_out(sizeof(T));
+        return t_obj;
+    }
+
+    // Read an object without throwing, decoding into the destination
+    template <typename T>
+    bool reg_api::read_obj(std::string_view key, T& out)
+    {
+        op_scope scope(op_kind::read_obj, &m_syscall_count);
+
+        DWORD type = REG_NONE;
+        DWORD data_size = 0;
+        if (!m_is_open || query_value(key, type, data_size) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+
+        bool ok = (type == REG_BINARY && is_chunked(m_read_buf.data(), data_size))
+            ? read_chunked(key, data_size, obj_type_id<T>(), &out, sizeof(T)) == nullptr
+            : decode_obj_into<T>(type, m_read_buf.data(), data_size, out) == nullptr;
+
+        if (ok)
+        {
+            scope.bytes_out(sizeof(T));
+        }
+        return ok;
+    }
+
+    // Decode a stored object from its framed, native or Base64 encoding
+    template <typename T>
+    T reg_api::decode_obj(std::string_view key, DWORD type, const char* data, DWORD data_size)
+    {
+        T t_obj;
+        const char* error = decode_obj_into<T>(type, data, data_size, t_obj);
+        if (error != nullptr)
+        {
+            throw std::runtime_error(error + std::string(key));
+        }
+        return t_obj;
+    }
+
+    template <typename T>
+    const char* reg_api::decode_obj_into(DWORD type, const char* data, DWORD data_size, T& out)
+    {
+        if (type == REG_BINARY && is_framed(data, data_size))
+        {
+            return decode_framed(data, data_size, obj_type_id<T>(), &out, sizeof(T));
+        }
+
+        // The chunks live in the registry, not in the data given here
+        if (type == REG_BINARY && is_chunked(data, data_size))
+        {
+            return "Chunked object must be read with reg_api::read_obj for key: ";
+        }
+
+        // Native encoding: the payload is the object itself
+        if (type == REG_BINARY)
+        {
+            if (data_size != sizeof(T))
+            {
+                return "Data size mismatch for key: ";
+            }
+
+            memcpy(&out, data, sizeof(T));
+            return nullptr;
+        }
+
+        return decode_b64_into(data, data_size, &out, sizeof(T));
+    }
 
-        // Write numeric value (template function)
-        template<typename T>
-            bool write_number(const std::string& value_name, const T& value);
+    template <typename T>
+    uint32_t reg_api::obj_type_id()
+    {
+        static const uint32_t id = []()
+        {
+            uint32_t hash = obj_type_hash(reg_obj_tag<T>::value, sizeof(T), alignof(T), reg_obj_version<T>::value);
+            if constexpr (has_obj_layout<T>::value)
+            {
+                std::apply([&hash](auto... fields)
+                {
+                    ((hash = obj_field_hash(hash, fields)), ...);
+                }, reg_obj_layout<T>::fields);
+            }
+            return hash;
+        }();
+        return id;
+    }
 
-        template<typename T>
-            bool write_pointer(const std::string& value_name, T* ptr);
+    template <typename T, typename M>
+    uint32_t reg_api::obj_field_hash(uint32_t hash, M T::* member)
+    {
+        const uint64_t facts[3] = { member_offset(member), sizeof(M), obj_field_kind<M>() };
+        return hash_bytes(hash, facts, sizeof(facts));
+    }
 
-        template<typename T>
-            T* read_pointer(const std::string& value_name, T* default_value = nullptr);
+    template <typename M>
+    constexpr unsigned reg_api::obj_field_kind()
+    {
+        return std::is_same<M, bool>::value ? 1
+             : std::is_floating_point<M>::value ? 2
+             : std::is_integral<M>::value && std::is_signed<M>::value ? 3
+             : std::is_integral<M>::value ? 4
+             : std::is_enum<M>::value ? 5
+             : std::is_pointer<M>::value ? 6
+             : std::is_array<M>::value ? 7
+             : 8;
+    }
 
-        // Read string value with default value
-        std::string read_string(const std::string& value_name, const std::string& default_value = "");
+    template <typename T, typename M>
+    size_t reg_api::member_offset(M T::* member)
+    {
+        // A member pointer has no portable offset; measure it on storage
+        // laid out like a T
+        alignas(T) static const unsigned char probe[sizeof(T)] = {};
+        const T* object = reinterpret_cast<const T*>(probe);
+        return static_cast<size_t>(reinterpret_cast<const unsigned char*>(&(object->*member)) - probe);
+    }
 
-        // Write string value
-        bool write_string(const std::string& value_name, const std::string& value);
+    template <typename T>
+    reg_api::obj_view<T> reg_api::view_obj(std::string_view key)
+    {
+        obj_view<T> view;
+        view.m_owner = this;
+        view.m_key.assign(key);
+        view.reload();
+        return view;
+    }
 
-        // Check if a value exists
-        bool value_exists(const std::string& value_name);
+    template <typename T, typename M>
+    bool reg_api::read_field(std::string_view key, M T::* member, M& out)
+    {
+        static_assert(std::is_trivially_copyable<M>::value, "fields are copied byte for byte");
+        op_scope scope(op_kind::read_obj, &m_syscall_count);
 
-        // Delete a value
-        bool delete_value(const std::string& value_name);
+        bool ok = read_obj_range(key, obj_type_id<T>(), sizeof(T), member_offset(member), &out, sizeof(M));
+        if (ok)
+        {
+            scope.bytes_out(sizeof(M));
+        }
+        return ok;
+    }
 
-        // Function to encode a string to Base64
-        std::string b64(const std::string& in);
+    template <typename T, typename M>
+    bool reg_api::write_field(std::string_view key, M T::* member, const M& value)
+    {
+        static_assert(std::is_trivially_copyable<M>::value, "fields are copied byte for byte");
+        op_scope scope(op_kind::write_obj, &m_syscall_count);
+        scope.bytes_in(sizeof(M));
 
-        // Function to decode a Base64 string
-        std::string b64_d(const std::string& in);
+        return write_obj_range(key, obj_type_id<T>(), sizeof(T), member_offset(member), &value, sizeof(M));
+    }
 
-        template <typename T>
-            void write_obj(const std::string& key, const T& t_obj);
+    template <typename T>
+    reg_api::obj_view<T>::obj_view()
+        : m_owner(nullptr)
+        , m_object(new storage())
+        , m_valid(false)
+    {
+    }
 
-        template <typename T>
-            T read_obj(const std::string& key);
- 
-        
+    template <typename T>
+    bool reg_api::obj_view<T>::is_valid() const
+    {
+        return m_valid;
+    }
 
-    private:
-        HKEY m_h_root_key; // Root key handle
-        HKEY m_h_key;      // Current open key handle
-        bool m_is_open;    // Flag to indicate if a key is open
+    template <typename T>
+    const T& reg_api::obj_view<T>::get() const
+    {
+        return *reinterpret_cast<const T*>(m_object->bytes);
+    }
 
-        // Helper function to convert number to string with max 5 decimal places
-        template<typename T>
-            std::string number_to_string(const T& value);
+    template <typename T>
+    const T* reg_api::obj_view<T>::operator->() const
+    {
+        return reinterpret_cast<const T*>(m_object->bytes);
+    }
 
-        // Helper function to convert string to number
-        template<typename T>
-            T string_to_number(const std::string& str, const T& default_val);
+    template <typename T>
+    template <typename M>
+    const M& reg_api::obj_view<T>::get(M T::* member) const
+    {
+        return get().*member;
+    }
 
+    template <typename T>
+    bool reg_api::obj_view<T>::reload()
+    {
+        if (m_owner == nullptr)
+        {
+            return false;
+        }
 
-        // The Base64 character set
-        const std::string base64_chars =
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "abcdefghijklmnopqrstuvwxyz"
-            "0123456789+/";
+        op_scope scope(op_kind::read_obj, &m_owner->m_syscall_count);
+        m_valid = m_owner->read_obj_bytes(m_key, obj_type_id<T>(), m_object->bytes, sizeof(T)) == nullptr;
+        if (m_valid)
+        {
+            scope.bytes_out(sizeof(T));
+        }
+        else
+        {
+            memset(m_object->bytes, 0, sizeof(T));
+        }
+        return m_valid;
+    }
 
-        // Function to check if a character is a valid Base64 character
-        inline bool is_base64(unsigned char c)
+    template <typename T>
+    template <typename M>
+    bool reg_api::obj_view<T>::set(M T::* member, const M& value)
+    {
+        if (m_owner == nullptr || !m_owner->write_field(m_key, member, value))
         {
-            return (isalnum(c) || (c == '+') || (c == '/'));
+            return false;
         }
 
+        memcpy(m_object->bytes + member_offset(member), &value, sizeof(M));
+        return true;
+    }
 
-};
 
-// Template implementation for number to string conversion
+// Read a number from the snapshot with the same decoding as reg_api::read_number
 template<typename T>
-std::string reg_api::number_to_string(const T& value)
+T reg_api::snapshot::read_number(std::string_view value_name, const T& default_value) const
 {
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(5) << value;
-    std::string str = oss.str();
+    const entry* item = lookup(value_name);
+    if (item == nullptr)
+    {
+        return default_value;
+    }
     
-    // Trim trailing zeros after decimal point
-    if (str.find('.') != std::string::npos)
+    T result = default_value;
+    if (!decode_number<T>(item->type, m_blob.data() + item->data_offset, item->data_size, result))
     {
-        str = str.substr(0, str.find_last_not_of('0') + 1);
-        if (str.back() == '.')
-        {
-            str.pop_back();
-        }
+        return default_value;
     }
     
-    return str;
+    return result;
 }
 
-// Template implementation for string to number conversion
-template<typename T>
-T reg_api::string_to_number(const std::string& str, const T& default_val)
+// Read an object from the snapshot with the same decoding as reg_api::read_obj
+template <typename T>
+T reg_api::snapshot::read_obj(std::string_view key) const
 {
-    T result = default_val;
-    std::istringstream iss(str);
-    
-    iss >> result;
-    if (iss.fail())
+    const entry* item = lookup(key);
+    if (item == nullptr)
     {
-        return default_val;
+        throw std::runtime_error("Key not found in registry: " + std::string(key));
     }
     
-    return result;
+    return decode_obj<T>(key, item->type, m_blob.data() + item->data_offset, item->data_size);
 }
 
-// Template implementation for reading numeric value
+// Queue a numeric write using the same encoding as reg_api::write_number
 template<typename T>
-T reg_api::read_number(const std::string& value_name, const T& default_value)
+bool reg_api::batch::write_number(std::string_view value_name, const T& value)
 {
-    // Try to read as string
-    std::string str_value = read_string(value_name, "");
+    char data[number_buffer_size];
+    DWORD data_size = 0;
+    DWORD type = m_owner->encode_number<T>(value, data, data_size);
+    if (type == REG_NONE)
+    {
+        return false;
+    }
     
-    if (str_value.empty())
+    add(value_name, false, type, data, data_size);
+    return true;
+}
+
+// Queue an object write using the same encoding as reg_api::write_obj
+template <typename T>
+bool reg_api::batch::write_obj(std::string_view key, const T& t_obj)
+{
+    // Chunks live in a subkey, outside what a batch applies
+    if (m_owner->chunks_obj(key, sizeof(T)))
     {
-        return default_value;
+        return false;
+    }
+    
+    if (m_owner->m_obj_format == obj_format::framed)
+    {
+        DWORD frame_size = m_owner->encode_framed(&t_obj, sizeof(T), obj_type_id<T>());
+        add(key, false, REG_BINARY, m_owner->m_frame_buf.data(), frame_size);
+        return true;
     }
     
-    // Convert string to number
-    return string_to_number<T>(str_value, default_value);
+    if (m_owner->m_storage_mode == storage_mode::native)
+    {
+        add(key, false, REG_BINARY, &t_obj, static_cast<DWORD>(sizeof(T)));
+        return true;
+    }
+    
+    // The text is copied into the arena, so it only needs scratch memory
+    scratch_scope scratch;
+    const char* p = reinterpret_cast<const char*>(&t_obj);
+    std::pmr::vector<char> encoded(b64_encoded_size(sizeof(T)) + 1, m_owner->scratch_resource());
+    size_t written = b64(p, sizeof(T), encoded.data());
+    encoded[written] = '\0';
+    add(key, false, REG_SZ, encoded.data(), static_cast<DWORD>(written + 1));
+    return true;
 }
 
-// Template implementation for writing numeric value
-template<typename T>
-bool reg_api::write_number(const std::string& value_name, const T& value)
+// Bulk-load a settings struct: one query for every name of the schema
+template<typename... Fields>
+bool reg_api::load(const reg_schema<Fields...>& schema, typename reg_schema<Fields...>::settings_type& settings)
 {
-    // Convert number to string with proper formatting
-    std::string str_value = number_to_string<T>(value);
+    snapshot values = load_names(schema.names.data(), schema.names.size());
     
-    // Write as string
-    return write_string(value_name, str_value);
+    return std::apply([&](const Fields&... fields)
+    {
+        // Every field is loaded, even after one falls back to its default
+        return (static_cast<int>(load_field(values, fields, settings)) & ...) != 0;
+    }, schema.fields);
 }
 
-// Write pointer value to registry
-template<typename T>
-bool reg_api::write_pointer(const std::string& value_name, T* ptr)
+// Store a settings struct as one batch
+template<typename... Fields>
+bool reg_api::store(const reg_schema<Fields...>& schema, const typename reg_schema<Fields...>::settings_type& settings)
 {
-    if (!m_is_open || ptr == nullptr)
+    batch pending = begin_batch();
+    
+    bool ok = std::apply([&](const Fields&... fields)
     {
-        return false;
-    }
+        return (static_cast<int>(store_field(pending, fields, settings)) & ...) != 0;
+    }, schema.fields);
+    
+    return pending.commit() && ok;
+}
 
-    // Get current process ID
-    DWORD current_pid = GetCurrentProcessId();
+// Sync to a settings struct, encoded as store() would write it
+template<typename... Fields>
+reg_api::sync_result reg_api::sync(const reg_schema<Fields...>& schema, const typename reg_schema<Fields...>::settings_type& settings,
+                                   const sync_options& options)
+{
+    batch desired = begin_batch();
+    
+    bool ok = std::apply([&](const Fields&... fields)
+    {
+        return (static_cast<int>(store_field(desired, fields, settings)) & ...) != 0;
+    }, schema.fields);
+    
+    sync_result result = sync(queued_values(desired), options);
+    result.ok = result.ok && ok;
+    return result;
+}
 
-    // Convert pointer address to string
-    std::ostringstream oss;
-    oss << std::hex << reinterpret_cast<uintptr_t>(ptr) << "_" << std::dec << current_pid;
+template<typename Field>
+bool reg_api::load_field(const snapshot& values, const Field& field, typename Field::settings_type& settings)
+{
+    typedef typename Field::member_type M;
+    M& out = settings.*field.member;
+    
+    const snapshot::entry* item = values.lookup(field.name);
+    const char* data = (item != nullptr) ? values.m_blob.data() + item->data_offset : nullptr;
+    
+    if constexpr (Field::is_string)
+    {
+        if (item != nullptr && (item->type == REG_SZ || item->type == REG_EXPAND_SZ))
+        {
+            out.assign(data, strnlen(data, item->data_size));
+            return true;
+        }
+    }
+    else if constexpr (!std::is_arithmetic<M>::value)
+    {
+        // Plain REG_BINARY copy of the member
+        if (item != nullptr && item->type == REG_BINARY && item->data_size == sizeof(M))
+        {
+            memcpy(&out, data, sizeof(M));
+            return true;
+        }
+    }
+    else
+    {
+        M value = field.default_value;
+        if (item != nullptr && decode_number<M>(item->type, data, item->data_size, value) &&
+            (!field.bounded || (value >= field.min_value && value <= field.max_value)))
+        {
+            out = value;
+            return true;
+        }
+    }
+    
+    out = field.default_value;
+    return false;
+}
 
-    // Write as string
-    return write_string(value_name, oss.str());
+template<typename Field>
+bool reg_api::store_field(batch& pending, const Field& field, const typename Field::settings_type& settings) const
+{
+    typedef typename Field::member_type M;
+    const M& value = settings.*field.member;
+    std::string_view name(field.name);
+    
+    if constexpr (Field::is_string)
+    {
+        pending.add(name, false, REG_SZ, value.c_str(), static_cast<DWORD>(value.length() + 1));
+    }
+    else if constexpr (Field::registry_type == REG_SZ)
+    {
+        char text[number_buffer_size];
+        DWORD data_size = 0;
+        if (encode_number<M>(value, storage_mode::string, m_float_format, text, data_size) == REG_NONE)
+        {
+            return false;
+        }
+        pending.add(name, false, REG_SZ, text, data_size);
+    }
+    else if constexpr (Field::registry_type == REG_DWORD)
+    {
+        uint32_t raw = static_cast<uint32_t>(value);
+        pending.add(name, false, REG_DWORD, &raw, sizeof(raw));
+    }
+    else if constexpr (Field::registry_type == REG_QWORD)
+    {
+        // Sign-extend so decode_number gives negative values back
+        uint64_t raw = std::is_signed<M>::value ? static_cast<uint64_t>(static_cast<int64_t>(value))
+                                                : static_cast<uint64_t>(value);
+        pending.add(name, false, REG_QWORD, &raw, sizeof(raw));
+    }
+    else
+    {
+        pending.add(name, false, REG_BINARY, &value, static_cast<DWORD>(sizeof(M)));
+    }
+    
+    return true;
 }
 
-// Read pointer value from registry with default value
+// Read a number from the viewed key, accepting every encoding
 template<typename T>
-T* reg_api::read_pointer(const std::string& value_name, T* default_value)
+T reg_api::key::read_number(std::string_view value_name, const T& default_value)
 {
-      // Try to read as string
-    std::string str_value = read_string(value_name, "");
+    if (m_h_key == NULL)
+    {
+        return default_value;
+    }
     
-    if (str_value.empty())
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (m_owner->query_registry(m_h_key, c_name(value_name).c_str(), type, data_size) != ERROR_SUCCESS)
     {
         return default_value;
     }
     
-    // Parse the pointer value and process ID
-    size_t separator_pos = str_value.find('_');
-    if (separator_pos == std::string::npos)
+    T result = default_value;
+    if (!decode_number<T>(type, m_owner->m_read_buf.data(), data_size, result))
     {
         return default_value;
     }
     
-    std::string ptr_str = str_value.substr(0, separator_pos);
-    std::string pid_str = str_value.substr(separator_pos + 1);
+    return result;
+}
+
+// Write a number to the viewed key using the owner's storage mode
+template<typename T>
+bool reg_api::key::write_number(std::string_view value_name, const T& value)
+{
+    if (m_h_key == NULL)
+    {
+        return false;
+    }
     
-    // Convert string to pointer and process ID
-    uintptr_t ptr_val = 0;
-    DWORD stored_pid = 0;
+    char data[number_buffer_size];
+    DWORD data_size = 0;
+    DWORD type = m_owner->encode_number<T>(value, data, data_size);
+    if (type == REG_NONE)
+    {
+        return false;
+    }
     
-    std::istringstream ptr_iss(ptr_str);
-    ptr_iss >> std::hex >> ptr_val;
+    return m_owner->set_registry(m_h_key, c_name(value_name).c_str(), type, data, data_size) == ERROR_SUCCESS;
+}
+
+// Read a number from the shared key, accepting any supported encoding
+template<typename T>
+T reg_api::shared::read_number(std::string_view value_name, const T& default_value) const
+{
+    epoch_guard guard;
+    const opened_key* key = current();
+    if (!key)
+    {
+        return default_value;
+    }
     
-    std::istringstream pid_iss(pid_str);
-    pid_iss >> stored_pid;
+    DWORD type = REG_NONE;
+    DWORD data_size = 0;
+    if (query_value(*key, value_name, type, data_size) != ERROR_SUCCESS)
+    {
+        return default_value;
+    }
     
-    if (ptr_iss.fail() || pid_iss.fail())
+    T result = default_value;
+    if (!decode_number<T>(type, thread_buffer().data(), data_size, result))
     {
         return default_value;
     }
     
-    // Get current process ID for validation
-    DWORD current_pid = GetCurrentProcessId();
+    return result;
+}
+
+// Write a number to the shared key using its storage mode
+template<typename T>
+bool reg_api::shared::write_number(std::string_view value_name, const T& value)
+{
+    std::lock_guard<std::mutex> lock(m_write_mutex);
     
-    // Validate process ID
-    if (current_pid != stored_pid)
+    char data[number_buffer_size];
+    DWORD data_size = 0;
+    DWORD type = encode_number<T>(value, m_storage_mode, m_float_format, data, data_size);
+    if (type == REG_NONE)
+    {
+        return false;
+    }
+    
+    return set_value(value_name, type, data, data_size);
+}
+
+// Read a number from the mapped tree, accepting any supported encoding
+template<typename T>
+T reg_api::tree_file::read_number(std::string_view key_path, std::string_view value_name, const T& default_value) const
+{
+    DWORD type = REG_NONE;
+    const char* data = nullptr;
+    DWORD data_size = 0;
+    if (!find(key_path, value_name, type, data, data_size))
     {
-        // Process ID mismatch - pointer is from a different process
-        std::cerr << "error, not the same PID, stored PID: " << stored_pid 
-                  << ", current PID: " << current_pid << std::endl;
         return default_value;
     }
     
-    return reinterpret_cast<T*>(ptr_val);
+    T result = default_value;
+    if (!decode_number<T>(type, data, data_size, result))
+    {
+        return default_value;
+    }
+    
+    return result;
 }
 
- template <typename T>
-    void reg_api::write_obj(const std::string& key, const T& t_obj)
+// Store a trivially copyable value in the named slot
+template<typename T>
+bool reg_api::slot_table::write(std::string_view name, const T& value)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "slot values are copied byte for byte");
+    static_assert(sizeof(T) <= max_data_size, "type does not fit in a slot");
+    
+    size_t index = slot(name);
+    return index != npos && store(index, &value, sizeof(T));
+}
+
+// Read a value stored by write<T>() with default value
+template<typename T>
+T reg_api::slot_table::read(std::string_view name, const T& default_value) const
+{
+    static_assert(std::is_trivially_copyable<T>::value, "slot values are copied byte for byte");
+    static_assert(sizeof(T) <= max_data_size, "type does not fit in a slot");
+    
+    T value;
+    size_t size = 0;
+    size_t index = find(name);
+    if (index == npos || !load(index, &value, sizeof(T), &size) || size != sizeof(T))
     {
-        // 1. Serialize the object into a byte-string.
-        const char* p = reinterpret_cast<const char*>(&t_obj);
-        std::string obj_string(p, sizeof(T));
+        return default_value;
+    }
+    return value;
+}
 
-        // 2. Encode the string to Base64.
-        std::string encoded_string = b64(obj_string);
+#if REG_API_COROUTINES
+// Await a string read; see async_read
+inline reg_api::async_read<std::string> reg_api::async_read_string(std::string_view value_name, std::string default_value)
+{
+    return async_read<std::string>(*this, value_name, std::move(default_value));
+}
+
+// Await a numeric read; see async_read
+template<typename T>
+reg_api::async_read<T> reg_api::async_read_number(std::string_view value_name, const T& default_value)
+{
+    return async_read<T>(*this, value_name, default_value);
+}
+
+// Await a string write, queued like batch::write_string
+inline reg_api::async_status reg_api::async_write_string(std::string_view value_name, const std::string& value)
+{
+    async_status awaiter(*this);
+    awaiter.m_request.op = async_request::kind::write;
+    awaiter.m_request.name.assign(value_name);
+    awaiter.m_request.type = REG_SZ;
+    awaiter.m_request.data.assign(value.c_str(), value.c_str() + value.length() + 1);
+    return awaiter;
+}
 
-        // 3. Write the encoded string to the registry.
-        write_string(key, encoded_string);
+// Await a numeric write, encoded now as write_number stores it
+template<typename T>
+reg_api::async_status reg_api::async_write_number(std::string_view value_name, const T& value)
+{
+    char data[number_buffer_size];
+    DWORD data_size = 0;
+    DWORD type = encode_number<T>(value, data, data_size);
+    
+    async_status awaiter(*this);
+    if (type == REG_NONE)
+    {
+        // Not encodable; completes with false
+        awaiter.m_request.op = async_request::kind::call;
+        awaiter.m_request.invoke = []() { return false; };
+        return awaiter;
     }
+    
+    awaiter.m_request.op = async_request::kind::write;
+    awaiter.m_request.name.assign(value_name);
+    awaiter.m_request.type = type;
+    awaiter.m_request.data.assign(data, data + data_size);
+    return awaiter;
+}
 
-    /**
-     * @brief Reads data from the registry, decodes it, and returns a new POD object.
-     * @tparam T The type of the object to read.
-     * @param key The registry key to read from.
-     * @return The deserialized object of type T.
-     * @throws std::runtime_error if the key is not found or data is corrupted.
-     */
-    template <typename T>
-    T reg_api::read_obj(const std::string& key)
+// Await a value delete
+inline reg_api::async_status reg_api::async_delete_value(std::string_view value_name)
+{
+    async_status awaiter(*this);
+    awaiter.m_request.op = async_request::kind::write;
+    awaiter.m_request.name.assign(value_name);
+    awaiter.m_request.is_delete = true;
+    return awaiter;
+}
+
+// Await read_obj() on the executor
+template<typename T>
+reg_api::async_status reg_api::async_read_obj(std::string_view key, T& out)
+{
+    async_status awaiter(*this);
+    awaiter.m_request.op = async_request::kind::call;
+    awaiter.m_request.invoke = [this, name = std::string(key), &out]() { return read_obj(name, out); };
+    return awaiter;
+}
+
+// Await write_obj() of a copy on the executor
+template<typename T>
+reg_api::async_status reg_api::async_write_obj(std::string_view key, const T& t_obj)
+{
+    async_status awaiter(*this);
+    awaiter.m_request.op = async_request::kind::call;
+    awaiter.m_request.invoke = [this, name = std::string(key), t_obj]()
     {
-        // 1. Read the encoded string from the registry.
-        std::string encoded_string = read_string(key, "");
-        if (encoded_string.empty())
-        {
-            throw std::runtime_error("Key not found in registry: " + key);
-        }
+        return write_obj(name, t_obj);
+    };
+    return awaiter;
+}
+#endif
 
-        // 2. Decode the string from Base64.
-        std::string obj_string = b64_d(encoded_string);
+// Short name for views returned by reg_api::open_key()
+typedef reg_api::key reg_key;
 
-        // 3. Check if the size matches the object's size.
-        if (obj_string.size() != sizeof(T))
-        {
-            throw std::runtime_error("Data size mismatch for key: " + key);
-        }
+// Short name for the thread-safe variant
+typedef reg_api::shared shared_reg_api;
 
-        // 4. Deserialize by creating a new object and copying the bytes into it.
-        T t_obj;
-        memcpy(&t_obj, obj_string.c_str(), sizeof(T));
-        return t_obj;
-    }
+// Short names for the read-only variants (default and 64/32-bit views)
+typedef reg_api::basic_reader<reg_api::read_only_access> reg_reader;
+typedef reg_api::basic_reader<reg_api::read_only_access_64> reg_reader_64;
+typedef reg_api::basic_reader<reg_api::read_only_access_32> reg_reader_32;
 
+#endif // _WIN32
 
 #endif // REGISTRY_HANDLER_H
@@ -0,0 +1,1163 @@
+#include "reg_backend.h"
+#include "reg_epoch.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+    // Live backend HKEYs, each the address of its reg_backend::handle.
+    // reg_api looks every HKEY up here first and anything not found goes
+    // to Win32, so no bits of a Windows key are interpreted. The sorted set
+    // is copied on open and close and published for lookups that take no
+    // lock; none at all happen while no backend key is open
+    struct backend_registry
+    {
+        typedef std::vector<const reg_backend::handle*> handle_set;
+
+        std::atomic<size_t> live{0};                              // Size of *handles
+        std::atomic<const handle_set*> handles{new handle_set()}; // Never null
+        std::mutex mutex;                                         // Serializes add/remove
+
+        // Retiring may free objects that close backend keys in turn, so
+        // add() and remove() retire the old set after unlocking
+        void add(const reg_backend::handle* handle)
+        {
+            const handle_set* current = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current = handles.load();
+                handle_set* replacement = new handle_set(*current);
+                replacement->insert(std::lower_bound(replacement->begin(), replacement->end(), handle), handle);
+                handles.store(replacement);
+                live.store(replacement->size());
+            }
+            reg_epoch::retire(current);
+        }
+
+        void remove(const reg_backend::handle* handle)
+        {
+            const handle_set* current = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current = handles.load();
+                if (!std::binary_search(current->begin(), current->end(), handle))
+                {
+                    return;
+                }
+
+                handle_set* replacement = new handle_set(*current);
+                replacement->erase(std::lower_bound(replacement->begin(), replacement->end(), handle));
+                handles.store(replacement);
+                live.store(replacement->size());
+            }
+            reg_epoch::retire(current);
+        }
+
+        bool contains(const void* address) const
+        {
+            // Whoever holds a backend HKEY got it after its add()
+            if (live.load(std::memory_order_acquire) == 0)
+            {
+                return false;
+            }
+
+            reg_epoch::guard guard;
+            const handle_set* current = handles.load(std::memory_order_acquire);
+            return std::binary_search(current->begin(), current->end(),
+                                      static_cast<const reg_backend::handle*>(address));
+        }
+    };
+
+    // Never destroyed, threads may close keys until the process ends
+    backend_registry& backend_handles()
+    {
+        static backend_registry* instance = new backend_registry();
+        return *instance;
+    }
+}
+
+reg_backend::reg_backend()
+    : m_root{ this, nullptr }
+{
+}
+
+reg_backend::~reg_backend()
+{
+    backend_handles().remove(&m_root);
+}
+
+HKEY reg_backend::root()
+{
+    std::call_once(m_root_once, [this]()
+    {
+        m_root.key = root_key();
+        backend_handles().add(&m_root);
+    });
+    return reinterpret_cast<HKEY>(&m_root);
+}
+
+reg_backend::handle* reg_backend::find(HKEY h_key)
+{
+    if (!backend_handles().contains(h_key))
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<handle*>(h_key);
+}
+
+LONG reg_backend::open(const handle& parent, const char* key_path, bool create, HKEY& h_result)
+{
+    key_id key = nullptr;
+    LONG result = parent.owner->open_key(parent.key, key_path, create, key);
+    if (result == ERROR_SUCCESS)
+    {
+        handle* opened = new handle{ parent.owner, key };
+        backend_handles().add(opened);
+        h_result = reinterpret_cast<HKEY>(opened);
+    }
+    return result;
+}
+
+void reg_backend::close(handle* key)
+{
+    // The root handle belongs to the backend
+    if (key == &key->owner->m_root)
+    {
+        return;
+    }
+
+    backend_handles().remove(key);
+    key->owner->close_key(key->key);
+    delete key;
+}
+
+namespace
+{
+    // Value and key names are compared like the cache does
+    std::string lower_name(const char* name, size_t size)
+    {
+        std::string lookup(name, size);
+        for (char& ch : lookup)
+        {
+            ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+        }
+        return lookup;
+    }
+
+    // First element of a vector of shared_ptrs sorted by ->lookup not
+    // ordered before lookup
+    template<typename Vector>
+    typename Vector::const_iterator find_lookup(const Vector& items, const std::string& lookup)
+    {
+        return std::lower_bound(items.begin(), items.end(), lookup,
+                                [](const typename Vector::value_type& item, const std::string& name) { return item->lookup < name; });
+    }
+
+    // Copy a name with its terminator into a buffer of *size bytes, like
+    // RegEnumValueA; *size receives the length
+    LONG copy_name(const std::string& name, char* out, DWORD* size)
+    {
+        if (out == nullptr || size == nullptr || name.size() >= *size)
+        {
+            return ERROR_MORE_DATA;
+        }
+        memcpy(out, name.c_str(), name.size() + 1);
+        *size = static_cast<DWORD>(name.size());
+        return ERROR_SUCCESS;
+    }
+
+    // Copy value data into a buffer of *size bytes, like RegQueryValueExA
+    LONG copy_data(const std::vector<char>& data, char* out, DWORD* size)
+    {
+        DWORD needed = static_cast<DWORD>(data.size());
+        if (out == nullptr)
+        {
+            if (size != nullptr)
+            {
+                *size = needed;
+            }
+            return ERROR_SUCCESS;
+        }
+        if (size == nullptr)
+        {
+            return ERROR_INVALID_PARAMETER;
+        }
+        if (*size < needed)
+        {
+            *size = needed;
+            return ERROR_MORE_DATA;
+        }
+        if (needed > 0)
+        {
+            memcpy(out, data.data(), needed);
+        }
+        *size = needed;
+        return ERROR_SUCCESS;
+    }
+}
+
+// Immutable state of one key; a write publishes a modified copy. Values are
+// shared between copies, so a copy costs one pointer per value
+struct reg_memory_backend::contents
+{
+    struct value
+    {
+        std::string name;   // As first written
+        std::string lookup; // Lower-cased
+        DWORD type;
+        std::vector<char> data;
+    };
+
+    std::vector<std::shared_ptr<const value>> values; // Sorted by lookup
+    std::vector<std::shared_ptr<node>> subkeys;       // Sorted by lookup
+    DWORD max_name_size = 0;
+    DWORD max_data_size = 0;
+    DWORD max_subkey_size = 0;
+
+    // Recompute the sizes RegQueryInfoKey reports
+    void measure();
+};
+
+struct reg_memory_backend::node
+{
+    std::string name;                     // As created
+    std::string lookup;                   // Lower-cased
+    std::string path;                     // From the root, names as created
+    std::atomic<const contents*> current; // Published, read under an epoch guard
+    std::mutex write_mutex;               // Serializes writers of this key
+    bool deleted = false;                 // Guarded by write_mutex
+
+    // Callbacks to run at the next change, each with the handle that armed
+    // it. Guarded by write_mutex
+    std::vector<std::pair<const open_handle*, change_callback>> watchers;
+
+    node()
+        : current(new contents())
+    {
+    }
+
+    // Last reference gone: no reader can still be inside current
+    ~node()
+    {
+        delete current.load();
+    }
+};
+
+// Work of writers that must wait until they released the node mutexes.
+// Retiring replaced contents may free a reg_api::shared key that closes its
+// handle here, and a change callback may call back into the backend; both
+// take those mutexes, so they happen when this goes out of scope. Declare
+// it before the locks
+struct reg_memory_backend::deferred
+{
+    std::vector<const contents*> replaced;
+    std::vector<change_callback> callbacks;
+
+    ~deferred()
+    {
+        for (const change_callback& callback : callbacks)
+        {
+            callback();
+        }
+        for (const contents* item : replaced)
+        {
+            reg_epoch::retire(item);
+        }
+    }
+};
+
+// What a key_id points to; keeps a deleted key alive while it is open
+struct reg_memory_backend::open_handle
+{
+    std::shared_ptr<node> target;
+};
+
+void reg_memory_backend::contents::measure()
+{
+    max_name_size = 0;
+    max_data_size = 0;
+    max_subkey_size = 0;
+    for (const std::shared_ptr<const value>& item : values)
+    {
+        max_name_size = std::max(max_name_size, static_cast<DWORD>(item->name.size()));
+        max_data_size = std::max(max_data_size, static_cast<DWORD>(item->data.size()));
+    }
+    for (const std::shared_ptr<node>& subkey : subkeys)
+    {
+        max_subkey_size = std::max(max_subkey_size, static_cast<DWORD>(subkey->name.size()));
+    }
+}
+
+reg_memory_backend::reg_memory_backend()
+    : m_root(new open_handle{ std::make_shared<node>() })
+    , m_changes(0)
+{
+}
+
+reg_memory_backend::~reg_memory_backend()
+{
+    // Free the replaced contents of this store's keys while we are around
+    m_root.reset();
+    reg_epoch::synchronize();
+}
+
+reg_backend::key_id reg_memory_backend::root_key()
+{
+    return m_root.get();
+}
+
+LONG reg_memory_backend::open_key(key_id parent, const char* key_path, bool create, key_id& result)
+{
+    std::shared_ptr<node> current = static_cast<open_handle*>(parent)->target;
+    const char* path = (key_path != nullptr) ? key_path : "";
+    reg_epoch::guard guard;
+    deferred later;
+
+    while (*path != '\0')
+    {
+        const char* end = strchr(path, '\\');
+        size_t size = (end != nullptr) ? static_cast<size_t>(end - path) : strlen(path);
+        if (size == 0)
+        {
+            ++path;
+            continue;
+        }
+
+        std::string lookup = lower_name(path, size);
+        const contents* state = current->current.load(std::memory_order_acquire);
+        auto it = find_lookup(state->subkeys, lookup);
+        std::shared_ptr<node> child = (it != state->subkeys.end() && (*it)->lookup == lookup) ? *it : nullptr;
+
+        if (!child)
+        {
+            if (!create)
+            {
+                return ERROR_FILE_NOT_FOUND;
+            }
+
+            std::lock_guard<std::mutex> lock(current->write_mutex);
+            if (current->deleted)
+            {
+                return ERROR_KEY_DELETED;
+            }
+
+            // Another writer may have created it meanwhile
+            state = current->current.load();
+            it = find_lookup(state->subkeys, lookup);
+            if (it != state->subkeys.end() && (*it)->lookup == lookup)
+            {
+                child = *it;
+            }
+            else
+            {
+                child = std::make_shared<node>();
+                child->name.assign(path, size);
+                child->lookup = lookup;
+                child->path = current->path.empty() ? child->name : current->path + "\\" + child->name;
+
+                if (!record(change{ change::kind::create_key, child->path, nullptr, REG_NONE, nullptr, 0 }))
+                {
+                    return ERROR_WRITE_FAULT;
+                }
+
+                std::unique_ptr<contents> replacement(new contents(*state));
+                replacement->subkeys.insert(replacement->subkeys.begin() + (it - state->subkeys.begin()), child);
+                replacement->measure();
+                publish(*current, std::move(replacement), later);
+            }
+        }
+
+        current = child;
+        path += size;
+    }
+
+    result = new open_handle{ current };
+    return ERROR_SUCCESS;
+}
+
+void reg_memory_backend::close_key(key_id key)
+{
+    open_handle* handle = static_cast<open_handle*>(key);
+
+    // Notifications end with the handle that armed them; their callbacks
+    // are destroyed after the lock
+    std::vector<change_callback> dropped;
+    {
+        node& target = *handle->target;
+        std::lock_guard<std::mutex> lock(target.write_mutex);
+        for (auto it = target.watchers.begin(); it != target.watchers.end(); )
+        {
+            if (it->first == handle)
+            {
+                dropped.push_back(std::move(it->second));
+                it = target.watchers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    delete handle;
+}
+
+LONG reg_memory_backend::query(key_id key, const char* value_name, DWORD* type, char* data, DWORD* data_size)
+{
+    node& target = *static_cast<open_handle*>(key)->target;
+    reg_epoch::guard guard;
+    const contents* state = target.current.load(std::memory_order_acquire);
+
+    std::string lookup = lower_name(value_name != nullptr ? value_name : "", value_name != nullptr ? strlen(value_name) : 0);
+    auto it = find_lookup(state->values, lookup);
+    if (it == state->values.end() || (*it)->lookup != lookup)
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    if (type != nullptr)
+    {
+        *type = (*it)->type;
+    }
+    return copy_data((*it)->data, data, data_size);
+}
+
+LONG reg_memory_backend::set(key_id key, const char* value_name, DWORD type, const void* data, DWORD data_size)
+{
+    node& target = *static_cast<open_handle*>(key)->target;
+
+    std::shared_ptr<contents::value> item = std::make_shared<contents::value>();
+    item->name = (value_name != nullptr) ? value_name : "";
+    item->lookup = lower_name(item->name.data(), item->name.size());
+    item->type = type;
+    if (data != nullptr && data_size > 0)
+    {
+        item->data.assign(static_cast<const char*>(data), static_cast<const char*>(data) + data_size);
+    }
+
+    deferred later;
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    if (target.deleted)
+    {
+        return ERROR_KEY_DELETED;
+    }
+
+    if (!record(change{ change::kind::set_value, target.path, item->name.c_str(), type, data, data_size }))
+    {
+        return ERROR_WRITE_FAULT;
+    }
+
+    const contents* state = target.current.load();
+    std::unique_ptr<contents> replacement(new contents(*state));
+    auto it = replacement->values.begin() + (find_lookup(state->values, item->lookup) - state->values.begin());
+    if (it != replacement->values.end() && (*it)->lookup == item->lookup)
+    {
+        // The registry keeps the name it first saw
+        item->name = (*it)->name;
+        *it = std::move(item);
+    }
+    else
+    {
+        replacement->values.insert(it, std::move(item));
+    }
+    replacement->measure();
+    publish(target, std::move(replacement), later);
+    return ERROR_SUCCESS;
+}
+
+LONG reg_memory_backend::remove(key_id key, const char* value_name)
+{
+    node& target = *static_cast<open_handle*>(key)->target;
+    std::string lookup = lower_name(value_name != nullptr ? value_name : "", value_name != nullptr ? strlen(value_name) : 0);
+
+    deferred later;
+    std::lock_guard<std::mutex> lock(target.write_mutex);
+    if (target.deleted)
+    {
+        return ERROR_KEY_DELETED;
+    }
+
+    const contents* state = target.current.load();
+    auto it = find_lookup(state->values, lookup);
+    if (it == state->values.end() || (*it)->lookup != lookup)
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    if (!record(change{ change::kind::remove_value, target.path, (*it)->name.c_str(), REG_NONE, nullptr, 0 }))
+    {
+        return ERROR_WRITE_FAULT;
+    }
+
+    std::unique_ptr<contents> replacement(new contents(*state));
+    replacement->values.erase(replacement->values.begin() + (it - state->values.begin()));
+    replacement->measure();
+    publish(target, std::move(replacement), later);
+    return ERROR_SUCCESS;
+}
+
+LONG reg_memory_backend::remove_tree(key_id parent, const char* key_path)
+{
+    // Like RegDeleteTree: an empty path empties the key itself
+    std::shared_ptr<node> target = static_cast<open_handle*>(parent)->target;
+    std::string path = (key_path != nullptr) ? key_path : "";
+    while (!path.empty() && path.back() == '\\')
+    {
+        path.pop_back();
+    }
+
+    deferred later;
+    if (path.empty())
+    {
+        std::lock_guard<std::mutex> lock(target->write_mutex);
+        if (target->deleted)
+        {
+            return ERROR_KEY_DELETED;
+        }
+
+        if (!record(change{ change::kind::clear_key, target->path, nullptr, REG_NONE, nullptr, 0 }))
+        {
+            return ERROR_WRITE_FAULT;
+        }
+
+        const contents* state = target->current.load();
+        for (const std::shared_ptr<node>& subkey : state->subkeys)
+        {
+            std::lock_guard<std::mutex> subkey_lock(subkey->write_mutex);
+            delete_below(*subkey, later);
+        }
+        publish(*target, std::unique_ptr<const contents>(new contents()), later);
+        return ERROR_SUCCESS;
+    }
+
+    size_t split = path.rfind('\\');
+    if (split != std::string::npos)
+    {
+        key_id owner = nullptr;
+        LONG result = open_key(parent, path.substr(0, split).c_str(), false, owner);
+        if (result != ERROR_SUCCESS)
+        {
+            return result;
+        }
+        target = static_cast<open_handle*>(owner)->target;
+        close_key(owner);
+        path.erase(0, split + 1);
+    }
+
+    std::string lookup = lower_name(path.data(), path.size());
+    std::lock_guard<std::mutex> lock(target->write_mutex);
+    const contents* state = target->current.load();
+    auto it = find_lookup(state->subkeys, lookup);
+    if (target->deleted || it == state->subkeys.end() || (*it)->lookup != lookup)
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    if (!record(change{ change::kind::delete_key, (*it)->path, nullptr, REG_NONE, nullptr, 0 }))
+    {
+        return ERROR_WRITE_FAULT;
+    }
+
+    {
+        std::lock_guard<std::mutex> subkey_lock((*it)->write_mutex);
+        delete_below(**it, later);
+    }
+
+    std::unique_ptr<contents> replacement(new contents(*state));
+    replacement->subkeys.erase(replacement->subkeys.begin() + (it - state->subkeys.begin()));
+    replacement->measure();
+    publish(*target, std::move(replacement), later);
+    return ERROR_SUCCESS;
+}
+
+LONG reg_memory_backend::info(key_id key, DWORD* subkey_count, DWORD* max_subkey_size, DWORD* value_count,
+                              DWORD* max_name_size, DWORD* max_data_size)
+{
+    node& target = *static_cast<open_handle*>(key)->target;
+    reg_epoch::guard guard;
+    const contents* state = target.current.load(std::memory_order_acquire);
+
+    if (subkey_count != nullptr)
+    {
+        *subkey_count = static_cast<DWORD>(state->subkeys.size());
+    }
+    if (max_subkey_size != nullptr)
+    {
+        *max_subkey_size = state->max_subkey_size;
+    }
+    if (value_count != nullptr)
+    {
+        *value_count = static_cast<DWORD>(state->values.size());
+    }
+    if (max_name_size != nullptr)
+    {
+        *max_name_size = state->max_name_size;
+    }
+    if (max_data_size != nullptr)
+    {
+        *max_data_size = state->max_data_size;
+    }
+    return ERROR_SUCCESS;
+}
+
+LONG reg_memory_backend::enum_value(key_id key, DWORD index, char* name, DWORD* name_size, DWORD* type,
+                                    char* data, DWORD* data_size)
+{
+    node& target = *static_cast<open_handle*>(key)->target;
+    reg_epoch::guard guard;
+    const contents* state = target.current.load(std::memory_order_acquire);
+    if (index >= state->values.size())
+    {
+        return ERROR_NO_MORE_ITEMS;
+    }
+
+    const contents::value& item = *state->values[index];
+    if (type != nullptr)
+    {
+        *type = item.type;
+    }
+
+    // Report the data size either way so the caller can grow both buffers
+    LONG result = copy_name(item.name, name, name_size);
+    if (result != ERROR_SUCCESS)
+    {
+        if (data_size != nullptr)
+        {
+            *data_size = std::max(*data_size, static_cast<DWORD>(item.data.size()));
+        }
+        return result;
+    }
+    return copy_data(item.data, data, data_size);
+}
+
+LONG reg_memory_backend::enum_key(key_id key, DWORD index, char* name, DWORD* name_size)
+{
+    node& target = *static_cast<open_handle*>(key)->target;
+    reg_epoch::guard guard;
+    const contents* state = target.current.load(std::memory_order_acquire);
+    if (index >= state->subkeys.size())
+    {
+        return ERROR_NO_MORE_ITEMS;
+    }
+    return copy_name(state->subkeys[index]->name, name, name_size);
+}
+
+LONG reg_memory_backend::notify(key_id key, change_callback on_change)
+{
+    open_handle* handle = static_cast<open_handle*>(key);
+    if (!on_change)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::lock_guard<std::mutex> lock(handle->target->write_mutex);
+    handle->target->watchers.emplace_back(handle, std::move(on_change));
+    return ERROR_SUCCESS;
+}
+
+unsigned long long reg_memory_backend::change_count() const
+{
+    return m_changes.load();
+}
+
+bool reg_memory_backend::record(const change&)
+{
+    return true;
+}
+
+void reg_memory_backend::publish(node& n, std::unique_ptr<const contents> replacement, deferred& later)
+{
+    later.replaced.push_back(n.current.exchange(replacement.release()));
+    ++m_changes;
+
+    for (std::pair<const open_handle*, change_callback>& watcher : n.watchers)
+    {
+        later.callbacks.push_back(std::move(watcher.second));
+    }
+    n.watchers.clear();
+}
+
+void reg_memory_backend::delete_below(node& n, deferred& later)
+{
+    const contents* state = n.current.load();
+    for (const std::shared_ptr<node>& subkey : state->subkeys)
+    {
+        std::lock_guard<std::mutex> lock(subkey->write_mutex);
+        delete_below(*subkey, later);
+    }
+
+    n.deleted = true;
+    publish(n, std::unique_ptr<const contents>(new contents()), later);
+}
+
+namespace
+{
+    // reg_file_backend journal layout. Integers are little-endian:
+    //   magic, version               uint32 each
+    //   records, each:
+    //     size, checksum             uint32 each, of the payload
+    //     payload:
+    //       kind                     uint8, change::kind + 1
+    //       key path                 text
+    //       value name               text, set_value and remove_value
+    //       type, data               uint32 and text, set_value
+    // Text is a uint32 size and that many bytes. A record cut short or
+    // failing its checksum ends the journal.
+    const uint32_t journal_magic = 0x4C4E4A52; // "RJNL"
+    const uint32_t journal_version = 1;
+    const size_t journal_header_size = 8;
+    const size_t record_header_size = 8;
+
+    void put_u32(std::vector<char>& out, uint32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            out.push_back(static_cast<char>((value >> shift) & 0xFF));
+        }
+    }
+
+    void put_text(std::vector<char>& out, const void* data, size_t size)
+    {
+        put_u32(out, static_cast<uint32_t>(size));
+        if (size > 0)
+        {
+            const char* bytes = static_cast<const char*>(data);
+            out.insert(out.end(), bytes, bytes + size);
+        }
+    }
+
+    uint32_t get_u32(const char* in)
+    {
+        uint32_t value = 0;
+        for (int i = 3; i >= 0; --i)
+        {
+            value = (value << 8) | static_cast<unsigned char>(in[i]);
+        }
+        return value;
+    }
+
+    // FNV-1a
+    uint32_t journal_checksum(const char* data, size_t size)
+    {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    std::vector<char> journal_header()
+    {
+        std::vector<char> out;
+        put_u32(out, journal_magic);
+        put_u32(out, journal_version);
+        return out;
+    }
+
+    // Frame a payload as a record at the end of out
+    void put_record(std::vector<char>& out, const std::vector<char>& payload)
+    {
+        put_u32(out, static_cast<uint32_t>(payload.size()));
+        put_u32(out, journal_checksum(payload.data(), payload.size()));
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+
+    // Fields of a record payload, read in order
+    struct payload_reader
+    {
+        const char* at;
+        const char* end;
+
+        bool byte(unsigned& out)
+        {
+            if (at == end)
+            {
+                return false;
+            }
+            out = static_cast<unsigned char>(*at++);
+            return true;
+        }
+
+        bool u32(uint32_t& out)
+        {
+            if (end - at < 4)
+            {
+                return false;
+            }
+            out = get_u32(at);
+            at += 4;
+            return true;
+        }
+
+        bool text(std::string& out)
+        {
+            uint32_t size = 0;
+            if (!u32(size) || static_cast<size_t>(end - at) < size)
+            {
+                return false;
+            }
+            out.assign(at, size);
+            at += size;
+            return true;
+        }
+    };
+
+    // Whole contents of a file; false if it cannot be read
+    bool read_file(const std::string& file_path, std::vector<char>& out)
+    {
+        std::ifstream in(file_path, std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+        out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return !in.bad();
+    }
+
+    bool write_file(const std::string& file_path, const std::vector<char>& data)
+    {
+        std::ofstream out(file_path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        out.flush();
+        return out.good();
+    }
+
+    // Apply one record payload through the backend calls of store; false if
+    // the payload is malformed. Changes that no longer apply are skipped
+    bool apply_record(reg_backend& store, const char* payload, size_t size)
+    {
+        payload_reader in{ payload, payload + size };
+        unsigned kind = 0;
+        std::string key_path;
+        if (!in.byte(kind) || !in.text(key_path))
+        {
+            return false;
+        }
+
+        typedef reg_backend::key_id key_id;
+        key_id root = store.root_key();
+        key_id key = nullptr;
+        std::string name;
+        switch (kind)
+        {
+            case 1: // create_key
+                if (store.open_key(root, key_path.c_str(), true, key) == ERROR_SUCCESS)
+                {
+                    store.close_key(key);
+                }
+                return true;
+
+            case 2: // set_value
+            {
+                uint32_t type = 0;
+                std::string data;
+                if (!in.text(name) || !in.u32(type) || !in.text(data))
+                {
+                    return false;
+                }
+                if (store.open_key(root, key_path.c_str(), true, key) == ERROR_SUCCESS)
+                {
+                    store.set(key, name.c_str(), type, data.data(), static_cast<DWORD>(data.size()));
+                    store.close_key(key);
+                }
+                return true;
+            }
+
+            case 3: // remove_value
+                if (!in.text(name))
+                {
+                    return false;
+                }
+                if (store.open_key(root, key_path.c_str(), false, key) == ERROR_SUCCESS)
+                {
+                    store.remove(key, name.c_str());
+                    store.close_key(key);
+                }
+                return true;
+
+            case 4: // delete_key
+                store.remove_tree(root, key_path.c_str());
+                return true;
+
+            case 5: // clear_key
+                if (store.open_key(root, key_path.c_str(), false, key) == ERROR_SUCCESS)
+                {
+                    store.remove_tree(key, "");
+                    store.close_key(key);
+                }
+                return true;
+        }
+        return false;
+    }
+
+    // Apply the records of journal from offset on; returns the end of the
+    // last whole record
+    size_t replay(reg_backend& store, const std::vector<char>& journal, size_t offset)
+    {
+        while (journal.size() - offset >= record_header_size)
+        {
+            uint32_t size = get_u32(journal.data() + offset);
+            uint32_t checksum = get_u32(journal.data() + offset + 4);
+            const char* payload = journal.data() + offset + record_header_size;
+            if (journal.size() - offset - record_header_size < size ||
+                journal_checksum(payload, size) != checksum ||
+                !apply_record(store, payload, size))
+            {
+                break;
+            }
+            offset += record_header_size + size;
+        }
+        return offset;
+    }
+
+    // Append records that recreate key and everything below it, at
+    // key_path, to out; false if the store could not be read
+    bool put_tree(reg_backend& store, reg_backend::key_id key, const std::string& key_path, std::vector<char>& out)
+    {
+        DWORD subkey_count = 0;
+        DWORD max_subkey_size = 0;
+        DWORD value_count = 0;
+        DWORD max_name_size = 0;
+        DWORD max_data_size = 0;
+        if (store.info(key, &subkey_count, &max_subkey_size, &value_count, &max_name_size, &max_data_size) != ERROR_SUCCESS)
+        {
+            return false;
+        }
+
+        std::vector<char> payload;
+        if (!key_path.empty())
+        {
+            payload.push_back(1); // create_key
+            put_text(payload, key_path.data(), key_path.size());
+            put_record(out, payload);
+        }
+
+        std::vector<char> name(static_cast<size_t>(max_name_size) + 1);
+        std::vector<char> data(std::max<size_t>(max_data_size, 1));
+        for (DWORD index = 0; index < value_count; ++index)
+        {
+            DWORD name_size = static_cast<DWORD>(name.size());
+            DWORD data_size = static_cast<DWORD>(data.size());
+            DWORD type = REG_NONE;
+            if (store.enum_value(key, index, name.data(), &name_size, &type, data.data(), &data_size) != ERROR_SUCCESS)
+            {
+                return false;
+            }
+
+            payload.clear();
+            payload.push_back(2); // set_value
+            put_text(payload, key_path.data(), key_path.size());
+            put_text(payload, name.data(), name_size);
+            put_u32(payload, type);
+            put_text(payload, data.data(), data_size);
+            put_record(out, payload);
+        }
+
+        std::vector<char> subkey(static_cast<size_t>(max_subkey_size) + 1);
+        for (DWORD index = 0; index < subkey_count; ++index)
+        {
+            DWORD subkey_size = static_cast<DWORD>(subkey.size());
+            reg_backend::key_id child = nullptr;
+            if (store.enum_key(key, index, subkey.data(), &subkey_size) != ERROR_SUCCESS ||
+                store.open_key(key, subkey.data(), false, child) != ERROR_SUCCESS)
+            {
+                return false;
+            }
+
+            std::string child_path(subkey.data(), subkey_size);
+            if (!key_path.empty())
+            {
+                child_path = key_path + "\\" + child_path;
+            }
+            bool ok = put_tree(store, child, child_path, out);
+            store.close_key(child);
+            if (!ok)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+reg_file_backend::reg_file_backend(const std::string& file_path)
+    : m_file_path(file_path)
+    , m_loaded(false)
+    , m_replaying(false)
+    , m_journal_size(0)
+{
+    std::vector<char> journal;
+    std::error_code error;
+    if (!std::filesystem::exists(file_path, error))
+    {
+        journal = journal_header();
+        if (!write_file(file_path, journal))
+        {
+            return;
+        }
+    }
+    else
+    {
+        // Leave anything that is not a journal alone
+        if (!read_file(file_path, journal) || journal.size() < journal_header_size ||
+            get_u32(journal.data()) != journal_magic || get_u32(journal.data() + 4) != journal_version)
+        {
+            return;
+        }
+
+        m_replaying = true;
+        size_t end = replay(*this, journal, journal_header_size);
+        m_replaying = false;
+        m_loaded = true;
+
+        // Cut a record the last writer did not finish, so appends follow
+        // whole records
+        if (end < journal.size())
+        {
+            std::filesystem::resize_file(file_path, end, error);
+            if (error)
+            {
+                return;
+            }
+            journal.resize(end);
+        }
+    }
+
+    m_journal.open(file_path, std::ios::binary | std::ios::app);
+    m_journal_size = journal.size();
+}
+
+reg_file_backend::~reg_file_backend()
+{
+}
+
+bool reg_file_backend::loaded() const
+{
+    return m_loaded;
+}
+
+bool reg_file_backend::is_open() const
+{
+    return m_journal.is_open();
+}
+
+bool reg_file_backend::record(const change& c)
+{
+    if (m_replaying)
+    {
+        return true;
+    }
+
+    std::vector<char> payload;
+    payload.push_back(static_cast<char>(static_cast<int>(c.type) + 1));
+    put_text(payload, c.key_path.data(), c.key_path.size());
+    if (c.type == change::kind::set_value || c.type == change::kind::remove_value)
+    {
+        put_text(payload, c.value_name, strlen(c.value_name));
+    }
+    if (c.type == change::kind::set_value)
+    {
+        put_u32(payload, c.value_type);
+        put_text(payload, c.data, (c.data != nullptr) ? c.data_size : 0);
+    }
+
+    std::vector<char> framed;
+    put_record(framed, payload);
+
+    std::lock_guard<std::mutex> lock(m_journal_mutex);
+    return append(framed);
+}
+
+bool reg_file_backend::append(const std::vector<char>& record)
+{
+    if (!m_journal.is_open())
+    {
+        return false;
+    }
+
+    m_journal.write(record.data(), static_cast<std::streamsize>(record.size()));
+    m_journal.flush();
+    if (m_journal.good())
+    {
+        m_journal_size += record.size();
+        return true;
+    }
+
+    // Take back whatever part got written, so later records stay readable
+    m_journal.close();
+    std::error_code error;
+    std::filesystem::resize_file(m_file_path, m_journal_size, error);
+    if (!error)
+    {
+        m_journal.open(m_file_path, std::ios::binary | std::ios::app);
+    }
+    return false;
+}
+
+bool reg_file_backend::compact()
+{
+    std::lock_guard<std::mutex> compact_lock(m_compact_mutex);
+
+    // Replay what the journal holds now into a scratch store; writers go on
+    // appending meanwhile
+    size_t prefix = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_journal_mutex);
+        if (!m_journal.is_open())
+        {
+            return false;
+        }
+        prefix = static_cast<size_t>(m_journal_size);
+    }
+
+    std::vector<char> journal;
+    if (!read_file(m_file_path, journal) || journal.size() < prefix)
+    {
+        return false;
+    }
+    journal.resize(prefix);
+
+    reg_memory_backend scratch;
+    if (replay(scratch, journal, journal_header_size) != prefix)
+    {
+        return false;
+    }
+
+    std::vector<char> compacted = journal_header();
+    if (!put_tree(scratch, scratch.root_key(), "", compacted))
+    {
+        return false;
+    }
+
+    // Add the records appended since, and switch files while writers wait
+    std::string temp_path = m_file_path + ".compact";
+    std::lock_guard<std::mutex> lock(m_journal_mutex);
+    if (!read_file(m_file_path, journal) || journal.size() < m_journal_size)
+    {
+        return false;
+    }
+    compacted.insert(compacted.end(), journal.begin() + prefix, journal.begin() + static_cast<size_t>(m_journal_size));
+
+    std::error_code error;
+    if (!write_file(temp_path, compacted))
+    {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    m_journal.close();
+    std::filesystem::rename(temp_path, m_file_path, error);
+    if (error)
+    {
+        std::filesystem::remove(temp_path, error);
+        m_journal.open(m_file_path, std::ios::binary | std::ios::app);
+        return false;
+    }
+
+    m_journal.open(m_file_path, std::ios::binary | std::ios::app);
+    m_journal_size = compacted.size();
+    return m_journal.is_open();
+}
@@ -0,0 +1,204 @@
+#ifndef REG_BACKEND_H
+#define REG_BACKEND_H
+
+#include "reg_platform.h"
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Key stores that serve reg_api in place of the Win32 registry, also known
+// as reg_api::backend, reg_api::memory_backend and reg_api::file_backend.
+// They use the standard library only, so they build and can be tested on
+// any platform; reg_api itself needs Windows.
+
+// Key store behind reg_api. A reg_api constructed with root() works on the
+// backend, and every key opened below it is served by the same backend, so
+// the cache, batches, typed values and tree export behave as on the
+// registry. Names are compared case-insensitively (ASCII); text is stored
+// as the bytes reg_api passes in. Implementations must be thread-safe.
+class reg_backend
+{
+    public:
+        typedef void* key_id;
+
+        // What an HKEY of a backend points to; reg_api tells these apart
+        // from Win32 keys by the addresses of the open ones
+        struct handle
+        {
+            reg_backend* owner;
+            key_id key;
+        };
+
+        // Run by notify() at the next change
+        typedef std::function<void()> change_callback;
+
+        reg_backend();
+        virtual ~reg_backend();
+
+        reg_backend(const reg_backend&) = delete;
+        reg_backend& operator=(const reg_backend&) = delete;
+
+        // Root key handle for reg_api; valid while the backend lives
+        HKEY root();
+
+        // The open backend key h_key stands for, or nullptr for any other
+        // HKEY, a Win32 one included. Takes no lock
+        static handle* find(HKEY h_key);
+
+        // Open key_path below parent, creating it if asked, as a new HKEY
+        // that find() knows; release it with close()
+        static LONG open(const handle& parent, const char* key_path, bool create, HKEY& h_result);
+
+        // Release a key of open(); a root() stays open
+        static void close(handle* key);
+
+        // The calls below mirror the registry API they replace and return
+        // its error codes. Keys other than root_key() are released with
+        // close_key()
+        virtual key_id root_key() = 0;
+        virtual LONG open_key(key_id parent, const char* key_path, bool create, key_id& result) = 0;
+        virtual void close_key(key_id key) = 0;
+        virtual LONG query(key_id key, const char* value_name, DWORD* type, char* data, DWORD* data_size) = 0;
+        virtual LONG set(key_id key, const char* value_name, DWORD type, const void* data, DWORD data_size) = 0;
+        virtual LONG remove(key_id key, const char* value_name) = 0;
+        virtual LONG remove_tree(key_id parent, const char* key_path) = 0;
+        virtual LONG info(key_id key, DWORD* subkey_count, DWORD* max_subkey_size, DWORD* value_count,
+                          DWORD* max_name_size, DWORD* max_data_size) = 0;
+        virtual LONG enum_value(key_id key, DWORD index, char* name, DWORD* name_size, DWORD* type,
+                                char* data, DWORD* data_size) = 0;
+        virtual LONG enum_key(key_id key, DWORD index, char* name, DWORD* name_size) = 0;
+
+        // Run on_change once, at the next change of key's values or
+        // subkeys, like RegNotifyChangeKeyValue. It runs on the writer's
+        // thread once the writer released its locks, must not throw, and is
+        // dropped without running when key is closed
+        virtual LONG notify(key_id key, change_callback on_change) = 0;
+
+    private:
+        handle m_root;              // Registered by root()
+        std::once_flag m_root_once; // Fills m_root.key on the first root() call
+};
+
+// Backend holding the keys in process memory. Each key publishes an
+// immutable copy of its values and subkeys: readers use it under an epoch
+// guard without locking, writers of a key are serialized and publish a
+// replacement, freeing the old copy once no reader has it
+class reg_memory_backend : public reg_backend
+{
+    public:
+        reg_memory_backend();
+        ~reg_memory_backend() override;
+
+        key_id root_key() override;
+        LONG open_key(key_id parent, const char* key_path, bool create, key_id& result) override;
+        void close_key(key_id key) override;
+        LONG query(key_id key, const char* value_name, DWORD* type, char* data, DWORD* data_size) override;
+        LONG set(key_id key, const char* value_name, DWORD type, const void* data, DWORD data_size) override;
+        LONG remove(key_id key, const char* value_name) override;
+        LONG remove_tree(key_id parent, const char* key_path) override;
+        LONG info(key_id key, DWORD* subkey_count, DWORD* max_subkey_size, DWORD* value_count,
+                  DWORD* max_name_size, DWORD* max_data_size) override;
+        LONG enum_value(key_id key, DWORD index, char* name, DWORD* name_size, DWORD* type,
+                        char* data, DWORD* data_size) override;
+        LONG enum_key(key_id key, DWORD index, char* name, DWORD* name_size) override;
+        LONG notify(key_id key, change_callback on_change) override;
+
+        // Changes made so far (sets, deletes, created keys)
+        unsigned long long change_count() const;
+
+    protected:
+        // A change about to be made, as passed to record()
+        struct change
+        {
+            enum class kind
+            {
+                create_key,   // key_path was created
+                set_value,    // value_name of key_path was set
+                remove_value, // value_name of key_path was deleted
+                delete_key,   // key_path and everything below it were deleted
+                clear_key     // Everything in and below key_path was deleted
+            };
+
+            kind type;
+            const std::string& key_path; // From the root, names as created
+            const char* value_name;      // set_value and remove_value
+            DWORD value_type;            // The rest are for set_value
+            const void* data;
+            DWORD data_size;
+        };
+
+        // Called before each change becomes visible, with the mutex of the
+        // changed key held (of the parent for created and deleted keys), so
+        // the changes of one key are recorded in the order they apply. A
+        // change recorded false is dropped and fails with ERROR_WRITE_FAULT.
+        // The default accepts every change
+        virtual bool record(const change& c);
+
+    private:
+        struct node;
+        struct contents;
+        struct deferred;
+        struct open_handle;
+
+        std::unique_ptr<open_handle> m_root;       // Never closed
+        std::atomic<unsigned long long> m_changes; // Modifications so far
+
+        // Publish a modified copy of n's contents; caller holds n's mutex.
+        // The old contents and n's change callbacks go to later, which
+        // retires and runs them once the caller dropped the mutexes
+        void publish(node& n, std::unique_ptr<const contents> replacement, deferred& later);
+
+        // Mark n and everything below it deleted; caller holds n's mutex
+        void delete_below(node& n, deferred& later);
+};
+
+// memory_backend whose keys are kept in a journal file. Every change is
+// appended to the file and flushed to the operating system before it
+// becomes visible, so a process that ends or crashes at any point keeps
+// every change it made; a power failure may lose what the system had not
+// written back yet. Opening replays the journal, dropping a last record
+// cut short by a crash, and creates a missing file. compact() rewrites the
+// journal to one record per key and value
+class reg_file_backend : public reg_memory_backend
+{
+    public:
+        explicit reg_file_backend(const std::string& file_path);
+        ~reg_file_backend() override;
+
+        // Whether the file existed and was loaded
+        bool loaded() const;
+
+        // Whether changes reach the file. False if it could not be opened or
+        // is not a journal; the file is then left alone and every change
+        // fails with ERROR_WRITE_FAULT
+        bool is_open() const;
+
+        // Rewrite the journal with the current keys and values only, to
+        // drop overwritten and deleted ones; false if it could not be
+        // written, in which case the old journal stays in use. Writers wait
+        // only while the new file replaces the old one
+        bool compact();
+
+    protected:
+        bool record(const change& c) override;
+
+    private:
+        std::string m_file_path;
+        bool m_loaded;
+        bool m_replaying;                 // Set while the constructor replays the file
+        std::ofstream m_journal;          // Appended to under m_journal_mutex
+        unsigned long long m_journal_size; // Bytes of whole records and header, ditto
+        std::mutex m_journal_mutex;
+        std::mutex m_compact_mutex;       // Serializes compact()
+
+        // Append one encoded record and flush it, taking back a partial
+        // write; caller holds m_journal_mutex
+        bool append(const std::vector<char>& record);
+};
+
+#endif // REG_BACKEND_H
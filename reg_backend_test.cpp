@@ -0,0 +1,254 @@
+#include "reg_backend.h"
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Test of reg_memory_backend and reg_file_backend
+//
+// Uses the standard library only, so it runs on any platform: keys and
+// values, change callbacks, readers racing a writer, and the journal of
+// reg_file_backend surviving a reopen, a torn last record and compact().
+// Exits non-zero on failure.
+//
+//   reg_backend_test [journal path]
+
+namespace
+{
+    const int loop_count = 200;
+
+    bool report(const char* label, bool passed)
+    {
+        std::printf("%-24s %s\n", label, passed ? "ok" : "FAIL");
+        return passed;
+    }
+
+    // Open key_path below the root, creating it if asked; nullptr on failure
+    reg_backend::key_id open(reg_backend& store, const char* key_path, bool create)
+    {
+        reg_backend::key_id key = nullptr;
+        return (store.open_key(store.root_key(), key_path, create, key) == ERROR_SUCCESS) ? key : nullptr;
+    }
+
+    bool set_text(reg_backend& store, reg_backend::key_id key, const char* name, const std::string& text)
+    {
+        return store.set(key, name, REG_SZ, text.c_str(), static_cast<DWORD>(text.size() + 1)) == ERROR_SUCCESS;
+    }
+
+    // Text of a value of key_path, or "<missing>"
+    std::string get_text(reg_backend& store, const char* key_path, const char* name)
+    {
+        reg_backend::key_id key = open(store, key_path, false);
+        if (key == nullptr)
+        {
+            return "<missing>";
+        }
+
+        char data[256] = {};
+        DWORD size = sizeof(data);
+        DWORD type = REG_NONE;
+        LONG result = store.query(key, name, &type, data, &size);
+        store.close_key(key);
+        return (result == ERROR_SUCCESS && type == REG_SZ) ? std::string(data) : "<missing>";
+    }
+
+    // Values, case-insensitive names, enumeration and deleting a tree
+    bool check_keys(reg_memory_backend& store)
+    {
+        reg_backend::key_id key = open(store, "Software\\App", true);
+        bool ok = key != nullptr;
+        ok = ok && set_text(store, key, "Name", "first") && set_text(store, key, "name", "second");
+        ok = ok && get_text(store, "software\\APP", "NAME") == "second";
+
+        DWORD value_count = 0;
+        ok = ok && store.info(key, nullptr, nullptr, &value_count, nullptr, nullptr) == ERROR_SUCCESS && value_count == 1;
+
+        char name[16] = {};
+        DWORD name_size = sizeof(name);
+        ok = ok && store.enum_value(key, 0, name, &name_size, nullptr, nullptr, nullptr) == ERROR_SUCCESS &&
+             std::string(name) == "Name";
+
+        ok = ok && store.remove(key, "name") == ERROR_SUCCESS && store.remove(key, "name") == ERROR_FILE_NOT_FOUND;
+        ok = ok && store.remove_tree(store.root_key(), "Software") == ERROR_SUCCESS;
+        ok = ok && set_text(store, key, "late", "x") == false && open(store, "Software", false) == nullptr;
+        if (key != nullptr)
+        {
+            store.close_key(key);
+        }
+        return report("keys", ok);
+    }
+
+    // A callback runs once per notify(), at the next change only
+    bool check_notify(reg_memory_backend& store)
+    {
+        reg_backend::key_id key = open(store, "notify", true);
+        int runs = 0;
+        bool ok = key != nullptr && store.notify(key, [&runs]() { ++runs; }) == ERROR_SUCCESS;
+        ok = ok && set_text(store, key, "a", "1") && set_text(store, key, "a", "2") && runs == 1;
+
+        // Dropped unrun when the key closes
+        reg_backend::key_id other = open(store, "notify", false);
+        ok = ok && other != nullptr && store.notify(other, [&runs]() { runs += 10; }) == ERROR_SUCCESS;
+        if (other != nullptr)
+        {
+            store.close_key(other);
+        }
+        ok = ok && set_text(store, key, "a", "3") && runs == 1;
+
+        if (key != nullptr)
+        {
+            store.close_key(key);
+        }
+        return report("notify", ok);
+    }
+
+    // Readers on several threads while a writer replaces the values
+    bool check_threads(reg_memory_backend& store)
+    {
+        reg_backend::key_id key = open(store, "threads", true);
+        bool ok = key != nullptr && set_text(store, key, "name", "a");
+
+        std::atomic<bool> stop(false);
+        std::atomic<int> bad(0);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; ++i)
+        {
+            readers.emplace_back([&]()
+            {
+                while (!stop)
+                {
+                    std::string name = get_text(store, "threads", "name");
+                    if (name != "a" && name != "b")
+                    {
+                        ++bad;
+                    }
+                }
+            });
+        }
+
+        for (int i = 0; i < loop_count * 10; ++i)
+        {
+            ok = ok && set_text(store, key, "name", (i % 2 == 0) ? "b" : "a");
+        }
+        stop = true;
+        for (std::thread& reader : readers)
+        {
+            reader.join();
+        }
+
+        if (key != nullptr)
+        {
+            store.close_key(key);
+        }
+        return report("threads", ok && bad == 0);
+    }
+
+    // Every change is in the journal when the call returns, without compact()
+    bool check_journal(const std::string& file_path)
+    {
+        std::error_code error;
+        std::filesystem::remove(file_path, error);
+        bool ok = true;
+        {
+            reg_file_backend store(file_path);
+            ok = store.is_open() && !store.loaded();
+            reg_backend::key_id key = open(store, "A\\B", true);
+            ok = ok && key != nullptr;
+            for (int i = 0; ok && i < loop_count; ++i)
+            {
+                ok = set_text(store, key, "n", std::to_string(i));
+            }
+            ok = ok && set_text(store, key, "gone", "x") && store.remove(key, "gone") == ERROR_SUCCESS;
+            reg_backend::key_id doomed = open(store, "A\\C\\D", true);
+            ok = ok && doomed != nullptr && store.remove_tree(store.root_key(), "a\\c") == ERROR_SUCCESS;
+            if (doomed != nullptr)
+            {
+                store.close_key(doomed);
+            }
+            if (key != nullptr)
+            {
+                store.close_key(key);
+            }
+        }
+
+        reg_file_backend reopened(file_path);
+        ok = ok && reopened.loaded() && reopened.is_open();
+        ok = ok && get_text(reopened, "a\\b", "n") == std::to_string(loop_count - 1);
+        ok = ok && get_text(reopened, "A\\B", "gone") == "<missing>" && open(reopened, "A\\C", false) == nullptr;
+        return report("journal", ok);
+    }
+
+    // A record cut short by a crash is dropped, and appends go on after the
+    // last whole one. The last record deleted A\C
+    bool check_torn(const std::string& file_path)
+    {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(file_path, error);
+        bool ok = !error && size > 3;
+        ok = ok && (std::filesystem::resize_file(file_path, size - 3, error), !error);
+        {
+            reg_file_backend store(file_path);
+            ok = ok && store.loaded() && get_text(store, "A\\B", "n") == std::to_string(loop_count - 1);
+            reg_backend::key_id torn = open(store, "A\\C\\D", false);
+            ok = ok && torn != nullptr;
+            if (torn != nullptr)
+            {
+                store.close_key(torn);
+            }
+
+            reg_backend::key_id key = open(store, "A\\B", false);
+            ok = ok && key != nullptr && set_text(store, key, "after", "torn");
+            if (key != nullptr)
+            {
+                store.close_key(key);
+            }
+        }
+
+        reg_file_backend reopened(file_path);
+        ok = ok && get_text(reopened, "A\\B", "after") == "torn";
+        return report("torn record", ok);
+    }
+
+    // compact() keeps the keys and values and shrinks the file
+    bool check_compact(const std::string& file_path)
+    {
+        std::error_code error;
+        uintmax_t before = std::filesystem::file_size(file_path, error);
+        bool ok = !error;
+        {
+            reg_file_backend store(file_path);
+            ok = ok && store.compact();
+            reg_backend::key_id key = open(store, "A\\B", false);
+            ok = ok && key != nullptr && set_text(store, key, "later", "kept");
+            if (key != nullptr)
+            {
+                store.close_key(key);
+            }
+        }
+
+        ok = ok && std::filesystem::file_size(file_path, error) < before;
+        reg_file_backend reopened(file_path);
+        ok = ok && get_text(reopened, "A\\B", "n") == std::to_string(loop_count - 1);
+        ok = ok && get_text(reopened, "A\\B", "after") == "torn" && get_text(reopened, "A\\B", "later") == "kept";
+        std::filesystem::remove(file_path, error);
+        return report("compact", ok);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string file_path = (argc > 1) ? argv[1] : "reg_backend_test.journal";
+    bool passed = true;
+    reg_memory_backend store;
+
+    passed = check_keys(store) && passed;
+    passed = check_notify(store) && passed;
+    passed = check_threads(store) && passed;
+    passed = check_journal(file_path) && passed;
+    passed = check_torn(file_path) && passed;
+    passed = check_compact(file_path) && passed;
+
+    return passed ? 0 : 1;
+}
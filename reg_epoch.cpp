@@ -0,0 +1,195 @@
+#include "reg_epoch.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Epoch-based reclamation for objects published to lock-free readers.
+    // A reader announces the global epoch in its own record on entry and
+    // clears it on exit; a retired object is freed once the epoch advanced
+    // twice past the one it was retired in, which needs every thread inside
+    // a guard to have announced the newer epoch, so none can still hold it.
+    // Readers write only their own cache line and never wait.
+    struct alignas(64) epoch_record
+    {
+        std::atomic<unsigned long long> active{0};   // Epoch entered in, 0 outside
+        std::atomic<bool> taken{false};               // Owned by a live thread
+        unsigned depth = 0;                           // Nested guards, owner only
+        epoch_record* next = nullptr;                 // Immutable once linked
+    };
+    
+    struct epoch_domain
+    {
+        struct retired
+        {
+            void* object;
+            void (*destroy)(void*);
+            unsigned long long epoch;
+        };
+        
+        std::atomic<unsigned long long> epoch{1};
+        std::atomic<epoch_record*> records{nullptr}; // Never unlinked
+        std::mutex mutex;                             // Guards garbage
+        std::vector<retired> garbage;
+        
+        // A free record, or a new one linked at the head
+        epoch_record* acquire_record()
+        {
+            for (epoch_record* record = records.load(); record != nullptr; record = record->next)
+            {
+                bool expected = false;
+                if (!record->taken.load(std::memory_order_relaxed) &&
+                    record->taken.compare_exchange_strong(expected, true))
+                {
+                    return record;
+                }
+            }
+            
+            epoch_record* record = new epoch_record();
+            record->taken = true;
+            epoch_record* head = records.load();
+            do
+            {
+                record->next = head;
+            } while (!records.compare_exchange_weak(head, record));
+            return record;
+        }
+        
+        // Advance when every thread inside a guard is in the current epoch;
+        // caller holds mutex
+        bool try_advance()
+        {
+            unsigned long long current = epoch.load();
+            for (epoch_record* record = records.load(); record != nullptr; record = record->next)
+            {
+                unsigned long long active = record->active.load();
+                if (active != 0 && active != current)
+                {
+                    return false;
+                }
+            }
+            epoch.store(current + 1);
+            return true;
+        }
+        
+        // Move what is safe to free out of garbage; caller holds mutex
+        void collect(std::vector<retired>& out)
+        {
+            unsigned long long current = epoch.load();
+            size_t kept = 0;
+            for (size_t i = 0; i < garbage.size(); ++i)
+            {
+                if (garbage[i].epoch + 2 <= current)
+                {
+                    out.push_back(garbage[i]);
+                }
+                else
+                {
+                    garbage[kept++] = garbage[i];
+                }
+            }
+            garbage.resize(kept);
+        }
+        
+        // Destroy outside the lock; a destructor may retire in turn
+        static void destroy_all(const std::vector<retired>& objects)
+        {
+            for (const retired& item : objects)
+            {
+                item.destroy(item.object);
+            }
+        }
+        
+        void retire(void* object, void (*destroy)(void*))
+        {
+            std::vector<retired> done;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                garbage.push_back({ object, destroy, epoch.load() });
+                try_advance();
+                collect(done);
+            }
+            destroy_all(done);
+        }
+        
+        // Free everything retired before the call, waiting for the readers
+        // that may still hold it; must not be called inside a guard
+        void synchronize()
+        {
+            unsigned long long target = epoch.load() + 2;
+            std::vector<retired> done;
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (epoch.load() < target)
+                    {
+                        try_advance();
+                    }
+                    collect(done);
+                    if (epoch.load() >= target)
+                    {
+                        break;
+                    }
+                }
+                std::this_thread::yield();
+            }
+            destroy_all(done);
+        }
+    };
+    
+    // Never destroyed, threads may retire until the process ends
+    epoch_domain& epochs()
+    {
+        static epoch_domain* instance = new epoch_domain();
+        return *instance;
+    }
+    
+    // The calling thread's record, handed back when the thread ends
+    struct epoch_slot
+    {
+        epoch_record* record = epochs().acquire_record();
+        
+        ~epoch_slot()
+        {
+            record->taken.store(false, std::memory_order_release);
+        }
+    };
+    
+    epoch_record& thread_epoch()
+    {
+        thread_local epoch_slot slot;
+        return *slot.record;
+    }
+}
+
+reg_epoch::guard::guard()
+{
+    epoch_record& record = thread_epoch();
+    if (record.depth++ == 0)
+    {
+        // seq_cst: the announcement is visible before any published pointer is read
+        record.active.store(epochs().epoch.load());
+    }
+}
+
+reg_epoch::guard::~guard()
+{
+    epoch_record& record = thread_epoch();
+    if (--record.depth == 0)
+    {
+        record.active.store(0, std::memory_order_release);
+    }
+}
+
+void reg_epoch::retire(void* object, void (*destroy)(void*))
+{
+    epochs().retire(object, destroy);
+}
+
+void reg_epoch::synchronize()
+{
+    epochs().synchronize();
+}
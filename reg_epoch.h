@@ -0,0 +1,44 @@
+#ifndef REG_EPOCH_H
+#define REG_EPOCH_H
+
+// Epoch-based reclamation for objects published to lock-free readers, used
+// by reg_api::shared and the backends. Readers pin their epoch with a
+// guard; writers swap the published pointer and retire the old object,
+// which is freed once no guard that could have seen it is left.
+// Standard library only.
+
+namespace reg_epoch
+{
+    // Pins the calling thread's epoch: objects retired while a guard is
+    // alive are not freed until it is gone. Nests; see reg_epoch.cpp
+    class guard
+    {
+        public:
+            guard();
+            ~guard();
+
+            guard(const guard&) = delete;
+            guard& operator=(const guard&) = delete;
+    };
+
+    // Free object with destroy once no reader can hold it. May run the
+    // destroy functions of earlier objects on the calling thread, so do
+    // not hold a lock their destructors take
+    void retire(void* object, void (*destroy)(void*));
+
+    // Free object with delete once no reader can hold it; see above
+    template<typename T>
+        void retire(const T* object)
+        {
+            if (object != nullptr)
+            {
+                retire(const_cast<T*>(object), [](void* p) { delete static_cast<T*>(p); });
+            }
+        }
+
+    // Free everything retired before the call, waiting for the readers that
+    // may still hold it; must not be called inside a guard
+    void synchronize();
+}
+
+#endif // REG_EPOCH_H
@@ -0,0 +1,46 @@
+#ifndef REG_PLATFORM_H
+#define REG_PLATFORM_H
+
+// Win32 types, error codes and value types shared by reg_api and the
+// backends. On Windows they come from <windows.h>. Elsewhere the subset
+// that reg_backend.h uses is defined here with the Win32 values, so the
+// backends build with the standard library alone.
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <cstdint>
+
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef unsigned char BYTE;
+
+// Opaque key handle, as in <windows.h>
+struct HKEY__;
+typedef HKEY__* HKEY;
+
+#define ERROR_SUCCESS               0L
+#define ERROR_FILE_NOT_FOUND        2L
+#define ERROR_INVALID_HANDLE        6L
+#define ERROR_NOT_ENOUGH_MEMORY     8L
+#define ERROR_INVALID_DATA          13L
+#define ERROR_WRITE_FAULT           29L
+#define ERROR_INVALID_PARAMETER     87L
+#define ERROR_MORE_DATA             234L
+#define ERROR_NO_MORE_ITEMS         259L
+#define ERROR_KEY_DELETED           1018L
+
+#define REG_NONE                    0
+#define REG_SZ                      1
+#define REG_EXPAND_SZ               2
+#define REG_BINARY                  3
+#define REG_DWORD                   4
+#define REG_MULTI_SZ                7
+#define REG_QWORD                   11
+
+#endif
+
+#endif // REG_PLATFORM_H